@@ -0,0 +1,31 @@
+# Runs gravity_sim_headless for twice STEPS steps, checkpointing half way, then restarts a second run from a snapshot taken half way and
+# checks both end with the same state hash. Called by ctest with HEADLESS, WORK_DIR, NAME, STEPS and OPTIONS (a list of extra options)
+
+function(run_headless output_var)
+
+    execute_process(COMMAND "${HEADLESS}" 2000 ${ARGN} ${OPTIONS} RESULT_VARIABLE result OUTPUT_VARIABLE output ERROR_VARIABLE error)
+    if (NOT result EQUAL 0)
+        message(FATAL_ERROR "gravity_sim_headless ${ARGN} ${OPTIONS} failed:\n${output}${error}")
+    endif()
+
+    string(REGEX MATCH "State hash: ([0-9a-f]+)" hash_line "${output}")
+    if (NOT hash_line)
+        message(FATAL_ERROR "gravity_sim_headless ${ARGN} ${OPTIONS} printed no state hash:\n${output}")
+    endif()
+    set(${output_var} "${CMAKE_MATCH_1}" PARENT_SCOPE)
+
+endfunction()
+
+set(half_snapshot "${WORK_DIR}/${NAME}_half.snap")
+set(whole_snapshot "${WORK_DIR}/${NAME}_whole.snap")
+math(EXPR whole_steps "${STEPS}*2")
+
+run_headless(unused ${STEPS} 0.016667 1 --checkpoint=${half_snapshot} --checkpoint-every=${STEPS})
+run_headless(restarted_hash ${STEPS} 0.016667 1 --restart=${half_snapshot})
+run_headless(continued_hash ${whole_steps} 0.016667 1 --checkpoint=${whole_snapshot} --checkpoint-every=${STEPS})
+file(REMOVE "${half_snapshot}" "${whole_snapshot}")
+
+if (NOT restarted_hash STREQUAL continued_hash)
+    message(FATAL_ERROR "The restarted run ended with state hash ${restarted_hash}, the run that went on ended with ${continued_hash}")
+endif()
+message(STATUS "Restarted and continued runs both ended with state hash ${continued_hash}")
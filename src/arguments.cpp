@@ -0,0 +1,82 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "arguments.hpp"
+
+namespace Arguments {
+
+    bool parse_count(const char *arg, const char *name, std::size_t &value) {
+
+        errno = 0;
+        char* end_ptr = NULL;
+
+        std::size_t parsed = std::strtoul(arg, &end_ptr, 10);
+
+        if (errno != 0 && parsed == 0) {
+            std::fprintf(stderr, "Error: Couldn't get number of %s: %s\n", name, strerror(errno));
+            return false;
+        }
+        else if (end_ptr == arg) {
+            std::fprintf(stderr, "Error: Number of %s is invalid (No digits found)!\n", name);
+            return false;
+        }
+        else if (parsed == 0) {
+            std::fprintf(stderr, "Error: Cannot use 0 %s!\n", name);
+            return false;
+        }
+
+        value = parsed;
+        return true;
+
+    }
+
+    bool parse_positive_float(const char *arg, const char *name, float &value) {
+
+        errno = 0;
+        char* end_ptr = NULL;
+
+        float parsed = std::strtof(arg, &end_ptr);
+
+        if (errno != 0) {
+            std::fprintf(stderr, "Error: Couldn't get %s: %s\n", name, strerror(errno));
+            return false;
+        }
+        else if (end_ptr == arg) {
+            std::fprintf(stderr, "Error: %s is invalid (No digits found)!\n", name);
+            return false;
+        }
+        else if (!(parsed > 0.f)) {
+            std::fprintf(stderr, "Error: %s must be greater than 0!\n", name);
+            return false;
+        }
+
+        value = parsed;
+        return true;
+
+    }
+
+    std::vector<const char*> positional(int argc, char** argv) {
+
+        std::vector<const char*> args;
+        for (int i = 1; i < argc; i++) {
+            if (std::strncmp(argv[i], "--", 2) != 0) args.push_back(argv[i]);
+        }
+        return args;
+
+    }
+
+    const char *find_option(int argc, char** argv, const char *name) {
+
+        std::size_t name_length = std::strlen(name);
+
+        for (int i = 1; i < argc; i++) {
+            if (std::strncmp(argv[i], "--", 2) != 0) continue;
+            if (std::strncmp(argv[i]+2, name, name_length) == 0 && argv[i][2+name_length] == '=') return argv[i]+3+name_length;
+        }
+        return NULL;
+
+    }
+
+}
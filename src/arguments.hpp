@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace Arguments {
+
+    //Parses a positive integer command line argument. Prints an error and returns false if the argument is invalid
+    bool parse_count(const char *arg, const char *name, std::size_t &value);
+
+    //Parses a positive floating point command line argument. Prints an error and returns false if the argument is invalid
+    bool parse_positive_float(const char *arg, const char *name, float &value);
+
+    //Every argument after the program name that isn't an option, in order
+    std::vector<const char*> positional(int argc, char** argv);
+
+    //Returns the value of an option given as --name=value, or NULL if it wasn't given
+    const char *find_option(int argc, char** argv, const char *name);
+
+}
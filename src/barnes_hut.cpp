@@ -1,180 +1,448 @@
+#include <algorithm>
 #include <array>
-#include <cassert>
-#include <limits>
-#include <memory>
+#include <cmath>
 #include <cstdio>
-#include <raylib.h>
 
 #include "barnes_hut.hpp"
 #include "particle.hpp"
 
+namespace {
+
+    //wrap for an offset between two points inside of the periodic box, which is never more than a period away from 0
+    inline float closest_image(float offset, float period, float half_period) {
+
+        if (offset > half_period) return offset - period;
+        if (offset < -half_period) return offset + period;
+        return offset;
+
+    }
+
+}
+
 namespace BarnesHut {
 
-    void Tree::insert_particle(Particle::Particle &particle) {
-
-        if (root_node == nullptr) {
-            root_node = std::make_unique<Node>();
-            
-            root_node->bounding_box.x_min = -5000.f;
-            root_node->bounding_box.x_max = 5000.f;
-            root_node->bounding_box.y_min = -5000.f;
-            root_node->bounding_box.y_max = 5000.f;
-            root_node->bounding_box.z_min = -5000.f;
-            root_node->bounding_box.z_max = 5000.f;
-        }
+    Vectors::Coordinate wrap(Vectors::Coordinate offset, float period) {
+
+        return offset - period*std::floor(offset/period + 0.5f);
+
+    }
+
+    void Tree::clear() {
+
+        nodes.clear();
+        node_depth = 0;
+        sorted_particles.clear();
+        groups.clear();
 
-        if (!root_node->bounding_box.is_point_inside(particle.position)) return;
+    }
+
+    float Tree::node_width(const Node &node) const {
 
-        root_node->insert_particle(particle);
+        return node.width;
 
     }
-    
-    void Tree::apply_gravity(Particle::Particle *const particles, std::size_t particle_idx, std::size_t n_particles, float G) const {
 
-        if (root_node == nullptr) return;
+    std::size_t Tree::particles_out_of_leaf() const {
 
-        root_node->apply_gravity(particles, particle_idx, n_particles, G);
+        return n_out_of_leaf;
 
     }
-    
-    void Tree::render() const {
 
-        if (root_node == nullptr) return;
+    float Tree::root_growth() const {
 
-        root_node->render();
+        return width_growth;
 
     }
-    
-    std::vector<Particle::Particle*> Tree::query(const Box &range) const {
 
-        if (root_node == nullptr) return {};
+    std::size_t Tree::particle_count() const {
 
-        std::vector<Particle::Particle*> found;
-        root_node->query(found, range);
+        return sorted_particles.size();
+
+    }
 
-        return found;
+    const Box &Tree::get_root_box() const {
+
+        return root_box;
 
     }
 
-    void Node::insert_particle(Particle::Particle &particle) {
+    std::uint32_t Tree::depth() const {
 
-        //Add the particle to the total mass and center of mass
-        mass += particle.mass;
-        position = position + particle.position*particle.mass;
+        return node_depth;
 
-        if (!has_particle) {
-            has_particle = true;
-            first_particle = &particle;
-            return;
-        }
-        else if (particle.position.dist(first_particle->position) < 0.001f) return;
+    }
 
-        //Else, create every sub node's bounding box to check the particle against
-        std::array<Box, 8> sub_boxes = create_sub_node_boxes();
+    const std::vector<Node> &Tree::get_nodes() const {
 
-        //Check which box the particle is within
-        std::size_t point_box_idx = std::numeric_limits<std::size_t>::max();
-        for (std::size_t i = 0; i < sub_boxes.size(); i++) {
-            if (sub_boxes[i].is_point_inside(particle.position)) {
-                point_box_idx = i;
-                break;
-            }
+        return nodes;
+
+    }
+
+    const std::vector<std::uint32_t> &Tree::get_sorted_particles() const {
+
+        return sorted_particles;
+
+    }
+
+    void Tree::add_source(const Node &node, const Vectors::Point &origin, Kernels::Sources &sources, Kernels::Multipoles &multipoles) const {
+
+        Vectors::Vec3 offset = node.position/node.mass - origin;
+        if (use_quadrupoles) {
+            multipoles.push_back(offset.x, offset.y, offset.z, node.mass, node.quadrupole);
         }
-        assert(point_box_idx != std::numeric_limits<std::size_t>::max());
-
-        //Continue from the node the particle is within
-        
-        if (sub_nodes[point_box_idx] == nullptr) {
-            has_sub_nodes = true;
-            sub_nodes[point_box_idx] = std::make_unique<Node>();
-            sub_nodes[point_box_idx]->bounding_box = sub_boxes[point_box_idx];
+        else {
+            sources.push_back(offset.x, offset.y, offset.z, node.mass);
         }
 
-        sub_nodes[point_box_idx]->insert_particle(particle);
+    }
+
+    WalkCost Tree::apply_gravity(Particle::Store &particles, std::size_t particle_idx, const Kernels::Parameters &gravity, Kernels::Sources &sources,
+            Kernels::Multipoles &multipoles) const {
+
+        if (boundary == Boundary::periodic) return apply_periodic_gravity(particles, particle_idx, gravity, sources, multipoles);
 
+        WalkCost cost;
+        if (nodes.empty()) return cost;
 
-        if (reinserted_first_particle) return;
+        Vectors::Point particle_position = particles.position(particle_idx);
+        sources.clear();
+        multipoles.clear();
 
-        //Do the same with the first particle, to re insert it into one of the sub nodes
-        point_box_idx = std::numeric_limits<std::size_t>::max();
-        for (std::size_t i = 0; i < sub_boxes.size(); i++) {
-            if (sub_boxes[i].is_point_inside(first_particle->position)) {
-                point_box_idx = i;
-                break;
+        //Depth first, without recursion. Every level pushes at most 8 nodes
+        std::array<std::uint32_t, 8*(max_depth+1)> stack;
+        std::size_t stack_size = 0;
+        stack[stack_size++] = 0;
+
+        while (stack_size > 0) {
+
+            const Node &node = nodes[stack[--stack_size]];
+            cost.node_visits++;
+
+            Vectors::Point center_of_mass = node.position/node.mass;
+            float bounding_box_width = node_width(node);
+
+            float ratio = bounding_box_width / particle_position.dist(center_of_mass);
+            if (ratio <= theta && node.particle_end - node.particle_begin > 1) {
+                //If the ratio is <= theta, the node is sufficiently far away, and will be simplified to only be its mass (and quadrupole) at center_of_mass
+                add_source(node, particle_position, sources, multipoles);
+            }
+            else if (!node.has_sub_nodes) {
+                //A leaf that is too close, or holds a single particle, is summed particle by particle. A single particle is never used through
+                //its COM, which is off by a rounding error and would make the particle pull on itself
+                for (std::uint32_t i = node.particle_begin; i < node.particle_end; i++) {
+                    std::uint32_t source_idx = sorted_particles[i];
+                    Vectors::Vec3 offset = particles.position(source_idx) - particle_position;
+                    sources.push_back(offset.x, offset.y, offset.z, particles.mass[source_idx]);
+                }
+            }
+            else {
+                //Apply gravity using all of the existing sub nodes. Pushed in reverse, so they're visited in order
+                for (std::size_t i = node.sub_nodes.size(); i-- > 0;) {
+                    if (node.sub_nodes[i] != no_node) stack[stack_size++] = node.sub_nodes[i];
+                }
             }
+
         }
-        assert(point_box_idx != std::numeric_limits<std::size_t>::max());
 
-        if (sub_nodes[point_box_idx] == nullptr) {
-            sub_nodes[point_box_idx] = std::make_unique<Node>();
-            sub_nodes[point_box_idx]->bounding_box = sub_boxes[point_box_idx];
+        Kernels::accumulate_gravity(sources, 0.f, 0.f, 0.f, gravity, particles.ax[particle_idx], particles.ay[particle_idx], particles.az[particle_idx]);
+        if (multipoles.size() > 0) {
+            Kernels::accumulate_gravity(multipoles, 0.f, 0.f, 0.f, gravity, particles.ax[particle_idx], particles.ay[particle_idx], particles.az[particle_idx]);
         }
 
-        sub_nodes[point_box_idx]->insert_particle(*first_particle);
-        
-        reinserted_first_particle = true;
+        cost.interactions = sources.size() + multipoles.size();
+        return cost;
 
     }
 
-    void Node::apply_gravity(Particle::Particle *const particles, std::size_t particle_idx, std::size_t n_particles, float G) const {
+    WalkCost Tree::apply_periodic_gravity(Particle::Store &particles, std::size_t particle_idx, const Kernels::Parameters &gravity,
+            Kernels::Sources &sources, Kernels::Multipoles &multipoles) const {
+
+        WalkCost cost;
+        if (nodes.empty()) return cost;
+
+        Vectors::Point particle_position = particles.position(particle_idx);
+        float half_period = 0.5f*period;
+        sources.clear();
+        multipoles.clear();
+
+        //The Ewald correction of every source, times its mass. It changes slowly enough that a node can always use the correction of its
+        //center of mass, even when the node is close
+        float correction_x = 0.f, correction_y = 0.f, correction_z = 0.f;
+        auto add_correction = [&](float dx, float dy, float dz, float mass) {
+            float cx, cy, cz;
+            ewald_table.correction(dx, dy, dz, cx, cy, cz);
+            correction_x += mass*cx;
+            correction_y += mass*cy;
+            correction_z += mass*cz;
+        };
+
+        std::array<std::uint32_t, 8*(max_depth+1)> stack;
+        std::size_t stack_size = 0;
+        stack[stack_size++] = 0;
+
+        while (stack_size > 0) {
+
+            const Node &node = nodes[stack[--stack_size]];
+            cost.node_visits++;
+
+            //The node as seen through the image of its center of mass closest to the particle. Every other image of the particle is further
+            //from it than the particle itself, so the same test as apply_gravity keeps it far enough from all of them
+            Vectors::Vec3 com_offset = node.position/node.mass - particle_position;
+            float dx = closest_image(com_offset.x, period, half_period);
+            float dy = closest_image(com_offset.y, period, half_period);
+            float dz = closest_image(com_offset.z, period, half_period);
+            float dist = std::sqrt(dx*dx + dy*dy + dz*dz);
+
+            if (node_width(node) <= theta*dist && node.particle_end - node.particle_begin > 1) {
+                if (use_quadrupoles) {
+                    multipoles.push_back(dx, dy, dz, node.mass, node.quadrupole);
+                }
+                else {
+                    sources.push_back(dx, dy, dz, node.mass);
+                }
+                add_correction(dx, dy, dz, node.mass);
+            }
+            else if (!node.has_sub_nodes) {
+                //Every particle pulls through its own closest image. If all of the leaf is within half a period of the particle, that's the
+                //same image for all of them, and the leaf's correction is used for all of them at once
+                float half_width = 0.5f*node_width(node);
+                Vectors::Vec3 center_offset = node.center - particle_position;
+                bool is_one_image = std::fabs(closest_image(center_offset.x, period, half_period)) + half_width <= half_period &&
+                        std::fabs(closest_image(center_offset.y, period, half_period)) + half_width <= half_period &&
+                        std::fabs(closest_image(center_offset.z, period, half_period)) + half_width <= half_period;
+                if (is_one_image) add_correction(dx, dy, dz, node.mass);
+
+                for (std::uint32_t i = node.particle_begin; i < node.particle_end; i++) {
+                    std::uint32_t source_idx = sorted_particles[i];
+                    Vectors::Vec3 offset = particles.position(source_idx) - particle_position;
+                    float source_dx = closest_image(offset.x, period, half_period);
+                    float source_dy = closest_image(offset.y, period, half_period);
+                    float source_dz = closest_image(offset.z, period, half_period);
+                    sources.push_back(source_dx, source_dy, source_dz, particles.mass[source_idx]);
+                    if (!is_one_image) add_correction(source_dx, source_dy, source_dz, particles.mass[source_idx]);
+                }
+            }
+            else {
+                for (std::size_t i = node.sub_nodes.size(); i-- > 0;) {
+                    if (node.sub_nodes[i] != no_node) stack[stack_size++] = node.sub_nodes[i];
+                }
+            }
 
-        Vectors::Vec3 center_of_mass = position/mass;
-        float bounding_box_width = bounding_box.x_max - bounding_box.x_min; //Assumes the box to be equally wide in every axis
+        }
 
-        float ratio = bounding_box_width / particles[particle_idx].position.dist(center_of_mass);
-        if (ratio <= 1.f || !has_sub_nodes) {
-            //If the ratio is <= 1, the node is sufficiently far away, and will be simplified to only be a point with pos = center_of_mass, and mass = mass
-            //Also, if the node has no sub nodes, then there is no option but to use it's COM and mass
-            
-            if (center_of_mass.dist(particles[particle_idx].position) < 0.1f) return;
+        float &ax = particles.ax[particle_idx], &ay = particles.ay[particle_idx], &az = particles.az[particle_idx];
+        Kernels::accumulate_gravity(sources, 0.f, 0.f, 0.f, gravity, ax, ay, az);
+        if (multipoles.size() > 0) Kernels::accumulate_gravity(multipoles, 0.f, 0.f, 0.f, gravity, ax, ay, az);
+        ax += gravity.G*correction_x;
+        ay += gravity.G*correction_y;
+        az += gravity.G*correction_z;
 
-            Particle::Particle node_particle;
-            node_particle.mass = mass;
-            node_particle.position = center_of_mass;
-            particles[particle_idx].apply_gravity(node_particle, G);
-        }
-        else {
-            //Apply gravity using all of the existing sub nodes
-            for (std::size_t i = 0; i < sub_nodes.size(); i++) {
-                if (sub_nodes[i] != nullptr) sub_nodes[i]->apply_gravity(particles, particle_idx, n_particles, G);
+        cost.interactions = sources.size() + multipoles.size();
+        return cost;
+
+    }
+
+    WalkCost Tree::apply_short_range_gravity(Particle::Store &particles, std::size_t particle_idx, const Kernels::Parameters &gravity,
+            const Kernels::ShortRange &short_range, Kernels::Sources &sources) const {
+
+        WalkCost cost;
+        if (nodes.empty()) return cost;
+
+        Vectors::Point particle_position = particles.position(particle_idx);
+        float half_period = 0.5f*period;
+        float cutoff_sq = short_range.cutoff()*short_range.cutoff();
+        sources.clear();
+
+        std::array<std::uint32_t, 8*(max_depth+1)> stack;
+        std::size_t stack_size = 0;
+        stack[stack_size++] = 0;
+
+        while (stack_size > 0) {
+
+            const Node &node = nodes[stack[--stack_size]];
+            cost.node_visits++;
+
+            //Distance from the particle to the closest point of the closest image of the node's cube
+            float half_width = 0.5f*node_width(node);
+            Vectors::Vec3 center_offset = node.center - particle_position;
+            float gap_x = std::max(0.f, std::fabs(closest_image(center_offset.x, period, half_period)) - half_width);
+            float gap_y = std::max(0.f, std::fabs(closest_image(center_offset.y, period, half_period)) - half_width);
+            float gap_z = std::max(0.f, std::fabs(closest_image(center_offset.z, period, half_period)) - half_width);
+            if (gap_x*gap_x + gap_y*gap_y + gap_z*gap_z > cutoff_sq) continue;
+
+            Vectors::Vec3 com_offset = node.position/node.mass - particle_position;
+            float dx = closest_image(com_offset.x, period, half_period);
+            float dy = closest_image(com_offset.y, period, half_period);
+            float dz = closest_image(com_offset.z, period, half_period);
+            float dist = std::sqrt(dx*dx + dy*dy + dz*dz);
+
+            if (node_width(node) <= theta*dist && node.particle_end - node.particle_begin > 1) {
+                sources.push_back(dx, dy, dz, node.mass);
+            }
+            else if (!node.has_sub_nodes) {
+                for (std::uint32_t i = node.particle_begin; i < node.particle_end; i++) {
+                    std::uint32_t source_idx = sorted_particles[i];
+                    Vectors::Vec3 offset = particles.position(source_idx) - particle_position;
+                    sources.push_back(closest_image(offset.x, period, half_period), closest_image(offset.y, period, half_period),
+                            closest_image(offset.z, period, half_period), particles.mass[source_idx]);
+                }
             }
+            else {
+                for (std::size_t i = node.sub_nodes.size(); i-- > 0;) {
+                    if (node.sub_nodes[i] != no_node) stack[stack_size++] = node.sub_nodes[i];
+                }
+            }
+
         }
 
+        Kernels::accumulate_short_range_gravity(sources, 0.f, 0.f, 0.f, gravity, short_range, particles.ax[particle_idx], particles.ay[particle_idx],
+                particles.az[particle_idx]);
+
+        cost.interactions = sources.size();
+        return cost;
+
     }
-    
-    void Node::render() const {
 
-        for (std::size_t i = 0; i < sub_nodes.size(); i++) {
-            if (sub_nodes[i] == nullptr) continue;
-            sub_nodes[i]->render();
+    void Tree::build_groups(std::size_t max_group_size) {
+
+        groups.clear();
+
+        std::uint32_t n_inside = 0;
+        if (!nodes.empty()) {
+
+            n_inside = nodes[0].particle_end;
+
+            std::array<std::uint32_t, 8*(max_depth+1)> stack;
+            std::size_t stack_size = 0;
+            stack[stack_size++] = 0;
+
+            while (stack_size > 0) {
+
+                const Node &node = nodes[stack[--stack_size]];
+
+                if (node.particle_end - node.particle_begin <= max_group_size || !node.has_sub_nodes) {
+                    groups.push_back({node.particle_begin, node.particle_end});
+                    continue;
+                }
+
+                for (std::size_t i = node.sub_nodes.size(); i-- > 0;) {
+                    if (node.sub_nodes[i] != no_node) stack[stack_size++] = node.sub_nodes[i];
+                }
+
+            }
+
+        }
+
+        //Particles outside of the root box can be anywhere, so grouping them would only make the bounding boxes huge
+        for (std::uint32_t i = n_inside; i < sorted_particles.size(); i++) {
+            groups.push_back({i, i+1});
+        }
+
+        particle_groups.resize(sorted_particles.size());
+        for (std::size_t g = 0; g < groups.size(); g++) {
+            for (std::uint32_t k = groups[g].particle_begin; k < groups[g].particle_end; k++) particle_groups[sorted_particles[k]] = static_cast<std::uint32_t>(g);
         }
 
-        Vectors::Vec3 bounding_box_min = {bounding_box.x_min, bounding_box.y_min, bounding_box.z_min};
-        Vectors::Vec3 bounding_box_max = {bounding_box.x_max, bounding_box.y_max, bounding_box.z_max};
+    }
+
+    std::size_t Tree::group_count() const {
+
+        return groups.size();
+
+    }
+
+    const Group &Tree::get_group(std::size_t group_idx) const {
 
-        Vectors::Vec3 node_center = bounding_box_min.lerp(bounding_box_max, 0.5f);
-        DrawCubeWires(node_center, bounding_box.x_max-bounding_box.x_min, bounding_box.y_max-bounding_box.y_min, bounding_box.z_max-bounding_box.z_min, WHITE);
+        return groups[group_idx];
 
     }
-    
-    void Node::query(std::vector<Particle::Particle*> &found, const Box &range) const {
 
-        if (!bounding_box.overlaps(range)) return;
+    std::uint32_t Tree::group_of(std::size_t particle_idx) const {
+
+        return particle_groups[particle_idx];
+
+    }
+
+    WalkCost Tree::apply_gravity_to_group(Particle::Store &particles, std::size_t group_idx, const Kernels::Parameters &gravity, Kernels::Sources &sources,
+            Kernels::Multipoles &multipoles, const std::uint8_t *is_active) const {
+
+        const Group &group = groups[group_idx];
+        WalkCost cost;
+
+        Box group_box = {particles.x[sorted_particles[group.particle_begin]], particles.y[sorted_particles[group.particle_begin]],
+            particles.z[sorted_particles[group.particle_begin]], 0.f, 0.f, 0.f};
+        group_box.x_max = group_box.x_min;
+        group_box.y_max = group_box.y_min;
+        group_box.z_max = group_box.z_min;
+        for (std::uint32_t i = group.particle_begin+1; i < group.particle_end; i++) {
+            std::uint32_t particle_idx = sorted_particles[i];
+            group_box.x_min = std::min(group_box.x_min, particles.x[particle_idx]);
+            group_box.y_min = std::min(group_box.y_min, particles.y[particle_idx]);
+            group_box.z_min = std::min(group_box.z_min, particles.z[particle_idx]);
+            group_box.x_max = std::max(group_box.x_max, particles.x[particle_idx]);
+            group_box.y_max = std::max(group_box.y_max, particles.y[particle_idx]);
+            group_box.z_max = std::max(group_box.z_max, particles.z[particle_idx]);
+        }
+
+        //Every source and particle of the group is an offset from here
+        Vectors::Point origin = {group_box.x_min + (group_box.x_max - group_box.x_min)*0.5f, group_box.y_min + (group_box.y_max - group_box.y_min)*0.5f,
+            group_box.z_min + (group_box.z_max - group_box.z_min)*0.5f};
 
-        if (!reinserted_first_particle && range.is_particle_maybe_inside(*first_particle)) found.push_back(first_particle);
+        sources.clear();
+        multipoles.clear();
 
-        if (found.size() % 2 == 0) {
-            for (std::size_t i = 0; i < sub_nodes.size(); i++) {
-                if (sub_nodes[i] != nullptr) sub_nodes[i]->query(found, range);
+        std::array<std::uint32_t, 8*(max_depth+1)> stack;
+        std::size_t stack_size = 0;
+        if (!nodes.empty()) stack[stack_size++] = 0;
+
+        while (stack_size > 0) {
+
+            const Node &node = nodes[stack[--stack_size]];
+            cost.node_visits++;
+
+            Vectors::Point center_of_mass = node.position/node.mass;
+
+            //Distance from the center of mass to the closest point of the group's bounding box, which is the closest any particle of the group can be
+            float dx = static_cast<float>(std::max<Vectors::Coordinate>(0.f, std::max(group_box.x_min - center_of_mass.x, center_of_mass.x - group_box.x_max)));
+            float dy = static_cast<float>(std::max<Vectors::Coordinate>(0.f, std::max(group_box.y_min - center_of_mass.y, center_of_mass.y - group_box.y_max)));
+            float dz = static_cast<float>(std::max<Vectors::Coordinate>(0.f, std::max(group_box.z_min - center_of_mass.z, center_of_mass.z - group_box.z_max)));
+            float dist = std::sqrt(dx*dx + dy*dy + dz*dz);
+
+            if (node_width(node) <= theta*dist && node.particle_end - node.particle_begin > 1) {
+                //Same as the width/dist <= theta of apply_gravity, for the closest particle of the group
+                add_source(node, origin, sources, multipoles);
+            }
+            else if (!node.has_sub_nodes) {
+                for (std::uint32_t i = node.particle_begin; i < node.particle_end; i++) {
+                    std::uint32_t particle_idx = sorted_particles[i];
+                    Vectors::Vec3 offset = particles.position(particle_idx) - origin;
+                    sources.push_back(offset.x, offset.y, offset.z, particles.mass[particle_idx]);
+                }
             }
+            else {
+                for (std::size_t i = node.sub_nodes.size(); i-- > 0;) {
+                    if (node.sub_nodes[i] != no_node) stack[stack_size++] = node.sub_nodes[i];
+                }
+            }
+
         }
-        else {
-            for (std::size_t i = sub_nodes.size()-1; i >= 0; i--) {
-                if (sub_nodes[i] != nullptr) sub_nodes[i]->query(found, range);
-                if (i == 0) break;
+
+        for (std::uint32_t i = group.particle_begin; i < group.particle_end; i++) {
+            std::uint32_t particle_idx = sorted_particles[i];
+            if (is_active && !is_active[particle_idx]) continue;
+
+            Vectors::Vec3 offset = particles.position(particle_idx) - origin;
+            Kernels::accumulate_gravity(sources, offset.x, offset.y, offset.z, gravity, particles.ax[particle_idx], particles.ay[particle_idx],
+                    particles.az[particle_idx]);
+            if (multipoles.size() > 0) {
+                Kernels::accumulate_gravity(multipoles, offset.x, offset.y, offset.z, gravity, particles.ax[particle_idx], particles.ay[particle_idx],
+                        particles.az[particle_idx]);
             }
+            cost.interactions += sources.size() + multipoles.size();
         }
 
+        return cost;
+
     }
 
 }
@@ -1,10 +1,16 @@
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <vector>
 
-#include "particle.hpp"
+#include "ewald.hpp"
+#include "gravity_kernels.hpp"
+#include "parallel.hpp"
+#include "particle_store.hpp"
 #include "vectors.hpp"
 
 namespace BarnesHut {
@@ -18,67 +24,225 @@ namespace BarnesHut {
     constexpr std::size_t bottom_back_left_idx = 6;
     constexpr std::size_t bottom_back_right_idx = 7;
 
-    //Assumed to be axis aligned
+    //The root is never a sub node of anything, so index 0 doubles as "no sub node"
+    constexpr std::uint32_t no_node = 0;
+
+    //Morton keys use 21 bits per axis, so no node is deeper than this
+    constexpr std::uint32_t max_depth = 21;
+
+    //What lies beyond the particles. open is empty space, and the root box is fit around the particles.
+    //periodic is a cube of width period around the origin repeating forever, with the particles and every one of their images in it.
+    //Every particle pulls through its closest image, and the Ewald correction adds the pull of every other image
+    enum class Boundary {
+        open,
+        periodic
+    };
+
+    //The closest image of offset to 0 for a box of width period, in [-period/2, period/2]
+    Vectors::Coordinate wrap(Vectors::Coordinate offset, float period);
+
+    //Assumed to be axis aligned. In the coordinates of the particles
     class Box {
 
     public:
-        float x_min, y_min, z_min;
-        float x_max, y_max, z_max;
+        Vectors::Coordinate x_min, y_min, z_min;
+        Vectors::Coordinate x_max, y_max, z_max;
 
-        bool is_point_inside(const Vectors::Vec3 &p) const;
-        bool is_particle_maybe_inside(const Particle::Particle &particle) const;
-        bool overlaps(const Box &box) const;
+        bool is_point_inside(const Vectors::Point &p) const;
 
     };
 
+    //Nodes are stored in one contiguous array owned by the Tree, and refer to each other and to particles by index
     class Node {
 
-        bool has_particle = false;  //Has the node recieved a particle thus far?
-        bool has_sub_nodes = false; //Does the node have any allocated sub nodes?
-        
-        //The first particle to be inserted into the node. Important for when a second particle gets inserted, since then the first one must be re-inserted
-        Particle::Particle *first_particle;
-        bool reinserted_first_particle = false; //Has the first particle been re-inserted yet?
-        
-        Vectors::Vec3 position = {0.f, 0.f, 0.f}; //Weighted by the mass of every particle within the node
+    public:
+        Vectors::Point position = {0.f, 0.f, 0.f}; //Weighted by the mass of every particle within the node
         float mass = 0.f;
+        Kernels::Quadrupole quadrupole; //Around the center of mass
 
-        Box bounding_box;
+        //The node is a cube around center, the root's width halved once per level of depth
+        Vectors::Point center = {0.f, 0.f, 0.f};
+        std::uint32_t depth = 0;
+        //Width of the cube around center holding every particle of the node. The width of the node's level, unless the tree was refit
+        //and particles have moved out of it since it was built
+        float width = 0.f;
 
-        std::array<Box, 8> create_sub_node_boxes() const;
+        std::uint32_t parent = no_node;
 
-    public:
+        //The particles within the node are sorted_particles[particle_begin] to sorted_particles[particle_end-1] of the tree.
+        //A leaf holds at most the tree's leaf_size particles, or more if they're too close together to be told apart
+        std::uint32_t particle_begin = 0;
+        std::uint32_t particle_end = 0;
 
-        //A 3D barnes hut tree is an octtree
-        std::array< std::unique_ptr<Node>, 8 > sub_nodes;
+        bool has_sub_nodes = false; //Does the node have any allocated sub nodes?
 
-        inline Node() {
-            for (std::size_t i = 0; i < sub_nodes.size(); i++) sub_nodes[i] = nullptr;
-        }
-        
-        void insert_particle(Particle::Particle &particle);
-        void apply_gravity(Particle::Particle *const particles, std::size_t particle_idx, std::size_t n_particles, float G) const;
+        //A 3D barnes hut tree is an octtree. Indices into the tree's node array, or no_node
+        std::array<std::uint32_t, 8> sub_nodes;
 
-        void query(std::vector<Particle::Particle*> &found, const Box &range) const;
-        
-        void render() const;
+    };
 
-        friend class Tree;
+    //What walking the tree cost, for profiling
+    class WalkCost {
 
-    };
+    public:
+        std::size_t node_visits = 0;
+        std::size_t interactions = 0;   //Particles and nodes that pulled on a particle, summed over the particles that got gravity
 
-    class Tree {
+    };
 
-        std::unique_ptr<Node> root_node = nullptr;
+    //Particles that share one walk of the tree, sorted_particles[particle_begin] to sorted_particles[particle_end-1] of the tree.
+    //Since the particles are sorted by morton key, the particles of a group are always close together
+    class Group {
 
     public:
+        std::uint32_t particle_begin;
+        std::uint32_t particle_end;
 
-        void insert_particle(Particle::Particle &particle);
-        void apply_gravity(Particle::Particle *const particles, std::size_t particle_idx, std::size_t n_particles, float G) const;
+    };
 
-        std::vector<Particle::Particle*> query(const Box &range) const;
+    class Tree {
+
+        //Everything below is kept between builds, so that rebuilding the tree every step doesn't allocate once the arrays have grown large enough
+
+        std::vector<Node> nodes;
+        std::uint32_t node_depth = 0; //Depth of the deepest node, recorded while building
+
+        //A padded cube around every particle, recomputed on every build. Only particles without a finite position end up outside of it
+        Box root_box;
+        std::vector<Box> chunk_boxes; //Bounds of the particles of every chunk of the pool, merged into the root box
+        std::vector<float> level_widths; //Width of the nodes at every depth, so the width of a node is a lookup instead of a division
+
+        //Particle indices sorted by their morton key. Particles outside of the root box are sorted last and aren't part of any node
+        std::vector<std::uint64_t> keys;
+        std::vector<std::uint32_t> sorted_particles;
+        std::vector<std::uint64_t> keys_scratch;
+        std::vector<std::uint32_t> sorted_particles_scratch;
+        std::vector<std::uint32_t> radix_counts;
+
+        //Binary radix tree over the sorted keys, built first and then collapsed into the octree. Leaves are the particles themselves
+        std::vector<std::uint32_t> binary_first, binary_last;
+        std::vector<std::uint32_t> binary_left, binary_right; //Children, with binary_leaf_flag set if the child is a leaf
+        std::vector<std::uint32_t> binary_parent, leaf_parent;
+        std::vector<std::uint32_t> binary_prefix; //Number of leading key bits every key in the node has in common
+        std::vector<std::uint32_t> node_offsets; //Where every binary node's (and then every leaf's) octree nodes start in nodes
+
+        std::unique_ptr<std::atomic<std::uint32_t>[]> visit_counts;
+        std::size_t visit_counts_size = 0;
+
+        std::vector<Group> groups;
+        std::vector<std::uint32_t> particle_groups; //The group of every particle, by index
+
+        Ewald::Table ewald_table;   //Built for the period by the first build with a periodic boundary
+
+        //How well the nodes still fit the particles, measured by every build and refit
+        std::size_t n_out_of_leaf = 0;
+        float width_growth = 1.f;
+
+        void compute_root_box(const Particle::Store &particles, Parallel::ThreadPool &pool);
+        void sort_keys(Parallel::ThreadPool &pool);
+        void build_binary_tree(std::size_t n_keys, Parallel::ThreadPool &pool);
+        void build_octree(std::size_t n_keys, Parallel::ThreadPool &pool);
+
+        //Calls on_leaf(leaf) for every leaf and then on_parent(node) for every node above, each only once all of its sub nodes are done, on
+        //every thread of the pool. Returns the sum of what on_leaf returned
+        template<typename LeafF, typename ParentF>
+        std::size_t for_each_node_upwards(Parallel::ThreadPool &pool, LeafF on_leaf, ParentF on_parent);
+        //The two halves of summing up the nodes: how wide they have to be to hold their particles, and their mass, center of mass and quadrupole
+        std::size_t fit_leaf(Node &leaf, const Particle::Store &particles) const;
+        void fit_parent(Node &parent) const;
+        void sum_leaf(Node &leaf, const Particle::Store &particles) const;
+        void sum_parent(Node &parent) const;
+        void measure_fit(std::size_t out_of_leaf_count);
+
+        std::uint32_t octree_parent(std::uint32_t binary_parent_idx) const;
+        //A node that is used as a whole, at its offset from origin
+        void add_source(const Node &node, const Vectors::Point &origin, Kernels::Sources &sources, Kernels::Multipoles &multipoles) const;
+        Vectors::Point node_center(std::uint64_t key, std::uint32_t depth) const;
+
+        WalkCost apply_periodic_gravity(Particle::Store &particles, std::size_t particle_idx, const Kernels::Parameters &gravity, Kernels::Sources &sources,
+                Kernels::Multipoles &multipoles) const;
+
+    public:
 
-        void render() const;        
+        //A node is used as a whole if its width is at most theta times its distance. Smaller is more accurate, and slower
+        float theta = 1.f;
+        //Whether the nodes used as a whole pull with their quadrupole moment as well as their mass. Much more accurate for the same theta
+        bool use_quadrupoles = true;
+        //Nodes with at most this many particles aren't split any further. Their particles are summed directly when the leaf is too close
+        //to be used as a whole, which is cheaper than walking down to one particle per leaf for small numbers of particles
+        std::size_t leaf_size = 16;
+
+        //With a periodic boundary the root box is always the periodic cube, and every particle is expected to be inside of it. Only
+        //apply_gravity knows about the images, groups and the FMM see the open tree
+        Boundary boundary = Boundary::open;
+        float period = 0.f;
+
+        void clear();
+
+        //Rebuilds the tree from scratch: the root box is fit around the particles, morton keys are computed for every particle, radix sorted,
+        //turned into a binary radix tree and then collapsed into the octree, using every thread of the pool for every stage
+        void build(const Particle::Store &particles, Parallel::ThreadPool &pool);
+
+        //Recomputes the mass, center of mass and quadrupole of every node from where the particles are now, keeping the nodes themselves.
+        //Much cheaper than build, but the nodes fit the particles less and less well as they move away from where they were built.
+        //Particles that left the cell of their leaf stay in it, and the leaf and every node above it grow to still hold them.
+        //The same as fit and then refit_mass
+        void refit(const Particle::Store &particles, Parallel::ThreadPool &pool);
+        //The first half of refit: grows the nodes to hold the particles where they are now, and measures particles_out_of_leaf and root_growth.
+        //Much cheaper than recomputing the mass, so a tree that doesn't fit well enough anymore can be rebuilt without paying for a refit first.
+        //The mass of the nodes is out of date until refit_mass or build
+        void fit(const Particle::Store &particles, Parallel::ThreadPool &pool);
+        //The second half of refit, for a tree that was just fit to the particles where they are now
+        void refit_mass(const Particle::Store &particles, Parallel::ThreadPool &pool);
+
+        //The number of particles outside of the cell of their leaf, and how many times wider than the root box the root has grown,
+        //as of the last build or refit. A tree that was just built has none and 1
+        std::size_t particles_out_of_leaf() const;
+        float root_growth() const;
+        //The number of particles the tree was built from. A refit expects the same particles
+        std::size_t particle_count() const;
+
+        //Walks the tree for one particle, collecting every node that is far enough away to be used as a whole into multipoles (or into
+        //sources if quadrupoles aren't used), and the particles of every leaf that isn't into sources, which are then handed to the gravity kernels.
+        //Every source is stored as its offset from the particle, so the kernels only ever see small floats however far out the particle is.
+        //sources and multipoles are only scratch space, passed in so they can be reused between particles.
+        //With a periodic boundary, every node and particle is seen through its image closest to the particle, and the Ewald correction of
+        //every source is added as well
+        WalkCost apply_gravity(Particle::Store &particles, std::size_t particle_idx, const Kernels::Parameters &gravity, Kernels::Sources &sources,
+                Kernels::Multipoles &multipoles) const;
+
+        //The short range part of gravity for TreePM, for a periodic boundary only. Nodes whose cube is entirely further away from the particle
+        //than the cutoff are skipped, and everything else is collected as for apply_gravity, with every node as a point mass, since the
+        //quadrupole is of little use this close
+        WalkCost apply_short_range_gravity(Particle::Store &particles, std::size_t particle_idx, const Kernels::Parameters &gravity,
+                const Kernels::ShortRange &short_range, Kernels::Sources &sources) const;
+
+        //Splits the particles into groups for apply_gravity_to_group. Every group is the largest node with at most max_group_size particles
+        //(or a leaf with more), and every particle outside of the root box is a group of its own. Expects the tree to be built
+        void build_groups(std::size_t max_group_size);
+        std::size_t group_count() const;
+
+        //Walks the tree once for every particle of a group. A node is used as a point mass if it's far enough away from the bounding box
+        //of the whole group, which makes the interaction list good enough for every particle in it, and the particles of every leaf that
+        //isn't are added one by one. The list is then handed to the gravity kernel for each particle of the group. Sources and particles are
+        //offsets from the center of the group's bounding box
+        //If is_active isn't NULL, only the particles i of the group with is_active[i] set get gravity
+        WalkCost apply_gravity_to_group(Particle::Store &particles, std::size_t group_idx, const Kernels::Parameters &gravity, Kernels::Sources &sources,
+                Kernels::Multipoles &multipoles, const std::uint8_t *is_active = NULL) const;
+        //The particles of a group are sorted_particles[group.particle_begin] to sorted_particles[group.particle_end-1]
+        const Group &get_group(std::size_t group_idx) const;
+        std::uint32_t group_of(std::size_t particle_idx) const;
+
+        float node_width(const Node &node) const;
+
+        const Box &get_root_box() const;
+        //Depth of the deepest node, as of the last build
+        std::uint32_t depth() const;
+
+        //The root is nodes[0], if there is one
+        const std::vector<Node> &get_nodes() const;
+        //Particles outside of the root box come after every particle of the root, from get_nodes()[0].particle_end
+        const std::vector<std::uint32_t> &get_sorted_particles() const;
 
     };
 
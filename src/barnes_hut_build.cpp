@@ -0,0 +1,692 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "barnes_hut.hpp"
+#include "parallel.hpp"
+
+namespace {
+
+    //Particles outside of the root box get this key, which sorts after every real key since those only use the low 63 bits
+    constexpr std::uint64_t outside_key = std::numeric_limits<std::uint64_t>::max();
+
+    //The root box is made this much wider than the particles, so that the outermost ones aren't quantized against its edge
+    constexpr float root_box_padding = 0.01f;
+    constexpr float min_root_box_width = 1.f; //For a single particle, or particles that are all at the same position
+
+    constexpr std::uint32_t key_resolution = 1u << BarnesHut::max_depth;  //Cells per axis at the deepest level
+    constexpr std::uint32_t max_prefix = 3*BarnesHut::max_depth;           //63 bits per key
+
+    constexpr std::uint32_t binary_leaf_flag = 0x80000000u;
+
+    constexpr std::size_t grain_size = 4096;  //Items per chunk handed to the pool
+
+    constexpr std::uint32_t radix_bits = 11;
+    constexpr std::size_t radix_size = std::size_t(1) << radix_bits;
+
+    //Spreads the lowest 21 bits of x out so that there are two zero bits between every bit
+    std::uint64_t expand_bits(std::uint64_t x) {
+
+        x &= 0x1fffff;
+        x = (x | x << 32) & 0x1f00000000ffffull;
+        x = (x | x << 16) & 0x1f0000ff0000ffull;
+        x = (x | x << 8) & 0x100f00f00f00f00full;
+        x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+        x = (x | x << 2) & 0x1249249249249249ull;
+        return x;
+
+    }
+
+    //Inverse of expand_bits
+    std::uint32_t compact_bits(std::uint64_t x) {
+
+        x &= 0x1249249249249249ull;
+        x = (x ^ (x >> 2)) & 0x10c30c30c30c30c3ull;
+        x = (x ^ (x >> 4)) & 0x100f00f00f00f00full;
+        x = (x ^ (x >> 8)) & 0x1f0000ff0000ffull;
+        x = (x ^ (x >> 16)) & 0x1f00000000ffffull;
+        x = (x ^ (x >> 32)) & 0x1fffffull;
+        return static_cast<std::uint32_t>(x);
+
+    }
+
+    std::uint32_t quantize(float offset, float width) {
+
+        float q = offset / width * static_cast<float>(key_resolution);
+        if (!(q > 0.f)) return 0;
+        if (q >= static_cast<float>(key_resolution-1)) return key_resolution-1;
+        return static_cast<std::uint32_t>(q);
+
+    }
+
+    //Adds a point mass at offset d from the center of mass to a quadrupole, m*(3*d*dᵀ - |d|²*I)
+    void add_quadrupole(Kernels::Quadrupole &quadrupole, const Vectors::Vec3 &d, float mass) {
+
+        float d_sq = d.dot(d);
+        quadrupole.xx += mass*(3.f*d.x*d.x - d_sq);
+        quadrupole.xy += mass*3.f*d.x*d.y;
+        quadrupole.xz += mass*3.f*d.x*d.z;
+        quadrupole.yy += mass*(3.f*d.y*d.y - d_sq);
+        quadrupole.yz += mass*3.f*d.y*d.z;
+        quadrupole.zz += mass*(3.f*d.z*d.z - d_sq);
+
+    }
+
+    float max_abs_component(const Vectors::Vec3 &v) {
+
+        return std::max({std::fabs(v.x), std::fabs(v.y), std::fabs(v.z)});
+
+    }
+
+    int count_leading_zeros(std::uint64_t x) {
+
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_clzll(x);
+#else
+        int n = 0;
+        for (std::uint64_t bit = std::uint64_t(1) << 63; bit != 0 && !(x & bit); bit >>= 1) ++n;
+        return n;
+#endif
+
+    }
+
+    //Length of the common prefix of keys i and j (Karras' delta), or -1 if j is out of range. Equal keys are told apart by
+    //their index, so the prefix of two equal keys is longer than 64 bits
+    int common_prefix(const std::uint64_t *keys, std::int64_t n_keys, std::int64_t i, std::int64_t j) {
+
+        if (j < 0 || j >= n_keys) return -1;
+
+        std::uint64_t diff = keys[i] ^ keys[j];
+        if (diff == 0) return 64 + count_leading_zeros(static_cast<std::uint64_t>(i) ^ static_cast<std::uint64_t>(j));
+        return count_leading_zeros(diff);
+
+    }
+
+    //The 3 bits of the key deciding which sub node of a node at depth-1 the key falls into at depth
+    std::size_t octant(std::uint64_t key, std::uint32_t depth) {
+
+        return static_cast<std::size_t>((key >> (max_prefix - 3*depth)) & 7);
+
+    }
+
+    //Exclusive prefix sum of values, in parallel. values gets one extra element at the end holding the total
+    void exclusive_scan(std::vector<std::uint32_t> &values, Parallel::ThreadPool &pool) {
+
+        std::size_t n = values.size();
+        std::size_t n_chunks = pool.size();
+        std::vector<std::uint32_t> chunk_sums(n_chunks+1, 0);
+
+        pool.for_each_chunk(n, n_chunks, [&](std::size_t chunk, std::size_t lower_limit, std::size_t upper_limit) {
+            std::uint32_t sum = 0;
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) sum += values[i];
+            chunk_sums[chunk+1] = sum;
+        });
+
+        for (std::size_t i = 0; i < n_chunks; i++) chunk_sums[i+1] += chunk_sums[i];
+
+        pool.for_each_chunk(n, n_chunks, [&](std::size_t chunk, std::size_t lower_limit, std::size_t upper_limit) {
+            std::uint32_t sum = chunk_sums[chunk];
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+                std::uint32_t value = values[i];
+                values[i] = sum;
+                sum += value;
+            }
+        });
+
+        values.push_back(chunk_sums[n_chunks]);
+
+    }
+
+}
+
+namespace BarnesHut {
+
+    void Tree::build(const Particle::Store &particles, Parallel::ThreadPool &pool) {
+
+        clear();
+        compute_root_box(particles, pool);
+        if (boundary == Boundary::periodic) ewald_table.build(period, pool);
+
+        level_widths.resize(max_depth+1);
+        level_widths[0] = static_cast<float>(root_box.x_max - root_box.x_min);
+        for (std::size_t i = 1; i < level_widths.size(); i++) level_widths[i] = level_widths[i-1]*0.5f;
+
+        if (particles.empty()) return;
+
+        //Morton keys. y and z are flipped so that the 3 bits of every level are exactly the sub node index (bottom, back, right)
+        keys.resize(particles.size());
+        sorted_particles.resize(particles.size());
+        pool.for_each_range(particles.size(), grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            float width = level_widths[0];
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+                Vectors::Point p = particles.position(i);
+                sorted_particles[i] = static_cast<std::uint32_t>(i);
+
+                if (!root_box.is_point_inside(p)) {
+                    keys[i] = outside_key;
+                    continue;
+                }
+
+                std::uint32_t x = quantize(static_cast<float>(p.x - root_box.x_min), width);
+                std::uint32_t y = key_resolution-1 - quantize(static_cast<float>(p.y - root_box.y_min), width);
+                std::uint32_t z = key_resolution-1 - quantize(static_cast<float>(p.z - root_box.z_min), width);
+                keys[i] = expand_bits(x) | expand_bits(z) << 1 | expand_bits(y) << 2;
+            }
+        });
+
+        sort_keys(pool);
+
+        std::size_t n_keys = static_cast<std::size_t>(std::lower_bound(keys.begin(), keys.end(), outside_key) - keys.begin());
+        if (n_keys == 0) return;
+
+        if (n_keys == 1) {
+            Node root;
+            root.center = node_center(keys[0], 0);
+            root.particle_begin = 0;
+            root.particle_end = 1;
+            root.sub_nodes.fill(no_node);
+            nodes.push_back(root);
+        }
+        else {
+            build_binary_tree(n_keys, pool);
+            build_octree(n_keys, pool);
+        }
+
+        //Both halves of a refit at once, the nodes are new
+        measure_fit(for_each_node_upwards(pool, [&](Node &leaf) -> std::size_t {
+            sum_leaf(leaf, particles);
+            return fit_leaf(leaf, particles);
+        }, [&](Node &parent) {
+            sum_parent(parent);
+            fit_parent(parent);
+        }));
+
+    }
+
+    void Tree::refit(const Particle::Store &particles, Parallel::ThreadPool &pool) {
+
+        fit(particles, pool);
+        refit_mass(particles, pool);
+
+    }
+
+    void Tree::fit(const Particle::Store &particles, Parallel::ThreadPool &pool) {
+
+        if (nodes.empty()) return;
+
+        measure_fit(for_each_node_upwards(pool, [&](Node &leaf) -> std::size_t {
+            return fit_leaf(leaf, particles);
+        }, [&](Node &parent) {
+            fit_parent(parent);
+        }));
+
+    }
+
+    void Tree::refit_mass(const Particle::Store &particles, Parallel::ThreadPool &pool) {
+
+        if (nodes.empty()) return;
+
+        for_each_node_upwards(pool, [&](Node &leaf) -> std::size_t {
+            sum_leaf(leaf, particles);
+            return 0;
+        }, [&](Node &parent) {
+            sum_parent(parent);
+        });
+
+    }
+
+    void Tree::compute_root_box(const Particle::Store &particles, Parallel::ThreadPool &pool) {
+
+        if (boundary == Boundary::periodic) {
+            float half_period = 0.5f*period;
+            root_box = {-half_period, -half_period, -half_period, half_period, half_period, half_period};
+            return;
+        }
+
+        //Every chunk finds the bounds of its own particles, and then the bounds of the chunks are merged.
+        //Positions that aren't finite are left out, they can't be put anywhere in the tree
+        std::size_t n_chunks = pool.size();
+        Box empty_box;
+        empty_box.x_min = empty_box.y_min = empty_box.z_min = std::numeric_limits<Vectors::Coordinate>::max();
+        empty_box.x_max = empty_box.y_max = empty_box.z_max = std::numeric_limits<Vectors::Coordinate>::lowest();
+        chunk_boxes.assign(n_chunks, empty_box);
+
+        pool.for_each_chunk(particles.size(), n_chunks, [&](std::size_t chunk, std::size_t lower_limit, std::size_t upper_limit) {
+            Box box = empty_box;
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+                Vectors::Coordinate x = particles.x[i], y = particles.y[i], z = particles.z[i];
+                if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z)) continue;
+                box.x_min = std::min(box.x_min, x);
+                box.x_max = std::max(box.x_max, x);
+                box.y_min = std::min(box.y_min, y);
+                box.y_max = std::max(box.y_max, y);
+                box.z_min = std::min(box.z_min, z);
+                box.z_max = std::max(box.z_max, z);
+            }
+            chunk_boxes[chunk] = box;
+        });
+
+        Box bounds = empty_box;
+        for (const Box &box : chunk_boxes) {
+            bounds.x_min = std::min(bounds.x_min, box.x_min);
+            bounds.x_max = std::max(bounds.x_max, box.x_max);
+            bounds.y_min = std::min(bounds.y_min, box.y_min);
+            bounds.y_max = std::max(bounds.y_max, box.y_max);
+            bounds.z_min = std::min(bounds.z_min, box.z_min);
+            bounds.z_max = std::max(bounds.z_max, box.z_max);
+        }
+
+        if (bounds.x_min > bounds.x_max) {
+            //No particles, or none with a finite position
+            bounds.x_min = bounds.y_min = bounds.z_min = 0.f;
+            bounds.x_max = bounds.y_max = bounds.z_max = 0.f;
+        }
+
+        //A cube around the center of the bounds, so the nodes stay cubes too
+        float width = static_cast<float>(std::max({bounds.x_max - bounds.x_min, bounds.y_max - bounds.y_min, bounds.z_max - bounds.z_min}));
+        width = std::max(width*(1.f + 2.f*root_box_padding), min_root_box_width);
+
+        float half_width = width*0.5f;
+        Vectors::Coordinate center_x = bounds.x_min + (bounds.x_max - bounds.x_min)*0.5f;
+        Vectors::Coordinate center_y = bounds.y_min + (bounds.y_max - bounds.y_min)*0.5f;
+        Vectors::Coordinate center_z = bounds.z_min + (bounds.z_max - bounds.z_min)*0.5f;
+
+        root_box.x_min = center_x - half_width;
+        root_box.x_max = center_x + half_width;
+        root_box.y_min = center_y - half_width;
+        root_box.y_max = center_y + half_width;
+        root_box.z_min = center_z - half_width;
+        root_box.z_max = center_z + half_width;
+
+    }
+
+    void Tree::sort_keys(Parallel::ThreadPool &pool) {
+
+        //Least significant digit radix sort. Every chunk counts its digits, the counts are turned into where every chunk writes each digit,
+        //and then every chunk scatters its keys. Stable, so particles with equal keys stay sorted by index
+        std::size_t n = keys.size();
+        std::size_t n_chunks = pool.size();
+        keys_scratch.resize(n);
+        sorted_particles_scratch.resize(n);
+        radix_counts.resize(n_chunks*radix_size);
+
+        for (std::uint32_t shift = 0; shift < 64; shift += radix_bits) {
+
+            std::fill(radix_counts.begin(), radix_counts.end(), 0);
+
+            pool.for_each_chunk(n, n_chunks, [&](std::size_t chunk, std::size_t lower_limit, std::size_t upper_limit) {
+                std::uint32_t *counts = &radix_counts[chunk*radix_size];
+                for (std::size_t i = lower_limit; i <= upper_limit; i++) ++counts[(keys[i] >> shift) & (radix_size-1)];
+            });
+
+            bool all_same_digit = false;
+            std::uint32_t sum = 0;
+            for (std::size_t digit = 0; digit < radix_size; digit++) {
+                std::uint32_t digit_total = 0;
+                for (std::size_t chunk = 0; chunk < n_chunks; chunk++) {
+                    std::uint32_t count = radix_counts[chunk*radix_size + digit];
+                    radix_counts[chunk*radix_size + digit] = sum;
+                    sum += count;
+                    digit_total += count;
+                }
+                if (digit_total == n) all_same_digit = true;
+            }
+            if (all_same_digit) continue; //Nothing would move
+
+            pool.for_each_chunk(n, n_chunks, [&](std::size_t chunk, std::size_t lower_limit, std::size_t upper_limit) {
+                std::uint32_t *offsets = &radix_counts[chunk*radix_size];
+                for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+                    std::uint32_t k = offsets[(keys[i] >> shift) & (radix_size-1)]++;
+                    keys_scratch[k] = keys[i];
+                    sorted_particles_scratch[k] = sorted_particles[i];
+                }
+            });
+
+            keys.swap(keys_scratch);
+            sorted_particles.swap(sorted_particles_scratch);
+
+        }
+
+    }
+
+    void Tree::build_binary_tree(std::size_t n_keys, Parallel::ThreadPool &pool) {
+
+        //Karras 2012, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees". Every internal node finds its own
+        //range of keys and where it splits, without looking at any other node, so they can all be built at once
+        std::size_t n_internal = n_keys-1;
+        binary_first.resize(n_internal);
+        binary_last.resize(n_internal);
+        binary_left.resize(n_internal);
+        binary_right.resize(n_internal);
+        binary_parent.resize(n_internal);
+        binary_prefix.resize(n_internal);
+        leaf_parent.resize(n_keys);
+
+        binary_parent[0] = std::numeric_limits<std::uint32_t>::max(); //Node 0 is the root
+
+        const std::uint64_t *k = keys.data();
+        std::int64_t n = static_cast<std::int64_t>(n_keys);
+
+        pool.for_each_range(n_internal, grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            for (std::size_t idx = lower_limit; idx <= upper_limit; idx++) {
+
+                std::int64_t i = static_cast<std::int64_t>(idx);
+
+                //Which way the node's range goes from i
+                std::int64_t d = common_prefix(k, n, i, i+1) - common_prefix(k, n, i, i-1) > 0 ? 1 : -1;
+
+                //Find the other end of the range, first roughly by doubling and then exactly by binary search
+                int prefix_min = common_prefix(k, n, i, i-d);
+                std::int64_t l_max = 2;
+                while (common_prefix(k, n, i, i + l_max*d) > prefix_min) l_max *= 2;
+
+                std::int64_t l = 0;
+                for (std::int64_t t = l_max/2; t >= 1; t /= 2) {
+                    if (common_prefix(k, n, i, i + (l+t)*d) > prefix_min) l += t;
+                }
+                std::int64_t j = i + l*d;
+
+                //Find where the keys in the range stop sharing the node's prefix
+                int prefix_node = common_prefix(k, n, i, j);
+                std::int64_t s = 0;
+                std::int64_t t = l;
+                do {
+                    t = (t+1)/2;
+                    if (common_prefix(k, n, i, i + (s+t)*d) > prefix_node) s += t;
+                } while (t > 1);
+                std::int64_t split = i + s*d + std::min<std::int64_t>(d, 0);
+
+                std::uint32_t first = static_cast<std::uint32_t>(std::min(i, j));
+                std::uint32_t last = static_cast<std::uint32_t>(std::max(i, j));
+                std::uint32_t gamma = static_cast<std::uint32_t>(split);
+
+                binary_first[idx] = first;
+                binary_last[idx] = last;
+                binary_prefix[idx] = std::min<std::uint32_t>(static_cast<std::uint32_t>(prefix_node-1), max_prefix); //The top bit of every key is always 0
+
+                if (first == gamma) {
+                    binary_left[idx] = gamma | binary_leaf_flag;
+                    leaf_parent[gamma] = static_cast<std::uint32_t>(idx);
+                }
+                else {
+                    binary_left[idx] = gamma;
+                    binary_parent[gamma] = static_cast<std::uint32_t>(idx);
+                }
+
+                if (last == gamma+1) {
+                    binary_right[idx] = (gamma+1) | binary_leaf_flag;
+                    leaf_parent[gamma+1] = static_cast<std::uint32_t>(idx);
+                }
+                else {
+                    binary_right[idx] = gamma+1;
+                    binary_parent[gamma+1] = static_cast<std::uint32_t>(idx);
+                }
+
+            }
+        });
+
+    }
+
+    std::uint32_t Tree::octree_parent(std::uint32_t binary_parent_idx) const {
+
+        //The deepest octree node of the closest binary ancestor that has any octree nodes at all
+        std::uint32_t b = binary_parent_idx;
+        while (node_offsets[b+1] == node_offsets[b]) b = binary_parent[b];
+        return node_offsets[b+1]-1;
+
+    }
+
+    Vectors::Point Tree::node_center(std::uint64_t key, std::uint32_t depth) const {
+
+        std::uint64_t cell = depth == 0 ? 0 : key >> (max_prefix - 3*depth);
+        float width = level_widths[depth];
+
+        Vectors::Point center;
+        center.x = root_box.x_min + (static_cast<float>(compact_bits(cell)) + 0.5f)*width;
+        center.z = root_box.z_max - (static_cast<float>(compact_bits(cell >> 1)) + 0.5f)*width;
+        center.y = root_box.y_max - (static_cast<float>(compact_bits(cell >> 2)) + 0.5f)*width;
+
+        return center;
+
+    }
+
+    void Tree::build_octree(std::size_t n_keys, Parallel::ThreadPool &pool) {
+
+        //An octree node at depth L is a prefix of 3*L bits. A binary node with a prefix of p bits, whose parent has a prefix of q bits,
+        //therefore holds a chain of octree nodes from depth q/3+1 down to p/3, where every node but the last has just one sub node.
+        //Particles get a leaf one level below their binary parent, unless their keys are all equal, in which case they share the last node.
+        //The last node of a chain with at most leaf_size particles is a leaf holding all of them, and nothing below it gets any nodes
+        std::size_t n_internal = n_keys-1;
+        node_offsets.resize(n_internal + n_keys);
+
+        auto first_depth = [this](std::size_t b) -> std::uint32_t {
+            return b == 0 ? 0 : binary_prefix[binary_parent[b]]/3 + 1;
+        };
+        auto particle_count = [this](std::size_t b) -> std::size_t {
+            return binary_last[b] - binary_first[b] + 1;
+        };
+
+        //Whether the closest binary ancestor with any octree nodes, starting from binary node b, is already a leaf
+        std::size_t bucket_size = std::max<std::size_t>(leaf_size, 1);
+        auto is_in_leaf = [&](std::uint32_t b) -> bool {
+            while (binary_prefix[b]/3 + 1 <= first_depth(b)) b = binary_parent[b];
+            return particle_count(b) <= bucket_size;
+        };
+
+        pool.for_each_range(node_offsets.size(), grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            for (std::size_t e = lower_limit; e <= upper_limit; e++) {
+                if (e < n_internal) {
+                    std::uint32_t depth_begin = first_depth(e);
+                    std::uint32_t depth_end = binary_prefix[e]/3 + 1;
+                    bool is_hidden = e != 0 && bucket_size > 1 && is_in_leaf(binary_parent[e]);
+                    node_offsets[e] = depth_end > depth_begin && !is_hidden ? depth_end - depth_begin : 0;
+                }
+                else {
+                    std::uint32_t parent = leaf_parent[e-n_internal];
+                    bool is_hidden = binary_prefix[parent] == max_prefix || (bucket_size > 1 && is_in_leaf(parent));
+                    node_offsets[e] = is_hidden ? 0 : 1;
+                }
+            }
+        });
+
+        exclusive_scan(node_offsets, pool);
+        nodes.resize(node_offsets.back());
+
+        //Fill in every node, and the links within every chain. The deepest node is the last of some chain, or a particle's leaf
+        std::atomic<std::uint32_t> deepest(0);
+        pool.for_each_range(n_internal + n_keys, grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            std::uint32_t range_deepest = 0;
+            for (std::size_t e = lower_limit; e <= upper_limit; e++) {
+
+                std::uint32_t offset = node_offsets[e];
+                std::uint32_t n_nodes = node_offsets[e+1] - offset;
+                if (n_nodes == 0) continue;
+
+                if (e < n_internal) {
+                    std::uint32_t depth_begin = first_depth(e);
+                    std::uint64_t key = keys[binary_first[e]];
+
+                    for (std::uint32_t c = 0; c < n_nodes; c++) {
+                        Node &node = nodes[offset+c];
+                        node = Node();
+                        node.depth = depth_begin + c;
+                        node.center = node_center(key, node.depth);
+                        node.particle_begin = binary_first[e];
+                        node.particle_end = binary_last[e]+1;
+                        node.sub_nodes.fill(no_node);
+
+                        if (c == 0) node.parent = e == 0 ? no_node : octree_parent(binary_parent[e]);
+                        else node.parent = offset+c-1;
+
+                        if (c+1 < n_nodes) {
+                            node.sub_nodes[octant(key, node.depth+1)] = offset+c+1;
+                            node.has_sub_nodes = true;
+                        }
+                        else {
+                            node.has_sub_nodes = binary_prefix[e] < max_prefix && particle_count(e) > bucket_size;
+                        }
+                    }
+                }
+                else {
+                    std::uint32_t leaf = static_cast<std::uint32_t>(e - n_internal);
+                    Node &node = nodes[offset];
+                    node = Node();
+                    node.depth = binary_prefix[leaf_parent[leaf]]/3 + 1;
+                    node.center = node_center(keys[leaf], node.depth);
+                    node.particle_begin = leaf;
+                    node.particle_end = leaf+1;
+                    node.sub_nodes.fill(no_node);
+                    node.parent = octree_parent(leaf_parent[leaf]);
+                }
+                range_deepest = std::max(range_deepest, nodes[offset+n_nodes-1].depth);
+
+            }
+
+            std::uint32_t current = deepest.load(std::memory_order_relaxed);
+            while (range_deepest > current && !deepest.compare_exchange_weak(current, range_deepest, std::memory_order_relaxed)) {}
+        });
+        node_depth = deepest.load();
+
+        //Link the first node of every chain into its parent. Every parent slot is written by exactly one chain
+        pool.for_each_range(n_internal + n_keys, grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            for (std::size_t e = std::max<std::size_t>(lower_limit, 1); e <= upper_limit; e++) {
+
+                std::uint32_t offset = node_offsets[e];
+                if (node_offsets[e+1] == offset) continue;
+
+                const Node &node = nodes[offset];
+                nodes[node.parent].sub_nodes[octant(keys[node.particle_begin], node.depth)] = offset;
+
+            }
+        });
+
+    }
+
+    template<typename LeafF, typename ParentF>
+    std::size_t Tree::for_each_node_upwards(Parallel::ThreadPool &pool, LeafF on_leaf, ParentF on_parent) {
+
+        if (visit_counts_size < nodes.size()) {
+            visit_counts_size = nodes.size() + nodes.size()/2;
+            visit_counts.reset(new std::atomic<std::uint32_t>[visit_counts_size]);
+        }
+
+        pool.for_each_range(nodes.size(), grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) visit_counts[i].store(0, std::memory_order_relaxed);
+        });
+
+        //Every leaf is done on its own and then walks up towards the root. Only the last sub node to arrive at a node continues past it,
+        //so every node is done exactly once, after all of its sub nodes are done
+        std::atomic<std::size_t> total(0);
+
+        pool.for_each_range(nodes.size(), grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            std::size_t range_total = 0;
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+
+                if (nodes[i].has_sub_nodes) continue;
+                range_total += on_leaf(nodes[i]);
+
+                std::uint32_t node_idx = static_cast<std::uint32_t>(i);
+                while (node_idx != 0) {
+                    std::uint32_t parent_idx = nodes[node_idx].parent;
+                    Node &parent = nodes[parent_idx];
+
+                    std::uint32_t n_sub_nodes = 0;
+                    for (std::size_t s = 0; s < parent.sub_nodes.size(); s++) {
+                        if (parent.sub_nodes[s] != no_node) ++n_sub_nodes;
+                    }
+                    if (visit_counts[parent_idx].fetch_add(1, std::memory_order_acq_rel)+1 != n_sub_nodes) break;
+
+                    on_parent(parent);
+                    node_idx = parent_idx;
+                }
+
+            }
+            total.fetch_add(range_total, std::memory_order_relaxed);
+        });
+
+        return total.load();
+
+    }
+
+    std::size_t Tree::fit_leaf(Node &leaf, const Particle::Store &particles) const {
+
+        std::size_t out_of_leaf = 0;
+        leaf.width = level_widths[leaf.depth];
+        for (std::uint32_t k = leaf.particle_begin; k < leaf.particle_end; k++) {
+            float particle_width = 2.f*max_abs_component(particles.position(sorted_particles[k]) - leaf.center);
+            if (particle_width > level_widths[leaf.depth]) out_of_leaf++;
+            leaf.width = std::max(leaf.width, particle_width);
+        }
+        return out_of_leaf;
+
+    }
+
+    void Tree::fit_parent(Node &parent) const {
+
+        parent.width = level_widths[parent.depth];
+        for (std::size_t s = 0; s < parent.sub_nodes.size(); s++) {
+            if (parent.sub_nodes[s] == no_node) continue;
+            const Node &sub_node = nodes[parent.sub_nodes[s]];
+            parent.width = std::max(parent.width, 2.f*max_abs_component(sub_node.center - parent.center) + sub_node.width);
+        }
+
+    }
+
+    void Tree::sum_leaf(Node &leaf, const Particle::Store &particles) const {
+
+        leaf.mass = 0.f;
+        leaf.position = {0.f, 0.f, 0.f};
+        for (std::uint32_t k = leaf.particle_begin; k < leaf.particle_end; k++) {
+            std::uint32_t p = sorted_particles[k];
+            leaf.mass += particles.mass[p];
+            leaf.position = leaf.position + particles.position(p)*particles.mass[p];
+        }
+
+        leaf.quadrupole = Kernels::Quadrupole();
+        Vectors::Point leaf_center_of_mass = leaf.position/leaf.mass;
+        for (std::uint32_t k = leaf.particle_begin; k < leaf.particle_end; k++) {
+            std::uint32_t p = sorted_particles[k];
+            add_quadrupole(leaf.quadrupole, particles.position(p) - leaf_center_of_mass, particles.mass[p]);
+        }
+
+    }
+
+    void Tree::sum_parent(Node &parent) const {
+
+        parent.mass = 0.f;
+        parent.position = {0.f, 0.f, 0.f};
+        for (std::size_t s = 0; s < parent.sub_nodes.size(); s++) {
+            if (parent.sub_nodes[s] == no_node) continue;
+            const Node &sub_node = nodes[parent.sub_nodes[s]];
+            parent.mass += sub_node.mass;
+            parent.position = parent.position + sub_node.position;
+        }
+
+        //Every sub node's quadrupole, moved from its own center of mass to the parent's
+        parent.quadrupole = Kernels::Quadrupole();
+        Vectors::Point parent_center_of_mass = parent.position/parent.mass;
+        for (std::size_t s = 0; s < parent.sub_nodes.size(); s++) {
+            if (parent.sub_nodes[s] == no_node) continue;
+            const Node &sub_node = nodes[parent.sub_nodes[s]];
+            const Kernels::Quadrupole &q = sub_node.quadrupole;
+            parent.quadrupole.xx += q.xx;
+            parent.quadrupole.xy += q.xy;
+            parent.quadrupole.xz += q.xz;
+            parent.quadrupole.yy += q.yy;
+            parent.quadrupole.yz += q.yz;
+            parent.quadrupole.zz += q.zz;
+            add_quadrupole(parent.quadrupole, sub_node.position/sub_node.mass - parent_center_of_mass, sub_node.mass);
+        }
+
+    }
+
+    void Tree::measure_fit(std::size_t out_of_leaf_count) {
+
+        n_out_of_leaf = out_of_leaf_count;
+        width_growth = nodes.empty() ? 1.f : nodes[0].width/level_widths[0];
+
+    }
+
+}
@@ -0,0 +1,281 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "arguments.hpp"
+#include "profiling.hpp"
+#include "scenes.hpp"
+#include "simulation.hpp"
+
+namespace {
+
+    constexpr const char *scene_names[] = {"two-spheres", "cube", "plummer"};
+    constexpr std::size_t scene_sizes[] = {1000, 3000, 10000, 30000, 100000, 300000, 1000000};
+    constexpr std::size_t default_scaling_particles = 100000;
+    constexpr float delta_time = 1.f/60.f;
+
+    bool is_scene(const char *name) {
+
+        for (const char *scene_name : scene_names) {
+            if (std::strcmp(name, scene_name) == 0) return true;
+        }
+        return false;
+
+    }
+
+    Particle::Store make_scene(const char *name, std::size_t n_particles, float G) {
+
+        if (std::strcmp(name, "cube") == 0) return Scenes::uniform_cube(n_particles);
+        if (std::strcmp(name, "plummer") == 0) return Scenes::plummer(n_particles, G);
+        return Scenes::two_spheres(n_particles);
+
+    }
+
+    //One run of a scene, with the stats averaged over its steps
+    class Result {
+
+    public:
+        const char *sweep;
+        const char *scene;
+        std::size_t n_particles;
+        std::size_t n_threads;
+        std::size_t n_steps;
+        double build_seconds;   //One build of the tree from scratch, which the steps mostly refit instead
+        Profiling::Stats stats;
+
+        double per_step(double seconds) const {
+
+            return seconds/static_cast<double>(n_steps);
+
+        }
+
+        double busy_fraction() const {
+
+            double busy_seconds = 0.0;
+            for (double seconds : stats.thread_seconds) busy_seconds += seconds;
+            return busy_seconds/(stats.step_seconds*static_cast<double>(n_threads));
+
+        }
+
+    };
+
+    //Steps a scene once to warm up, which allocates every buffer and builds the first tree, then times n_steps more
+    Result run(const char *sweep, const char *scene, std::size_t n_particles, std::size_t n_threads, std::size_t n_steps) {
+
+        Simulation::Simulation simulation(n_threads);
+        simulation.particles = make_scene(scene, n_particles, simulation.gravity.G);
+        simulation.step(delta_time);
+
+        Result result;
+        result.sweep = sweep;
+        result.scene = scene;
+        result.n_particles = simulation.particles.size();
+        result.n_threads = simulation.thread_count();
+        result.n_steps = n_steps;
+
+        result.build_seconds = 0.0;
+        {
+            Profiling::ScopedTimer timer(result.build_seconds);
+            simulation.build_tree();
+        }
+
+        simulation.reset_stats();
+        for (std::size_t i = 0; i < n_steps; i++) simulation.step(delta_time);
+        result.stats = simulation.read_stats();
+
+        return result;
+
+    }
+
+    //Writes every result as a row of a CSV file, or as a JSON array if the file name ends in .json. Times are in milliseconds per step,
+    //and the counters are per step too
+    class ResultWriter {
+
+        std::FILE *file = NULL;
+        bool is_json = false;
+        std::size_t n_rows = 0;
+
+    public:
+
+        explicit ResultWriter(const char *path) {
+
+            file = std::fopen(path, "w");
+            if (!file) {
+                std::fprintf(stderr, "Error: Couldn't open \"%s\" to write the results to!\n", path);
+                return;
+            }
+
+            std::size_t length = std::strlen(path);
+            is_json = length >= 5 && std::strcmp(path + length - 5, ".json") == 0;
+
+            if (!is_json) {
+                std::fprintf(file, "sweep,scene,particles,threads,steps,build_ms,step_ms");
+                for (std::size_t i = 0; i < Profiling::phase_count; i++) std::fprintf(file, ",%s_ms", Profiling::phase_name(static_cast<Profiling::Phase>(i)));
+                std::fprintf(file, ",busy_fraction,node_visits,interactions,collision_tests,tree_depth,tree_nodes\n");
+            }
+
+        }
+
+        ~ResultWriter() {
+
+            if (!file) return;
+
+            if (is_json) std::fputs(n_rows == 0 ? "[]\n" : "\n]\n", file);
+            std::fclose(file);
+
+        }
+
+        ResultWriter(const ResultWriter&) = delete;
+        ResultWriter& operator=(const ResultWriter&) = delete;
+
+        bool is_open() const {
+
+            return file != NULL;
+
+        }
+
+        void write(const Result &result) {
+
+            const Profiling::Stats &stats = result.stats;
+            double steps = static_cast<double>(result.n_steps);
+
+            if (is_json) {
+                std::fprintf(file, "%s{\"sweep\": \"%s\", \"scene\": \"%s\", \"particles\": %zu, \"threads\": %zu, \"steps\": %zu, \"build_ms\": %.6f, "
+                        "\"step_ms\": %.6f", n_rows == 0 ? "[\n" : ",\n", result.sweep, result.scene, result.n_particles, result.n_threads, result.n_steps,
+                        result.build_seconds*1000.0, result.per_step(stats.step_seconds)*1000.0);
+                for (std::size_t i = 0; i < Profiling::phase_count; i++) {
+                    std::fprintf(file, ", \"%s_ms\": %.6f", Profiling::phase_name(static_cast<Profiling::Phase>(i)), result.per_step(stats.phase_seconds[i])*1000.0);
+                }
+                std::fprintf(file, ", \"busy_fraction\": %.4f, \"node_visits\": %.0f, \"interactions\": %.0f, \"collision_tests\": %.0f, \"tree_depth\": %u, "
+                        "\"tree_nodes\": %zu}", result.busy_fraction(), static_cast<double>(stats.node_visits)/steps,
+                        static_cast<double>(stats.interactions)/steps, static_cast<double>(stats.collision_tests)/steps, stats.tree_depth, stats.tree_nodes);
+            }
+            else {
+                std::fprintf(file, "%s,%s,%zu,%zu,%zu,%.6f,%.6f", result.sweep, result.scene, result.n_particles, result.n_threads, result.n_steps,
+                        result.build_seconds*1000.0, result.per_step(stats.step_seconds)*1000.0);
+                for (std::size_t i = 0; i < Profiling::phase_count; i++) std::fprintf(file, ",%.6f", result.per_step(stats.phase_seconds[i])*1000.0);
+                std::fprintf(file, ",%.4f,%.0f,%.0f,%.0f,%u,%zu\n", result.busy_fraction(), static_cast<double>(stats.node_visits)/steps,
+                        static_cast<double>(stats.interactions)/steps, static_cast<double>(stats.collision_tests)/steps, stats.tree_depth, stats.tree_nodes);
+            }
+
+            n_rows++;
+
+        }
+
+    };
+
+    //1, 2, 4, ... threads, and max_threads at the end if it isn't a power of two
+    std::vector<std::size_t> thread_counts(std::size_t max_threads) {
+
+        std::vector<std::size_t> counts;
+        for (std::size_t n = 1; n < max_threads; n *= 2) counts.push_back(n);
+        counts.push_back(max_threads);
+        return counts;
+
+    }
+
+}
+
+//Steps fixed scenes and times every phase of a step separately, so a change to the tree or the particles shows up as a number:
+//the default two spheres, a uniform cube and a Plummer sphere, from 1k particles up to max_particles.
+//Then a strong scaling sweep, the same particles with more and more threads, and a weak scaling sweep, where the number of particles
+//grows with the number of threads
+//Usage: gravity_bench [max_particles] [n_steps] [max_threads] [--scene=two-spheres|cube|plummer] [--scaling-particles=<n>] [--output=<file>]
+int main(int argc, char** argv) {
+
+    std::size_t max_particles = 1000000;
+    std::size_t n_steps = 3;
+    std::size_t max_threads = 0;
+
+    std::vector<const char*> args = Arguments::positional(argc, argv);
+
+    if (args.size() >= 1 && !Arguments::parse_count(args[0], "particles", max_particles)) return EXIT_FAILURE;
+    if (args.size() >= 2 && !Arguments::parse_count(args[1], "steps", n_steps)) return EXIT_FAILURE;
+    if (args.size() >= 3 && !Arguments::parse_count(args[2], "threads", max_threads)) return EXIT_FAILURE;
+    if (max_threads == 0) max_threads = Simulation::default_thread_count();
+
+    const char *only_scene = Arguments::find_option(argc, argv, "scene");
+    if (only_scene && !is_scene(only_scene)) {
+        std::fprintf(stderr, "Error: Unknown scene \"%s\" (two-spheres, cube or plummer)!\n", only_scene);
+        return EXIT_FAILURE;
+    }
+
+    std::size_t scaling_particles = std::min(max_particles, default_scaling_particles);
+    const char *scaling = Arguments::find_option(argc, argv, "scaling-particles");
+    if (scaling && !Arguments::parse_count(scaling, "particles to scale with", scaling_particles)) return EXIT_FAILURE;
+
+    std::unique_ptr<ResultWriter> writer;
+    const char *output = Arguments::find_option(argc, argv, "output");
+    if (output) {
+        writer.reset(new ResultWriter(output));
+        if (!writer->is_open()) return EXIT_FAILURE;
+    }
+
+    std::printf("Every run steps %zu times after one step to warm up, times are in milliseconds per step.\n", n_steps);
+    std::printf("\nScenes with %zu threads:\n", max_threads);
+    std::printf("%12s %10s %10s %10s %10s %10s %10s %10s %8s %14s\n", "scene", "particles", "build", "step", "tree", "gravity", "collisions",
+            "integrate", "busy", "interactions");
+
+    for (const char *scene : scene_names) {
+
+        if (only_scene && std::strcmp(scene, only_scene) != 0) continue;
+
+        for (std::size_t n_particles : scene_sizes) {
+
+            if (n_particles > max_particles) break;
+
+            Result result = run("scenes", scene, n_particles, max_threads, n_steps);
+            const Profiling::Stats &stats = result.stats;
+
+            std::printf("%12s %10zu %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f %7.1f%% %14.1f\n", scene, result.n_particles, result.build_seconds*1000.0,
+                    result.per_step(stats.step_seconds)*1000.0, result.per_step(stats.seconds(Profiling::Phase::tree))*1000.0,
+                    result.per_step(stats.seconds(Profiling::Phase::gravity))*1000.0, result.per_step(stats.seconds(Profiling::Phase::collisions))*1000.0,
+                    result.per_step(stats.seconds(Profiling::Phase::integration))*1000.0, result.busy_fraction()*100.0,
+                    static_cast<double>(stats.interactions)/static_cast<double>(result.n_steps*result.n_particles));
+            if (writer) writer->write(result);
+
+        }
+
+    }
+
+    const char *scaling_scene = only_scene ? only_scene : scene_names[0];
+
+    //Perfect scaling divides the time of a step by the number of threads
+    std::printf("\nStrong scaling, %s with %zu particles:\n", scaling_scene, scaling_particles);
+    std::printf("%8s %10s %10s %10s\n", "threads", "step", "speedup", "efficiency");
+
+    double single_thread_time = 0.0;
+    for (std::size_t n_threads : thread_counts(max_threads)) {
+
+        Result result = run("strong", scaling_scene, scaling_particles, n_threads, n_steps);
+        double step_time = result.per_step(result.stats.step_seconds);
+        if (n_threads == 1) single_thread_time = step_time;
+
+        std::printf("%8zu %10.3f %9.2fx %9.1f%%\n", n_threads, step_time*1000.0, single_thread_time/step_time,
+                100.0*single_thread_time/(step_time*static_cast<double>(n_threads)));
+        if (writer) writer->write(result);
+
+    }
+
+    //Perfect scaling keeps the time of a step the same, apart from the log N of the tree
+    std::size_t particles_per_thread = std::max<std::size_t>(1, scaling_particles/max_threads);
+    std::printf("\nWeak scaling, %s with %zu particles per thread:\n", scaling_scene, particles_per_thread);
+    std::printf("%8s %10s %10s %10s\n", "threads", "particles", "step", "efficiency");
+
+    for (std::size_t n_threads : thread_counts(max_threads)) {
+
+        Result result = run("weak", scaling_scene, particles_per_thread*n_threads, n_threads, n_steps);
+        double step_time = result.per_step(result.stats.step_seconds);
+        if (n_threads == 1) single_thread_time = step_time;
+
+        std::printf("%8zu %10zu %10.3f %9.1f%%\n", n_threads, result.n_particles, step_time*1000.0, 100.0*single_thread_time/step_time);
+        if (writer) writer->write(result);
+
+    }
+
+    return 0;
+
+}
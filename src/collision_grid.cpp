@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <cmath>
+
+#include "collision_grid.hpp"
+
+namespace {
+
+    constexpr std::size_t build_grain_size = 4096;    //Particles or buckets per chunk handed to the pool
+
+    //Keeps cell coordinates far away from overflowing when a particle has flown off
+    constexpr Vectors::Coordinate max_cell_coord = 1073741824; //2^30
+
+    //Floors in the positions' own precision, since far from the origin a float quotient would round neighbouring cells together
+    std::int32_t to_cell_coord(Vectors::Coordinate x) {
+        Vectors::Coordinate c = std::floor(x);
+        if (!(c > -max_cell_coord)) c = -max_cell_coord; //Also catches NaN
+        if (c > max_cell_coord) c = max_cell_coord;
+        return static_cast<std::int32_t>(c);
+    }
+
+}
+
+namespace Collision {
+
+    Grid::Cell Grid::cell_of(const Vectors::Point &p) const {
+
+        return {to_cell_coord(p.x / cell_size), to_cell_coord(p.y / cell_size), to_cell_coord(p.z / cell_size)};
+
+    }
+
+    std::size_t Grid::bucket_of(const Cell &cell) const {
+
+        //Only the segment is hashed, the cell's place within it is kept as the low bits, so a segment's cells are 16 buckets in a row
+        std::uint32_t segment = static_cast<std::uint32_t>(cell[0] >> segment_bits);
+        std::uint32_t hash = segment*73856093u ^ static_cast<std::uint32_t>(cell[1])*19349663u ^ static_cast<std::uint32_t>(cell[2])*83492791u;
+        return (static_cast<std::size_t>(hash) << segment_bits | static_cast<std::size_t>(cell[0] & segment_mask)) & bucket_mask;
+
+    }
+
+    void Grid::build(const Particle::Store &particles, Parallel::ThreadPool &pool) {
+
+        std::size_t n = particles.size();
+
+        //Every chunk finds the largest radius of its own particles, and then the chunks are merged
+        chunk_max_radius.assign(pool.size(), 0.f);
+        pool.for_each_chunk(n, pool.size(), [&](std::size_t chunk, std::size_t lower_limit, std::size_t upper_limit) {
+            float max_radius = 0.f;
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) max_radius = std::max(max_radius, particles.radius[i]);
+            chunk_max_radius[chunk] = max_radius;
+        });
+        float max_radius = 0.f;
+        for (float radius : chunk_max_radius) max_radius = std::max(max_radius, radius);
+        cell_size = max_radius > 0.f ? max_radius*2.f : 1.f;
+
+        //At least twice as many buckets as particles and as many as a segment has cells, and a power of two so the hash can be masked
+        std::size_t n_buckets = std::size_t(1) << segment_bits;
+        while (n_buckets < n*2) n_buckets *= 2;
+        bucket_mask = n_buckets-1;
+
+        if (bucket_counts_size < n_buckets) {
+            bucket_counts_size = n_buckets;
+            bucket_counts.reset(new std::atomic<std::uint32_t>[bucket_counts_size]);
+        }
+        pool.for_each_range(n_buckets, build_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            for (std::size_t b = lower_limit; b <= upper_limit; b++) bucket_counts[b].store(0, std::memory_order_relaxed);
+        });
+
+        //The cell and bucket of every particle, counted in parallel. The counts don't depend on the order the particles are counted in
+        cells.resize(n);
+        buckets.resize(n);
+        pool.for_each_range(n, build_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+                cells[i] = cell_of(particles.position(i));
+                buckets[i] = static_cast<std::uint32_t>(bucket_of(cells[i]));
+                bucket_counts[buckets[i]].fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+
+        bucket_starts.resize(n_buckets+1);
+        bucket_starts[0] = 0;
+        for (std::size_t b = 0; b < n_buckets; b++) bucket_starts[b+1] = bucket_starts[b] + bucket_counts[b].load(std::memory_order_relaxed);
+
+        //Counting sort of the particles by bucket. Stable, so the order within a bucket is always by index
+        sorted_indices.resize(n);
+        sorted_cells.resize(n);
+        fill.assign(bucket_starts.begin(), bucket_starts.end()-1);
+        for (std::size_t i = 0; i < n; i++) {
+            std::uint32_t k = fill[buckets[i]]++;
+            sorted_indices[k] = static_cast<std::uint32_t>(i);
+            sorted_cells[k] = cells[i];
+        }
+
+    }
+
+}
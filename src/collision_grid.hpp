@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "parallel.hpp"
+#include "particle_store.hpp"
+#include "vectors.hpp"
+
+namespace Collision {
+
+    //Uniform grid stored as a spatial hash, used as the broadphase for collisions. The cells are as wide as the largest
+    //particle diameter, so every particle that can touch a particle is within the 27 cells around it.
+    //Along x, the cells are hashed in segments of 16: the 16 cells of a segment get 16 buckets in a row, so the 3 cells of a row around a
+    //particle are one run of buckets (or two, where the row crosses into the next segment), and they're scanned in one go
+    class Grid {
+
+        using Cell = std::array<std::int32_t, 3>;
+
+        static constexpr std::int32_t segment_bits = 4;
+        static constexpr std::int32_t segment_mask = (1 << segment_bits) - 1;
+
+        float cell_size = 1.f;
+        std::size_t bucket_mask = 0;
+
+        //Particles sorted by bucket. The particles in bucket b are sorted_indices[bucket_starts[b]] to sorted_indices[bucket_starts[b+1]-1]
+        std::vector<std::uint32_t> bucket_starts;
+        std::vector<std::uint32_t> sorted_indices;
+        std::vector<Cell> sorted_cells; //The cell of every particle in sorted_indices. Used to skip particles from other cells that share a bucket
+
+        //Everything below is only scratch space for build, kept so that rebuilding the grid every step doesn't allocate once it has grown
+        std::vector<float> chunk_max_radius;
+        std::vector<Cell> cells;                //The cell and bucket of every particle, by index
+        std::vector<std::uint32_t> buckets;
+        std::unique_ptr<std::atomic<std::uint32_t>[]> bucket_counts;
+        std::size_t bucket_counts_size = 0;
+        std::vector<std::uint32_t> fill;
+
+        Cell cell_of(const Vectors::Point &p) const;
+        std::size_t bucket_of(const Cell &cell) const;
+
+    public:
+
+        //Rebuilds the grid from scratch, finding the cell of every particle and counting the particles of every bucket on every thread of
+        //the pool. The particles must not move until the grid is rebuilt again
+        void build(const Particle::Store &particles, Parallel::ThreadPool &pool);
+
+        //Calls f(j) for every particle j in the 27 cells around p, in the same order every time: cell by cell, z, y and then x, and by index
+        //within a cell
+        template<typename F>
+        void for_each_nearby(const Vectors::Point &p, F &&f) const {
+
+            if (sorted_indices.empty()) return;
+
+            Cell center = cell_of(p);
+            for (std::int32_t dz = -1; dz <= 1; dz++) {
+                for (std::int32_t dy = -1; dy <= 1; dy++) {
+
+                    std::int32_t y = center[1]+dy, z = center[2]+dz;
+                    std::int32_t last_x = center[0]+1;
+
+                    //The cells x to run_last_x are in the buckets bucket to bucket + run_last_x - x, and every bucket is sorted by index
+                    for (std::int32_t x = center[0]-1; x <= last_x;) {
+                        std::int32_t run_last_x = x | segment_mask;
+                        if (run_last_x > last_x) run_last_x = last_x;
+
+                        std::size_t bucket = bucket_of({x, y, z});
+                        std::size_t bucket_end = bucket + static_cast<std::size_t>(run_last_x - x) + 1;
+                        for (std::uint32_t k = bucket_starts[bucket]; k < bucket_starts[bucket_end]; k++) {
+                            const Cell &cell = sorted_cells[k];
+                            if (cell[1] == y && cell[2] == z && cell[0] >= x && cell[0] <= run_last_x) f(static_cast<std::size_t>(sorted_indices[k]));
+                        }
+
+                        x = run_last_x+1;
+                    }
+
+                }
+            }
+
+        }
+
+    };
+
+}
@@ -0,0 +1,67 @@
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "diagnostics.hpp"
+
+namespace Diagnostics {
+
+    double Totals::energy() const {
+
+        return kinetic_energy + potential_energy;
+
+    }
+
+    double Totals::momentum() const {
+
+        return std::sqrt(momentum_x*momentum_x + momentum_y*momentum_y + momentum_z*momentum_z);
+
+    }
+
+    Totals measure(const Particle::Store &particles, const Kernels::Parameters &gravity, Parallel::ThreadPool &pool) {
+
+        //Every chunk sums its own particles, and the chunks are added up in order. There are always as many chunks, so the result doesn't
+        //depend on the number of threads, and enough of them that the first chunks, which have the most pairs, don't hold up the rest
+        constexpr std::size_t n_chunks = 256;
+        std::vector<Totals> chunk_totals(n_chunks);
+        double softening_sq = static_cast<double>(gravity.softening)*gravity.softening;
+
+        pool.for_each_chunk(particles.size(), n_chunks, [&](std::size_t chunk, std::size_t lower_limit, std::size_t upper_limit) {
+            Totals totals;
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+                double mass = particles.mass[i];
+                double vx = particles.vx[i], vy = particles.vy[i], vz = particles.vz[i];
+                totals.kinetic_energy += 0.5*mass*(vx*vx + vy*vy + vz*vz);
+                totals.momentum_x += mass*vx;
+                totals.momentum_y += mass*vy;
+                totals.momentum_z += mass*vz;
+                totals.momentum_scale += mass*std::sqrt(vx*vx + vy*vy + vz*vz);
+
+                //Every pair once, from the particle with the lower index
+                double potential = 0.0;
+                for (std::size_t j = i+1; j < particles.size(); j++) {
+                    double dx = static_cast<double>(particles.x[j]) - particles.x[i];
+                    double dy = static_cast<double>(particles.y[j]) - particles.y[i];
+                    double dz = static_cast<double>(particles.z[j]) - particles.z[i];
+                    potential -= particles.mass[j] / std::sqrt(dx*dx + dy*dy + dz*dz + softening_sq);
+                }
+                totals.potential_energy += gravity.G*mass*potential;
+            }
+            chunk_totals[chunk] = totals;
+        });
+
+        Totals totals;
+        for (const Totals &chunk : chunk_totals) {
+            totals.kinetic_energy += chunk.kinetic_energy;
+            totals.potential_energy += chunk.potential_energy;
+            totals.momentum_x += chunk.momentum_x;
+            totals.momentum_y += chunk.momentum_y;
+            totals.momentum_z += chunk.momentum_z;
+            totals.momentum_scale += chunk.momentum_scale;
+        }
+
+        return totals;
+
+    }
+
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "gravity_kernels.hpp"
+#include "parallel.hpp"
+#include "particle_store.hpp"
+
+namespace Diagnostics {
+
+    //Quantities that gravity alone conserves, so how much they drift over a run shows how much error the integrator adds
+    class Totals {
+
+    public:
+        double kinetic_energy = 0.0;
+        double potential_energy = 0.0; //Softened the same way as the gravity, so it's the potential the particles actually move in
+        double momentum_x = 0.0, momentum_y = 0.0, momentum_z = 0.0;
+        double momentum_scale = 0.0; //Sum of the length of every particle's momentum, what a drift in momentum is compared against
+
+        double energy() const;
+        double momentum() const;
+
+    };
+
+    //Sums every pair of particles directly, in double precision. Too slow to do every step for many particles, but exact
+    Totals measure(const Particle::Store &particles, const Kernels::Parameters &gravity, Parallel::ThreadPool &pool);
+
+}
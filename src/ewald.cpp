@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <cmath>
+
+#include "ewald.hpp"
+
+namespace {
+
+    constexpr double pi = 3.14159265358979323846;
+
+    //Splits the sum between real and reciprocal space at 2 per period. Images further out than 2 periods in either sum add less than 1e-6
+    constexpr double alpha = 2.0;
+    constexpr int max_image = 2;
+
+    //Grid cells along every axis of the octant, which is half a period wide
+    constexpr std::size_t table_cells = 32;
+    constexpr std::size_t table_points = table_cells+1;
+
+    constexpr std::size_t grain_size = 64;
+
+    //Sorts a lookup into the grid: the cell below u, how far into it u is, and which way the offset points
+    void locate(float offset, float scale, std::size_t &cell, float &fraction, float &sign) {
+
+        sign = offset < 0.f ? -1.f : 1.f;
+        float u = std::min(std::fabs(offset)*scale, static_cast<float>(table_cells));
+        cell = std::min(static_cast<std::size_t>(u), table_cells-1);
+        fraction = u - static_cast<float>(cell);
+
+    }
+
+}
+
+namespace Ewald {
+
+    void exact_correction(double dx, double dy, double dz, double period, double &cx, double &cy, double &cz) {
+
+        cx = cy = cz = 0.0;
+        if (dx == 0.0 && dy == 0.0 && dz == 0.0) return;
+
+        //In units of the period
+        double x = dx/period, y = dy/period, z = dz/period;
+
+        //Real space: every image, screened by erfc so the sum converges quickly. Includes the closest image, taken out again below
+        for (int i = -max_image; i <= max_image; i++) {
+            for (int j = -max_image; j <= max_image; j++) {
+                for (int k = -max_image; k <= max_image; k++) {
+                    double rx = x - i, ry = y - j, rz = z - k;
+                    double r = std::sqrt(rx*rx + ry*ry + rz*rz);
+                    double s = (std::erfc(alpha*r) + 2.0*alpha*r/std::sqrt(pi)*std::exp(-alpha*alpha*r*r))/(r*r*r);
+                    cx += rx*s;
+                    cy += ry*s;
+                    cz += rz*s;
+                }
+            }
+        }
+
+        //Reciprocal space: the smooth rest of every image, minus the background
+        for (int i = -max_image; i <= max_image; i++) {
+            for (int j = -max_image; j <= max_image; j++) {
+                for (int k = -max_image; k <= max_image; k++) {
+                    int h_sq = i*i + j*j + k*k;
+                    if (h_sq == 0) continue;
+                    double s = 2.0/h_sq*std::exp(-pi*pi*h_sq/(alpha*alpha))*std::sin(2.0*pi*(i*x + j*y + k*z));
+                    cx += i*s;
+                    cy += j*s;
+                    cz += k*s;
+                }
+            }
+        }
+
+        double r_sq = x*x + y*y + z*z;
+        double inv_r_3 = 1.0/(r_sq*std::sqrt(r_sq));
+        cx -= x*inv_r_3;
+        cy -= y*inv_r_3;
+        cz -= z*inv_r_3;
+
+        double scale = 1.0/(period*period);
+        cx *= scale;
+        cy *= scale;
+        cz *= scale;
+
+    }
+
+    void Table::build(float period, Parallel::ThreadPool &pool) {
+
+        if (period == table_period && !values.empty()) return;
+
+        table_period = period;
+        values.resize(3*table_points*table_points*table_points);
+
+        double spacing = 0.5*static_cast<double>(period)/static_cast<double>(table_cells);
+        pool.for_each_range(table_points*table_points*table_points, grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            for (std::size_t p = lower_limit; p <= upper_limit; p++) {
+                std::size_t i = p % table_points, j = (p/table_points) % table_points, k = p/(table_points*table_points);
+                double cx, cy, cz;
+                exact_correction(static_cast<double>(i)*spacing, static_cast<double>(j)*spacing, static_cast<double>(k)*spacing, period, cx, cy, cz);
+                values[3*p] = static_cast<float>(cx);
+                values[3*p+1] = static_cast<float>(cy);
+                values[3*p+2] = static_cast<float>(cz);
+            }
+        });
+
+    }
+
+    float Table::period() const {
+
+        return table_period;
+
+    }
+
+    void Table::correction(float dx, float dy, float dz, float &cx, float &cy, float &cz) const {
+
+        float scale = 2.f*static_cast<float>(table_cells)/table_period;
+        std::size_t i, j, k;
+        float fx, fy, fz, sx, sy, sz;
+        locate(dx, scale, i, fx, sx);
+        locate(dy, scale, j, fy, sy);
+        locate(dz, scale, k, fz, sz);
+
+        cx = cy = cz = 0.f;
+        for (std::size_t corner = 0; corner < 8; corner++) {
+            std::size_t di = corner & 1, dj = (corner >> 1) & 1, dk = corner >> 2;
+            float w = (di ? fx : 1.f - fx)*(dj ? fy : 1.f - fy)*(dk ? fz : 1.f - fz);
+            const float *value = &values[3*((i+di) + (j+dj)*table_points + (k+dk)*table_points*table_points)];
+            cx += w*value[0];
+            cy += w*value[1];
+            cz += w*value[2];
+        }
+
+        cx *= sx;
+        cy *= sy;
+        cz *= sz;
+
+    }
+
+}
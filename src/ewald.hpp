@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "parallel.hpp"
+
+namespace Ewald {
+
+    //A cube of width period repeating forever in every direction, with a uniform background of the same total mass but of opposite sign,
+    //so the sum over every image converges (Hernquist, Bouchet & Suto 1991). Gives what a source and every one of its images add to the
+    //acceleration of a particle, minus what the source alone adds through Newton's law, for a mass and G of 1. (dx, dy, dz) points from the
+    //particle to the source, and should be the closest image of it, every component within half a period of 0.
+    //The closest image plus this is the whole periodic sum. 0 for an offset of 0
+    void exact_correction(double dx, double dy, double dz, double period, double &cx, double &cy, double &cz);
+
+    //exact_correction on a grid over one octant of the closest images, interpolated linearly. Odd in the component along an axis and even
+    //in the other two, so the other octants are mirrored. The correction is smooth over the whole box, the 1/r² part being taken out of it
+    class Table {
+
+        float table_period = 0.f;
+        std::vector<float> values;  //cx, cy and cz of every grid point, x fastest
+
+    public:
+
+        //Evaluates exact_correction at every grid point, using every thread of the pool. Takes a while, so only done again if period changes
+        void build(float period, Parallel::ThreadPool &pool);
+        //0 if the table was never built
+        float period() const;
+
+        //The interpolated correction for a source at offset (dx, dy, dz) from the particle, for a mass and G of 1
+        void correction(float dx, float dy, float dz, float &cx, float &cy, float &cz) const;
+
+    };
+
+}
@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include "fmm.hpp"
+
+namespace {
+
+    //Nodes with at most this many particles (or n_particles/min_tasks, whichever is larger) are handed to the pool as one task
+    constexpr std::size_t min_tasks = 256;
+
+    bool is_group(const BarnesHut::Node &node, std::size_t group_size) {
+
+        return !node.has_sub_nodes || node.particle_end - node.particle_begin <= group_size;
+
+    }
+
+    //Multipole to local: adds the field of source around target's center of mass to local
+    void add_field(FMM::Local &local, const FMM::Cell &target, const FMM::Cell &source, const Kernels::Parameters &gravity) {
+
+        //r points from the target towards the source, and the field is softened the same way as the direct interactions
+        float rx = static_cast<float>(source.x - target.x);
+        float ry = static_cast<float>(source.y - target.y);
+        float rz = static_cast<float>(source.z - target.z);
+        float inv_dist = 1.f / std::sqrt(rx*rx + ry*ry + rz*rz + gravity.softening*gravity.softening);
+
+        //a = GM*r/|r|³, and its gradient da_i/dx_j = GM*(3*r_i*r_j/|r|⁵ - δ_ij/|r|³)
+        float s = gravity.G*source.mass*inv_dist*inv_dist*inv_dist;
+        float t = 3.f*s*inv_dist*inv_dist;
+
+        local.ax += s*rx;
+        local.ay += s*ry;
+        local.az += s*rz;
+        local.jxx += t*rx*rx - s;
+        local.jxy += t*rx*ry;
+        local.jxz += t*rx*rz;
+        local.jyy += t*ry*ry - s;
+        local.jyz += t*ry*rz;
+        local.jzz += t*rz*rz - s;
+
+    }
+
+}
+
+namespace FMM {
+
+    void Local::add(const Local &other) {
+
+        ax += other.ax;
+        ay += other.ay;
+        az += other.az;
+        jxx += other.jxx;
+        jxy += other.jxy;
+        jxz += other.jxz;
+        jyy += other.jyy;
+        jyz += other.jyz;
+        jzz += other.jzz;
+
+    }
+
+    bool Solver::is_well_separated(const Cell &a, const Cell &b) const {
+
+        float dx = static_cast<float>(a.x - b.x);
+        float dy = static_cast<float>(a.y - b.y);
+        float dz = static_cast<float>(a.z - b.z);
+        float reach = a.radius + b.radius;
+        return reach*reach < theta*theta*(dx*dx + dy*dy + dz*dz);
+
+    }
+
+    void Solver::interact(std::uint32_t target_idx, std::uint32_t source_idx, const BarnesHut::Tree &tree, const Kernels::Parameters &gravity,
+            std::size_t group_size, std::vector<NearPair> &near_pairs) {
+
+        const std::vector<BarnesHut::Node> &nodes = tree.get_nodes();
+        const BarnesHut::Node &target = nodes[target_idx];
+        const BarnesHut::Node &source = nodes[source_idx];
+
+        if (is_well_separated(cells[target_idx], cells[source_idx])) {
+            add_field(locals[target_idx], cells[target_idx], cells[source_idx], gravity);
+        }
+        else if (is_group(target, group_size)) {
+            near_pairs.push_back({target_idx, source_idx});
+        }
+        else if (!source.has_sub_nodes || target.depth <= source.depth) {
+            //Split whichever node is larger, so both sides of an interaction are about the same size
+            for (std::uint32_t sub_node : target.sub_nodes) {
+                if (sub_node != BarnesHut::no_node) interact(sub_node, source_idx, tree, gravity, group_size, near_pairs);
+            }
+        }
+        else {
+            for (std::uint32_t sub_node : source.sub_nodes) {
+                if (sub_node != BarnesHut::no_node) interact(target_idx, sub_node, tree, gravity, group_size, near_pairs);
+            }
+        }
+
+    }
+
+    void Solver::interact_group(const BarnesHut::Tree &tree, Particle::Store &particles, const NearPair *first, const NearPair *last,
+            const Kernels::Parameters &gravity, std::size_t group_size, Kernels::Sources &sources) {
+
+        const std::vector<BarnesHut::Node> &nodes = tree.get_nodes();
+        const std::vector<std::uint32_t> &sorted_particles = tree.get_sorted_particles();
+
+        std::uint32_t target_idx = first->target_idx;
+        const Cell &target_cell = cells[target_idx];
+        Local local;
+
+        //Everything near the group goes into one list, so the kernel runs once per particle no matter how many nodes the list came from.
+        //The group can't be split, so source nodes no larger than a group are summed directly instead of being split further.
+        //Sources and particles are offsets from the group's center of mass
+        Vectors::Point origin = {target_cell.x, target_cell.y, target_cell.z};
+        sources.clear();
+
+        std::array<std::uint32_t, 8*(BarnesHut::max_depth+1)> stack;
+
+        for (const NearPair *pair = first; pair != last; pair++) {
+
+            std::size_t stack_size = 0;
+            stack[stack_size++] = pair->source_idx;
+
+            while (stack_size > 0) {
+
+                std::uint32_t node_idx = stack[--stack_size];
+                const BarnesHut::Node &node = nodes[node_idx];
+
+                if (is_well_separated(target_cell, cells[node_idx])) {
+                    add_field(local, target_cell, cells[node_idx], gravity);
+                }
+                else if (is_group(node, group_size)) {
+                    for (std::uint32_t i = node.particle_begin; i < node.particle_end; i++) {
+                        std::uint32_t particle_idx = sorted_particles[i];
+                        Vectors::Vec3 offset = particles.position(particle_idx) - origin;
+                        sources.push_back(offset.x, offset.y, offset.z, particles.mass[particle_idx]);
+                    }
+                }
+                else {
+                    for (std::size_t i = node.sub_nodes.size(); i-- > 0;) {
+                        if (node.sub_nodes[i] != BarnesHut::no_node) stack[stack_size++] = node.sub_nodes[i];
+                    }
+                }
+
+            }
+
+        }
+
+        locals[target_idx].add(local);
+
+        if (sources.size() == 0) return;
+
+        const BarnesHut::Node &target = nodes[target_idx];
+        for (std::uint32_t i = target.particle_begin; i < target.particle_end; i++) {
+            std::uint32_t particle_idx = sorted_particles[i];
+            Vectors::Vec3 offset = particles.position(particle_idx) - origin;
+            Kernels::accumulate_gravity(sources, offset.x, offset.y, offset.z, gravity, particles.ax[particle_idx], particles.ay[particle_idx],
+                    particles.az[particle_idx]);
+        }
+
+    }
+
+    void Solver::compute_radius(const BarnesHut::Tree &tree, const Particle::Store &particles, std::uint32_t node_idx, std::size_t task_size) {
+
+        const BarnesHut::Node &node = tree.get_nodes()[node_idx];
+        Cell &cell = cells[node_idx];
+        cell.radius = 0.f;
+
+        if (!node.has_sub_nodes) {
+            const std::vector<std::uint32_t> &sorted_particles = tree.get_sorted_particles();
+            for (std::uint32_t i = node.particle_begin; i < node.particle_end; i++) {
+                std::uint32_t particle_idx = sorted_particles[i];
+                float dx = static_cast<float>(particles.x[particle_idx] - cell.x);
+                float dy = static_cast<float>(particles.y[particle_idx] - cell.y);
+                float dz = static_cast<float>(particles.z[particle_idx] - cell.z);
+                cell.radius = std::max(cell.radius, std::sqrt(dx*dx + dy*dy + dz*dz));
+            }
+            return;
+        }
+
+        //Every sub node's sphere has to fit inside, so the radius is never smaller than the real one. If task_size is greater than 0,
+        //the sub nodes at or below the size of a task are already done
+        for (std::uint32_t sub_node : node.sub_nodes) {
+            if (sub_node == BarnesHut::no_node) continue;
+            if (task_size == 0 || !is_group(tree.get_nodes()[sub_node], task_size)) compute_radius(tree, particles, sub_node, task_size);
+
+            const Cell &sub_cell = cells[sub_node];
+            float dx = static_cast<float>(sub_cell.x - cell.x);
+            float dy = static_cast<float>(sub_cell.y - cell.y);
+            float dz = static_cast<float>(sub_cell.z - cell.z);
+            cell.radius = std::max(cell.radius, std::sqrt(dx*dx + dy*dy + dz*dz) + sub_cell.radius);
+        }
+
+    }
+
+    void Solver::pass_down(const BarnesHut::Tree &tree, Particle::Store &particles, std::uint32_t node_idx, std::size_t group_size) {
+
+        const BarnesHut::Node &node = tree.get_nodes()[node_idx];
+        const Cell &cell = cells[node_idx];
+        const Local &local = locals[node_idx];
+
+        if (is_group(node, group_size)) {
+            //Evaluate the local expansion at every particle
+            const std::vector<std::uint32_t> &sorted_particles = tree.get_sorted_particles();
+            for (std::uint32_t i = node.particle_begin; i < node.particle_end; i++) {
+                std::uint32_t particle_idx = sorted_particles[i];
+                float dx = static_cast<float>(particles.x[particle_idx] - cell.x);
+                float dy = static_cast<float>(particles.y[particle_idx] - cell.y);
+                float dz = static_cast<float>(particles.z[particle_idx] - cell.z);
+                particles.ax[particle_idx] += local.ax + local.jxx*dx + local.jxy*dy + local.jxz*dz;
+                particles.ay[particle_idx] += local.ay + local.jxy*dx + local.jyy*dy + local.jyz*dz;
+                particles.az[particle_idx] += local.az + local.jxz*dx + local.jyz*dy + local.jzz*dz;
+            }
+            return;
+        }
+
+        //Shift the local expansion to the center of mass of every sub node. The gradient stays the same, since the expansion is linear
+        for (std::uint32_t sub_node : node.sub_nodes) {
+            if (sub_node == BarnesHut::no_node) continue;
+
+            float dx = static_cast<float>(cells[sub_node].x - cell.x);
+            float dy = static_cast<float>(cells[sub_node].y - cell.y);
+            float dz = static_cast<float>(cells[sub_node].z - cell.z);
+
+            Local shifted = local;
+            shifted.ax += local.jxx*dx + local.jxy*dy + local.jxz*dz;
+            shifted.ay += local.jxy*dx + local.jyy*dy + local.jyz*dz;
+            shifted.az += local.jxz*dx + local.jyz*dy + local.jzz*dz;
+            locals[sub_node].add(shifted);
+
+            pass_down(tree, particles, sub_node, group_size);
+        }
+
+    }
+
+    void Solver::compute_accelerations(Particle::Store &particles, const BarnesHut::Tree &tree, const Kernels::Parameters &gravity,
+            std::size_t group_size, Parallel::ThreadPool &pool) {
+
+        const std::vector<BarnesHut::Node> &nodes = tree.get_nodes();
+        const std::vector<std::uint32_t> &sorted_particles = tree.get_sorted_particles();
+
+        std::uint32_t n_inside = nodes.empty() ? 0 : nodes[0].particle_end;
+
+        //Particles outside of the root box aren't part of any node, so they walk the tree one by one
+        pool.for_each_range(sorted_particles.size() - n_inside, group_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            static thread_local Kernels::Sources sources;
+            static thread_local Kernels::Multipoles multipoles;
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+                tree.apply_gravity(particles, sorted_particles[n_inside + i], gravity, sources, multipoles);
+            }
+        });
+
+        if (nodes.empty()) return;
+
+        cells.resize(nodes.size());
+        locals.assign(nodes.size(), Local());
+        pool.for_each_range(nodes.size(), 4096, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+                cells[i].x = nodes[i].position.x/nodes[i].mass;
+                cells[i].y = nodes[i].position.y/nodes[i].mass;
+                cells[i].z = nodes[i].position.z/nodes[i].mass;
+                cells[i].mass = nodes[i].mass;
+            }
+        });
+
+        //Every task is a target for everything in the tree, and only ever writes to its own nodes and particles.
+        //Interactions above the tasks are done by every task on its own instead, which costs little as long as there aren't too many of them
+        std::size_t task_size = std::max(group_size, static_cast<std::size_t>(n_inside)/min_tasks);
+        tasks.clear();
+
+        std::array<std::uint32_t, 8*(BarnesHut::max_depth+1)> stack;
+        std::size_t stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            std::uint32_t node_idx = stack[--stack_size];
+            const BarnesHut::Node &node = nodes[node_idx];
+
+            if (is_group(node, task_size)) {
+                tasks.push_back(node_idx);
+                continue;
+            }
+            for (std::uint32_t sub_node : node.sub_nodes) {
+                if (sub_node != BarnesHut::no_node) stack[stack_size++] = sub_node;
+            }
+        }
+
+        //Radii of the tasks and everything below them first, then of the nodes above them
+        pool.for_each_range(tasks.size(), 1, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) compute_radius(tree, particles, tasks[i], 0);
+        });
+        if (!is_group(nodes[0], task_size)) compute_radius(tree, particles, 0, task_size);
+
+        pool.for_each_range(tasks.size(), 1, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            static thread_local Kernels::Sources sources;
+            static thread_local std::vector<NearPair> near_pairs;
+
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+
+                near_pairs.clear();
+                interact(tasks[i], 0, tree, gravity, group_size, near_pairs);
+
+                //Every group gets one list of direct interactions, from all of the nodes that were too close to it
+                std::sort(near_pairs.begin(), near_pairs.end(), [](const NearPair &a, const NearPair &b) {
+                    return a.target_idx < b.target_idx;
+                });
+                for (std::size_t first = 0, last = 0; first < near_pairs.size(); first = last) {
+                    while (last < near_pairs.size() && near_pairs[last].target_idx == near_pairs[first].target_idx) last++;
+                    interact_group(tree, particles, &near_pairs[first], &near_pairs[0] + last, gravity, group_size, sources);
+                }
+
+                pass_down(tree, particles, tasks[i], group_size);
+
+            }
+        });
+
+    }
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "barnes_hut.hpp"
+#include "gravity_kernels.hpp"
+#include "parallel.hpp"
+#include "particle_store.hpp"
+
+namespace FMM {
+
+    //What the solver needs of every node of the tree, packed together since the interactions read them for pairs of nodes
+    class Cell {
+
+    public:
+        Vectors::Coordinate x, y, z; //Center of mass, in the coordinates of the particles
+        float mass;
+        float radius;  //Distance from the center of mass to the farthest particle of the node
+
+    };
+
+    //The field around the center of mass of a node: the acceleration at the center, and its gradient, which is symmetric
+    class Local {
+
+    public:
+        float ax = 0.f, ay = 0.f, az = 0.f;
+        float jxx = 0.f, jxy = 0.f, jxz = 0.f, jyy = 0.f, jyz = 0.f, jzz = 0.f;
+
+        void add(const Local &other);
+
+    };
+
+    //Fast multipole method on the Barnes-Hut tree. Every node is a monopole at its center of mass, and pairs of nodes that are far enough apart
+    //from each other interact once, cell to cell, by adding the field of the source node to the local expansion of the target node.
+    //The local expansions are then passed down the tree and evaluated for every particle, so the far field costs about the same for every
+    //particle no matter how many there are. Anything closer is summed directly with the gravity kernel
+    class Solver {
+
+        //A group of particles, and a node that is too close to it to be used as a whole
+        class NearPair {
+
+        public:
+            std::uint32_t target_idx;
+            std::uint32_t source_idx;
+
+        };
+
+        std::vector<Cell> cells;
+        std::vector<Local> locals;
+
+        std::vector<std::uint32_t> tasks; //Nodes that are handed to the pool, every one with all of its sub nodes
+
+        void interact(std::uint32_t target_idx, std::uint32_t source_idx, const BarnesHut::Tree &tree, const Kernels::Parameters &gravity,
+                std::size_t group_size, std::vector<NearPair> &near_pairs);
+        void interact_group(const BarnesHut::Tree &tree, Particle::Store &particles, const NearPair *first, const NearPair *last,
+                const Kernels::Parameters &gravity, std::size_t group_size, Kernels::Sources &sources);
+        void compute_radius(const BarnesHut::Tree &tree, const Particle::Store &particles, std::uint32_t node_idx, std::size_t task_size);
+        void pass_down(const BarnesHut::Tree &tree, Particle::Store &particles, std::uint32_t node_idx, std::size_t group_size);
+
+        bool is_well_separated(const Cell &a, const Cell &b) const;
+
+    public:
+
+        //Two nodes interact cell to cell if the sum of their radii is less than theta times the distance between their centers of mass
+        float theta = 0.7f;
+
+        //Adds the gravity on every particle to its acceleration. Expects the tree to be built from the same particles.
+        //Nodes with at most group_size particles are never split, their particles share one list of direct interactions instead
+        void compute_accelerations(Particle::Store &particles, const BarnesHut::Tree &tree, const Kernels::Parameters &gravity, std::size_t group_size,
+                Parallel::ThreadPool &pool);
+
+    };
+
+}
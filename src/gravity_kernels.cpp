@@ -0,0 +1,401 @@
+#include <cassert>
+#include <cmath>
+
+#if defined(__AVX512F__) || defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "gravity_kernels.hpp"
+
+namespace {
+
+    constexpr std::size_t short_range_entries = 1024;   //Over the distance up to the cutoff
+
+    //The interaction of a single source, used for whatever is left over after the vector loop. G is applied by the caller
+    void accumulate_scalar(const Kernels::Sources &sources, std::size_t begin, float x, float y, float z, float softening_sq, float &ax, float &ay, float &az) {
+
+        for (std::size_t i = begin; i < sources.size(); i++) {
+            float dx = sources.x[i] - x;
+            float dy = sources.y[i] - y;
+            float dz = sources.z[i] - z;
+
+            //a = M*d/(r²+eps²)^(3/2). d/r is the direction and M/r² the magnitude, without ever normalizing d
+            float inv_dist = 1.f / std::sqrt(dx*dx + dy*dy + dz*dz + softening_sq);
+            float s = sources.mass[i]*inv_dist*inv_dist*inv_dist;
+            ax += dx*s;
+            ay += dy*s;
+            az += dz*s;
+        }
+
+    }
+
+    //The interaction of a single multipole source. G is applied by the caller
+    inline void accumulate_multipole(const Kernels::Multipoles &sources, std::size_t i, float x, float y, float z, float softening_sq,
+            float &ax, float &ay, float &az) {
+
+        float dx = sources.x[i] - x;
+        float dy = sources.y[i] - y;
+        float dz = sources.z[i] - z;
+
+        float inv_dist = 1.f / std::sqrt(dx*dx + dy*dy + dz*dz + softening_sq);
+        float inv_dist_2 = inv_dist*inv_dist;
+        float inv_dist_3 = inv_dist*inv_dist_2;
+        float inv_dist_5 = inv_dist_3*inv_dist_2;
+
+        //With d pointing towards the source: a = M*d/r³ - Q*d/r⁵ + 5/2*(dᵀ*Q*d)*d/r⁷
+        float qx = sources.xx[i]*dx + sources.xy[i]*dy + sources.xz[i]*dz;
+        float qy = sources.xy[i]*dx + sources.yy[i]*dy + sources.yz[i]*dz;
+        float qz = sources.xz[i]*dx + sources.yz[i]*dy + sources.zz[i]*dz;
+        float s = sources.mass[i]*inv_dist_3 + 2.5f*(dx*qx + dy*qy + dz*qz)*inv_dist_5*inv_dist_2;
+
+        ax += dx*s - qx*inv_dist_5;
+        ay += dy*s - qy*inv_dist_5;
+        az += dz*s - qz*inv_dist_5;
+
+    }
+
+}
+
+namespace Kernels {
+
+    std::size_t Sources::size() const {
+
+        return x.size();
+
+    }
+
+    void Sources::clear() {
+
+        x.clear();
+        y.clear();
+        z.clear();
+        mass.clear();
+
+    }
+
+    void Sources::push_back(float source_x, float source_y, float source_z, float source_mass) {
+
+        x.push_back(source_x);
+        y.push_back(source_y);
+        z.push_back(source_z);
+        mass.push_back(source_mass);
+
+    }
+
+    std::size_t Multipoles::size() const {
+
+        return x.size();
+
+    }
+
+    void Multipoles::clear() {
+
+        for (std::vector<float> *column : {&x, &y, &z, &mass, &xx, &xy, &xz, &yy, &yz, &zz}) column->clear();
+
+    }
+
+    void Multipoles::push_back(float source_x, float source_y, float source_z, float source_mass, const Quadrupole &quadrupole) {
+
+        x.push_back(source_x);
+        y.push_back(source_y);
+        z.push_back(source_z);
+        mass.push_back(source_mass);
+        xx.push_back(quadrupole.xx);
+        xy.push_back(quadrupole.xy);
+        xz.push_back(quadrupole.xz);
+        yy.push_back(quadrupole.yy);
+        yz.push_back(quadrupole.yz);
+        zz.push_back(quadrupole.zz);
+
+    }
+
+    void accumulate_gravity(const Multipoles &sources, float x, float y, float z, const Parameters &parameters, float &ax, float &ay, float &az) {
+
+        assert(parameters.softening > 0.f);
+
+        //Every lane sums up every lanes'th source, so the loop over the lanes is free to be vectorized without reordering any sums
+        constexpr std::size_t lanes = 8;
+        float sum_x[lanes] = {}, sum_y[lanes] = {}, sum_z[lanes] = {};
+
+        const std::size_t n = sources.size();
+        const float softening_sq = parameters.softening*parameters.softening;
+
+        std::size_t i = 0;
+        for (; i+lanes <= n; i += lanes) {
+            for (std::size_t lane = 0; lane < lanes; lane++) {
+                accumulate_multipole(sources, i+lane, x, y, z, softening_sq, sum_x[lane], sum_y[lane], sum_z[lane]);
+            }
+        }
+        for (; i < n; i++) accumulate_multipole(sources, i, x, y, z, softening_sq, sum_x[0], sum_y[0], sum_z[0]);
+
+        float sx = 0.f, sy = 0.f, sz = 0.f;
+        for (std::size_t lane = 0; lane < lanes; lane++) {
+            sx += sum_x[lane];
+            sy += sum_y[lane];
+            sz += sum_z[lane];
+        }
+
+        ax += sx*parameters.G;
+        ay += sy*parameters.G;
+        az += sz*parameters.G;
+
+    }
+
+    void ShortRange::set(float split, float cutoff) {
+
+        split_length = split;
+        cutoff_length = cutoff;
+        entries_per_length = static_cast<float>(short_range_entries)/cutoff;
+
+        //One entry past the cutoff, for the interpolation of the last one
+        factors.resize(short_range_entries+2);
+        const double sqrt_pi = std::sqrt(3.14159265358979323846);
+        for (std::size_t i = 0; i < factors.size(); i++) {
+            double r = static_cast<double>(i)/entries_per_length;
+            double u = r/(2.0*split);
+            factors[i] = i > short_range_entries ? 0.f : static_cast<float>(std::erfc(u) + r/(split*sqrt_pi)*std::exp(-u*u));
+        }
+
+    }
+
+    float ShortRange::split() const {
+
+        return split_length;
+
+    }
+
+    float ShortRange::cutoff() const {
+
+        return cutoff_length;
+
+    }
+
+    float ShortRange::factor(float r) const {
+
+        float u = r*entries_per_length;
+        if (!(u < static_cast<float>(short_range_entries))) return 0.f;
+        std::size_t i = static_cast<std::size_t>(u);
+        float fraction = u - static_cast<float>(i);
+        return factors[i] + (factors[i+1] - factors[i])*fraction;
+
+    }
+
+    void accumulate_short_range_gravity(const Sources &sources, float x, float y, float z, const Parameters &parameters, const ShortRange &short_range,
+            float &ax, float &ay, float &az) {
+
+        assert(parameters.softening > 0.f);
+
+        const float softening_sq = parameters.softening*parameters.softening;
+        float sx = 0.f, sy = 0.f, sz = 0.f;
+
+        for (std::size_t i = 0; i < sources.size(); i++) {
+            float dx = sources.x[i] - x;
+            float dy = sources.y[i] - y;
+            float dz = sources.z[i] - z;
+
+            float dist_sq = dx*dx + dy*dy + dz*dz + softening_sq;
+            float inv_dist = 1.f / std::sqrt(dist_sq);
+            float s = sources.mass[i]*inv_dist*inv_dist*inv_dist*short_range.factor(dist_sq*inv_dist);
+            sx += dx*s;
+            sy += dy*s;
+            sz += dz*s;
+        }
+
+        ax += sx*parameters.G;
+        ay += sy*parameters.G;
+        az += sz*parameters.G;
+
+    }
+
+#if defined(__AVX512F__)
+
+    namespace {
+
+        float horizontal_sum(__m512 v) {
+            float lanes[16];
+            _mm512_storeu_ps(lanes, v);
+            float sum = 0.f;
+            for (std::size_t i = 0; i < 16; i++) sum += lanes[i];
+            return sum;
+        }
+
+    }
+
+    void accumulate_gravity(const Sources &sources, float x, float y, float z, const Parameters &parameters, float &ax, float &ay, float &az) {
+
+        assert(parameters.softening > 0.f);
+
+        const std::size_t n = sources.size();
+        const float softening_sq = parameters.softening*parameters.softening;
+        const __m512 px = _mm512_set1_ps(x), py = _mm512_set1_ps(y), pz = _mm512_set1_ps(z);
+        const __m512 eps_sq = _mm512_set1_ps(softening_sq);
+        const __m512 half = _mm512_set1_ps(0.5f), three_halves = _mm512_set1_ps(1.5f);
+        __m512 sum_x = _mm512_setzero_ps(), sum_y = _mm512_setzero_ps(), sum_z = _mm512_setzero_ps();
+
+        std::size_t i = 0;
+        for (; i+16 <= n; i += 16) {
+            __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(&sources.x[i]), px);
+            __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(&sources.y[i]), py);
+            __m512 dz = _mm512_sub_ps(_mm512_loadu_ps(&sources.z[i]), pz);
+            __m512 dist_sq = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_fmadd_ps(dz, dz, eps_sq)));
+
+            //14 bit estimate, refined with one Newton-Raphson step
+            __m512 inv_dist = _mm512_maskz_rsqrt14_ps(0xFFFF, dist_sq);
+            inv_dist = _mm512_mul_ps(inv_dist, _mm512_fnmadd_ps(_mm512_mul_ps(half, dist_sq), _mm512_mul_ps(inv_dist, inv_dist), three_halves));
+
+            __m512 s = _mm512_mul_ps(_mm512_loadu_ps(&sources.mass[i]), _mm512_mul_ps(inv_dist, _mm512_mul_ps(inv_dist, inv_dist)));
+            sum_x = _mm512_fmadd_ps(dx, s, sum_x);
+            sum_y = _mm512_fmadd_ps(dy, s, sum_y);
+            sum_z = _mm512_fmadd_ps(dz, s, sum_z);
+        }
+
+        float sx = horizontal_sum(sum_x), sy = horizontal_sum(sum_y), sz = horizontal_sum(sum_z);
+        accumulate_scalar(sources, i, x, y, z, softening_sq, sx, sy, sz);
+
+        ax += sx*parameters.G;
+        ay += sy*parameters.G;
+        az += sz*parameters.G;
+
+    }
+
+    const char *instruction_set() {
+
+        return "AVX-512";
+
+    }
+
+#elif defined(__AVX2__)
+
+    namespace {
+
+        float horizontal_sum(__m256 v) {
+            __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+            sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+            sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+            return _mm_cvtss_f32(sum);
+        }
+
+    }
+
+    void accumulate_gravity(const Sources &sources, float x, float y, float z, const Parameters &parameters, float &ax, float &ay, float &az) {
+
+        assert(parameters.softening > 0.f);
+
+        const std::size_t n = sources.size();
+        const float softening_sq = parameters.softening*parameters.softening;
+        const __m256 px = _mm256_set1_ps(x), py = _mm256_set1_ps(y), pz = _mm256_set1_ps(z);
+        const __m256 eps_sq = _mm256_set1_ps(softening_sq);
+        const __m256 half = _mm256_set1_ps(0.5f), three_halves = _mm256_set1_ps(1.5f);
+        __m256 sum_x = _mm256_setzero_ps(), sum_y = _mm256_setzero_ps(), sum_z = _mm256_setzero_ps();
+
+        std::size_t i = 0;
+        for (; i+8 <= n; i += 8) {
+            __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(&sources.x[i]), px);
+            __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(&sources.y[i]), py);
+            __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(&sources.z[i]), pz);
+            __m256 dist_sq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_add_ps(_mm256_mul_ps(dz, dz), eps_sq));
+
+            //12 bit estimate, refined with one Newton-Raphson step
+            __m256 inv_dist = _mm256_rsqrt_ps(dist_sq);
+            inv_dist = _mm256_mul_ps(inv_dist, _mm256_sub_ps(three_halves, _mm256_mul_ps(_mm256_mul_ps(half, dist_sq), _mm256_mul_ps(inv_dist, inv_dist))));
+
+            __m256 s = _mm256_mul_ps(_mm256_loadu_ps(&sources.mass[i]), _mm256_mul_ps(inv_dist, _mm256_mul_ps(inv_dist, inv_dist)));
+            sum_x = _mm256_add_ps(sum_x, _mm256_mul_ps(dx, s));
+            sum_y = _mm256_add_ps(sum_y, _mm256_mul_ps(dy, s));
+            sum_z = _mm256_add_ps(sum_z, _mm256_mul_ps(dz, s));
+        }
+
+        float sx = horizontal_sum(sum_x), sy = horizontal_sum(sum_y), sz = horizontal_sum(sum_z);
+        accumulate_scalar(sources, i, x, y, z, softening_sq, sx, sy, sz);
+
+        ax += sx*parameters.G;
+        ay += sy*parameters.G;
+        az += sz*parameters.G;
+
+    }
+
+    const char *instruction_set() {
+
+        return "AVX2";
+
+    }
+
+#elif defined(__SSE2__)
+
+    namespace {
+
+        float horizontal_sum(__m128 v) {
+            __m128 sum = _mm_add_ps(v, _mm_movehl_ps(v, v));
+            sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+            return _mm_cvtss_f32(sum);
+        }
+
+    }
+
+    void accumulate_gravity(const Sources &sources, float x, float y, float z, const Parameters &parameters, float &ax, float &ay, float &az) {
+
+        assert(parameters.softening > 0.f);
+
+        const std::size_t n = sources.size();
+        const float softening_sq = parameters.softening*parameters.softening;
+        const __m128 px = _mm_set1_ps(x), py = _mm_set1_ps(y), pz = _mm_set1_ps(z);
+        const __m128 eps_sq = _mm_set1_ps(softening_sq);
+        const __m128 half = _mm_set1_ps(0.5f), three_halves = _mm_set1_ps(1.5f);
+        __m128 sum_x = _mm_setzero_ps(), sum_y = _mm_setzero_ps(), sum_z = _mm_setzero_ps();
+
+        std::size_t i = 0;
+        for (; i+4 <= n; i += 4) {
+            __m128 dx = _mm_sub_ps(_mm_loadu_ps(&sources.x[i]), px);
+            __m128 dy = _mm_sub_ps(_mm_loadu_ps(&sources.y[i]), py);
+            __m128 dz = _mm_sub_ps(_mm_loadu_ps(&sources.z[i]), pz);
+            __m128 dist_sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_add_ps(_mm_mul_ps(dz, dz), eps_sq));
+
+            //12 bit estimate, refined with one Newton-Raphson step
+            __m128 inv_dist = _mm_rsqrt_ps(dist_sq);
+            inv_dist = _mm_mul_ps(inv_dist, _mm_sub_ps(three_halves, _mm_mul_ps(_mm_mul_ps(half, dist_sq), _mm_mul_ps(inv_dist, inv_dist))));
+
+            __m128 s = _mm_mul_ps(_mm_loadu_ps(&sources.mass[i]), _mm_mul_ps(inv_dist, _mm_mul_ps(inv_dist, inv_dist)));
+            sum_x = _mm_add_ps(sum_x, _mm_mul_ps(dx, s));
+            sum_y = _mm_add_ps(sum_y, _mm_mul_ps(dy, s));
+            sum_z = _mm_add_ps(sum_z, _mm_mul_ps(dz, s));
+        }
+
+        float sx = horizontal_sum(sum_x), sy = horizontal_sum(sum_y), sz = horizontal_sum(sum_z);
+        accumulate_scalar(sources, i, x, y, z, softening_sq, sx, sy, sz);
+
+        ax += sx*parameters.G;
+        ay += sy*parameters.G;
+        az += sz*parameters.G;
+
+    }
+
+    const char *instruction_set() {
+
+        return "SSE";
+
+    }
+
+#else
+
+    void accumulate_gravity(const Sources &sources, float x, float y, float z, const Parameters &parameters, float &ax, float &ay, float &az) {
+
+        assert(parameters.softening > 0.f);
+
+        float sx = 0.f, sy = 0.f, sz = 0.f;
+        accumulate_scalar(sources, 0, x, y, z, parameters.softening*parameters.softening, sx, sy, sz);
+
+        ax += sx*parameters.G;
+        ay += sy*parameters.G;
+        az += sz*parameters.G;
+
+    }
+
+    const char *instruction_set() {
+
+        return "scalar";
+
+    }
+
+#endif
+
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace Kernels {
+
+    class Parameters {
+
+    public:
+        float G = 1.f;
+
+        //Plummer softening length. Every interaction is evaluated as if the two masses were eps further apart, a = MG*d/(r²+eps²)^(3/2),
+        //which keeps close encounters finite without a hard cutoff. Must be greater than 0
+        float softening = 0.1f;
+
+    };
+
+    //Point masses pulling on a particle, stored as one array per component so the kernel can load several of them at a time
+    class Sources {
+
+    public:
+        std::vector<float> x, y, z;
+        std::vector<float> mass;
+
+        std::size_t size() const;
+        void clear();
+        void push_back(float source_x, float source_y, float source_z, float source_mass);
+
+    };
+
+    //Traceless quadrupole moment of a group of masses around their center of mass, sum of m*(3*d*dᵀ - |d|²*I). Symmetric, so only 6 of the 9
+    //components are stored
+    class Quadrupole {
+
+    public:
+        float xx = 0.f, xy = 0.f, xz = 0.f;
+        float yy = 0.f, yz = 0.f, zz = 0.f;
+
+    };
+
+    //Groups of masses seen from far away, as their total mass at their center of mass plus their quadrupole moment
+    class Multipoles {
+
+    public:
+        std::vector<float> x, y, z;
+        std::vector<float> mass;
+        std::vector<float> xx, xy, xz, yy, yz, zz;
+
+        std::size_t size() const;
+        void clear();
+        void push_back(float source_x, float source_y, float source_z, float source_mass, const Quadrupole &quadrupole);
+
+    };
+
+    //The short range part of gravity when the long range part comes from a mesh (TreePM). Newton's law times
+    //erfc(r/2s) + r/(s*sqrt(pi))*exp(-r²/4s²) for a split length s, which is 1 up close and falls to nothing a few s away.
+    //Tabulated against r up to the cutoff, and 0 beyond it
+    class ShortRange {
+
+        float split_length = 0.f;
+        float cutoff_length = 0.f;
+        float entries_per_length = 0.f;
+        std::vector<float> factors;
+
+    public:
+
+        void set(float split, float cutoff);
+        float split() const;
+        float cutoff() const;
+
+        //What the force at distance r is multiplied by
+        float factor(float r) const;
+
+    };
+
+    //Adds the softened acceleration every source gives a particle at (x, y, z) to (ax, ay, az). A source exactly on the particle adds nothing,
+    //so the particle itself can be among the sources. One reciprocal square root per interaction, using AVX-512, AVX2 or SSE if the code
+    //was compiled with them, and plain floats otherwise
+    void accumulate_gravity(const Sources &sources, float x, float y, float z, const Parameters &parameters, float &ax, float &ay, float &az);
+
+    //Same as above, with the quadrupole term of every source added to the monopole. Not hand vectorized, but written so the compiler can
+    void accumulate_gravity(const Multipoles &sources, float x, float y, float z, const Parameters &parameters, float &ax, float &ay, float &az);
+
+    //Same as the first one, with every interaction multiplied by the short range factor of its distance. The distance is the softened one,
+    //which is the same where it matters, since the factor is 1 up close. Not hand vectorized
+    void accumulate_short_range_gravity(const Sources &sources, float x, float y, float z, const Parameters &parameters, const ShortRange &short_range,
+            float &ax, float &ay, float &az);
+
+    //Name of the instruction set accumulate_gravity was compiled for
+    const char *instruction_set();
+
+}
@@ -0,0 +1,234 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "arguments.hpp"
+#include "profiling.hpp"
+#include "scenes.hpp"
+#include "simulation.hpp"
+#include "snapshot.hpp"
+#include "trajectory.hpp"
+
+namespace {
+
+    constexpr std::size_t default_checkpoint_interval = 100;
+    constexpr std::size_t default_trajectory_interval = 10;
+
+}
+
+//Steps the default scene a fixed number of times with a fixed delta time, without opening a window
+//Usage: gravity_sim_headless [n_particles] [n_steps] [delta_time] [n_threads] [--softening=<length>] [--group-size=<n>] [--leaf-size=<n>] [--solver=barnes-hut|fmm|tree-pm] [--theta=<angle>]
+//       [--integrator=euler|leapfrog|yoshida4|block] [--max-out-of-leaf=<fraction>] [--max-root-growth=<factor>] [--verify-threads=<n>] [--stats=<file>]
+//       [--checkpoint=<file>] [--checkpoint-every=<n>] [--restart=<file>] [--trajectory=<file>] [--trajectory-every=<n>] [--trajectory-fields=<list>]
+//       [--periodic=<width>] [--mesh=<cells>]
+//Every step is bit for bit the same for any number of threads. --verify-threads runs the same steps again with n threads, and fails
+//if the particles don't end up identical.
+//--stats writes the time of every phase and the work counters of every step to a CSV file, or JSON if the file name ends in .json.
+//--checkpoint writes a snapshot every --checkpoint-every steps (100 by default) on a thread of its own, and --restart starts from one instead
+//of the default scene. A restarted run steps exactly like the run that wrote the snapshot would have.
+//--trajectory streams the positions every --trajectory-every steps (10 by default) into a compressed trajectory, with the velocities too by
+//default. --trajectory-fields picks what else is stored, a comma separated list of velocity and acceleration, or none.
+//--periodic makes space a cube of the given width around the origin that repeats forever, with Ewald summation for the images. Without
+//--restart, it starts from particles spread uniformly at random over the whole box instead of the default scene.
+//--solver=tree-pm needs --periodic, and computes the long range part of gravity on a mesh of --mesh cells along every axis, a power of two,
+//by default the smallest with at least one cell per particle up to 128. The tree only adds the short range part
+int main(int argc, char** argv) {
+
+    std::size_t n_particles = 3000;
+    std::size_t n_steps = 1000;
+    float delta_time = 1.f/60.f;
+    std::size_t n_threads = 0;
+
+    std::vector<const char*> args = Arguments::positional(argc, argv);
+
+    if (args.size() >= 1 && !Arguments::parse_count(args[0], "particles", n_particles)) return EXIT_FAILURE;
+    if (args.size() >= 2 && !Arguments::parse_count(args[1], "steps", n_steps)) return EXIT_FAILURE;
+    if (args.size() >= 3 && !Arguments::parse_positive_float(args[2], "Delta time", delta_time)) return EXIT_FAILURE;
+    if (args.size() >= 4 && !Arguments::parse_count(args[3], "threads", n_threads)) return EXIT_FAILURE;
+    if (n_threads == 0) n_threads = Simulation::default_thread_count();
+
+    Simulation::Simulation simulation(n_threads);
+
+    if (!Simulation::read_options(argc, argv, simulation)) return EXIT_FAILURE;
+
+    std::size_t n_verify_threads = 0;
+    const char *verify_threads = Arguments::find_option(argc, argv, "verify-threads");
+    if (verify_threads && !Arguments::parse_count(verify_threads, "threads to verify with", n_verify_threads)) return EXIT_FAILURE;
+
+    const char *checkpoint_path = Arguments::find_option(argc, argv, "checkpoint");
+    std::size_t checkpoint_interval = checkpoint_path ? default_checkpoint_interval : 0;
+    const char *checkpoint_every = Arguments::find_option(argc, argv, "checkpoint-every");
+    if (checkpoint_every && !Arguments::parse_count(checkpoint_every, "steps between checkpoints", checkpoint_interval)) return EXIT_FAILURE;
+    if (!checkpoint_path) checkpoint_interval = 0;
+
+    Trajectory::Settings trajectory_settings;
+    const char *trajectory_path = Arguments::find_option(argc, argv, "trajectory");
+    std::size_t trajectory_interval = default_trajectory_interval;
+    const char *trajectory_every = Arguments::find_option(argc, argv, "trajectory-every");
+    if (trajectory_every && !Arguments::parse_count(trajectory_every, "steps between trajectory frames", trajectory_interval)) return EXIT_FAILURE;
+    if (trajectory_interval == 0) trajectory_interval = 1;
+    const char *trajectory_fields = Arguments::find_option(argc, argv, "trajectory-fields");
+    if (trajectory_fields && !Trajectory::parse_fields(trajectory_fields, trajectory_settings.fields)) return EXIT_FAILURE;
+
+    Particle::Store initial_particles;
+    Snapshot::Info start_info;
+    const char *restart_path = Arguments::find_option(argc, argv, "restart");
+    if (restart_path) {
+        if (!Snapshot::load(restart_path, initial_particles, start_info)) return EXIT_FAILURE;
+    }
+    else if (simulation.bh_tree.boundary == BarnesHut::Boundary::periodic) {
+        initial_particles = Scenes::uniform_box(n_particles, simulation.bh_tree.period);
+    }
+    else {
+        initial_particles = Scenes::two_spheres(n_particles);
+    }
+
+    std::unique_ptr<Profiling::Writer> stats_writer;
+    const char *stats_path = Arguments::find_option(argc, argv, "stats");
+    if (stats_path) {
+        stats_writer.reset(new Profiling::Writer(stats_path));
+        if (!stats_writer->is_open()) return EXIT_FAILURE;
+    }
+
+    float solver_theta = simulation.solver == Simulation::Solver::fmm ? simulation.fmm.theta : simulation.bh_tree.theta;
+
+    if (restart_path) {
+        std::printf("Restarting from \"%s\", %llu steps and %f seconds in.\n", restart_path, static_cast<unsigned long long>(start_info.step),
+                start_info.time);
+    }
+    std::printf("Using %zu particles.\n", initial_particles.size());
+    std::printf("Simulation using %zu threads.\n", simulation.thread_count());
+    std::printf("Softening length: %f\n", simulation.gravity.softening);
+    std::printf("Gravity solver: %s, theta %.2f, up to %zu particles per group and %zu per leaf.\n", Simulation::solver_name(simulation.solver),
+            solver_theta, simulation.group_size, simulation.bh_tree.leaf_size);
+    if (simulation.bh_tree.boundary == BarnesHut::Boundary::periodic) {
+        if (simulation.solver != Simulation::Solver::tree_pm) {
+            std::printf("Periodic box %f meters wide, with Ewald summation.\n", simulation.bh_tree.period);
+        }
+        else if (simulation.pm.cells != 0) {
+            std::printf("Periodic box %f meters wide, with a mesh of %zu cells along every axis.\n", simulation.bh_tree.period, simulation.pm.cells);
+        }
+        else {
+            std::printf("Periodic box %f meters wide, with a mesh sized by the number of particles.\n", simulation.bh_tree.period);
+        }
+    }
+    std::printf("Running %zu steps with a delta time of %f seconds, integrated with %s.\n", n_steps, delta_time,
+            Simulation::integrator_name(simulation.integrator));
+
+    simulation.particles = initial_particles;
+    simulation.restore(start_info.accelerations_are_current);
+
+    std::unique_ptr<Snapshot::Checkpointer> checkpointer;
+    if (checkpoint_path) checkpointer.reset(new Snapshot::Checkpointer(checkpoint_path));
+    auto is_checkpoint = [&](std::size_t i) {
+        return checkpoint_interval != 0 && (start_info.step + i + 1) % checkpoint_interval == 0;
+    };
+
+    std::unique_ptr<Trajectory::Writer> trajectory;
+    if (trajectory_path) {
+        trajectory.reset(new Trajectory::Writer(trajectory_path, trajectory_settings));
+        if (!trajectory->is_open()) return EXIT_FAILURE;
+    }
+
+    //Without a file to write every step to, the stats just add up over the whole run
+    Profiling::Stats total_stats;
+    simulation.reset_stats();
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    for (std::size_t i = 0; i < n_steps; i++) {
+        simulation.step(delta_time);
+
+        if (is_checkpoint(i)) {
+            Snapshot::Info info;
+            info.step = start_info.step + i + 1;
+            info.time = start_info.time + static_cast<double>(i + 1)*delta_time;
+            info.accelerations_are_current = simulation.has_evaluated_accelerations();
+            checkpointer->save(simulation.particles, info);
+            simulation.discard_tree();
+        }
+
+        if (trajectory && (start_info.step + i + 1) % trajectory_interval == 0) {
+            trajectory->write(simulation.particles, start_info.step + i + 1, start_info.time + static_cast<double>(i + 1)*delta_time);
+        }
+
+        if (stats_writer) {
+            const Profiling::Stats &step_stats = simulation.read_stats();
+            stats_writer->write(i, step_stats);
+            total_stats.add(step_stats);
+            simulation.reset_stats();
+        }
+    }
+
+    auto end_time = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(end_time - start_time).count();
+    if (!stats_writer) total_stats = simulation.read_stats();
+
+    std::printf("Ran %zu steps in %f seconds (%f steps/sec).\n", n_steps, elapsed, static_cast<double>(n_steps)/elapsed);
+
+    if (checkpointer) {
+        checkpointer->finish();
+        std::printf("Wrote %zu checkpoints to \"%s\".\n", checkpointer->written(), checkpoint_path);
+        if (checkpointer->failed() != 0) return EXIT_FAILURE;
+    }
+
+    if (trajectory) {
+        bool ok = trajectory->finish();
+        std::size_t n_frames = trajectory->frames_written();
+        double n_values = static_cast<double>(n_frames*simulation.particles.size());
+        std::printf("Wrote %zu trajectory frames to \"%s\", %.2f bytes per particle and frame, waited %.3f ms for the writer.\n", n_frames,
+                trajectory_path, n_frames == 0 ? 0.0 : static_cast<double>(trajectory->bytes_written())/n_values, trajectory->stalled_seconds()*1000.0);
+        if (!ok) return EXIT_FAILURE;
+    }
+
+    double ms_per_step = 1000.0/static_cast<double>(n_steps);
+    double phases_seconds = 0.0;
+    std::printf("Time per step:");
+    for (std::size_t i = 0; i < Profiling::phase_count; i++) {
+        std::printf(" %.3f ms %s,", total_stats.phase_seconds[i]*ms_per_step, Profiling::phase_name(static_cast<Profiling::Phase>(i)));
+        phases_seconds += total_stats.phase_seconds[i];
+    }
+    std::printf(" %.3f ms other.\n", (total_stats.step_seconds - phases_seconds)*ms_per_step);
+
+    double busy_seconds = 0.0;
+    for (double seconds : total_stats.thread_seconds) busy_seconds += seconds;
+    std::printf("Threads were busy for %.1f%% of the steps.\n",
+            100.0*busy_seconds/(total_stats.step_seconds*static_cast<double>(total_stats.thread_seconds.size())));
+    std::printf("Per step: %.0f nodes visited, %.0f interactions, %.0f collision tests.\n", static_cast<double>(total_stats.node_visits)/n_steps,
+            static_cast<double>(total_stats.interactions)/n_steps, static_cast<double>(total_stats.collision_tests)/n_steps);
+    std::printf("Gravity was computed %.1f times per particle.\n", static_cast<double>(simulation.gravity_evaluations)/simulation.particles.size());
+    std::printf("Tree rebuilt %zu times, refit %zu times, %.1f particles out of their leaf per refit.\n", simulation.tree_rebuilds,
+            simulation.tree_refits, simulation.tree_refits == 0 ? 0.0 : static_cast<double>(simulation.tree_out_of_leaf_total)/simulation.tree_refits);
+    std::printf("State hash: %016llx\n", static_cast<unsigned long long>(simulation.particles.hash()));
+
+    //The root box follows the particles, so the tree of the last step shows how far the system has spread out
+    simulation.build_tree();
+    const BarnesHut::Box &root_box = simulation.bh_tree.get_root_box();
+    std::printf("Final tree: %u levels deep, root box %f meters wide.\n", simulation.bh_tree.depth(), root_box.x_max - root_box.x_min);
+
+    if (n_verify_threads != 0) {
+        Simulation::Simulation verification(n_verify_threads);
+        Simulation::read_options(argc, argv, verification);
+        verification.particles = initial_particles;
+        verification.restore(start_info.accelerations_are_current);
+        for (std::size_t i = 0; i < n_steps; i++) {
+            verification.step(delta_time);
+            if (is_checkpoint(i)) verification.discard_tree();
+        }
+
+        std::uint64_t expected = simulation.particles.hash();
+        std::uint64_t hash = verification.particles.hash();
+        if (hash != expected) {
+            std::fprintf(stderr, "Error: State hash with %zu threads is %016llx, not %016llx!\n", verification.thread_count(),
+                    static_cast<unsigned long long>(hash), static_cast<unsigned long long>(expected));
+            return EXIT_FAILURE;
+        }
+        std::printf("Same state hash with %zu threads.\n", verification.thread_count());
+    }
+
+    return 0;
+
+}
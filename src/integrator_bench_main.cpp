@@ -0,0 +1,101 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "arguments.hpp"
+#include "diagnostics.hpp"
+#include "scenes.hpp"
+#include "simulation.hpp"
+
+namespace {
+
+    constexpr Simulation::Integrator integrators[] = {Simulation::Integrator::euler, Simulation::Integrator::leapfrog, Simulation::Integrator::yoshida4,
+        Simulation::Integrator::block};
+    constexpr float delta_times[] = {1.f, 1.f/2.f, 1.f/4.f, 1.f/8.f, 1.f/16.f, 1.f/32.f};
+    constexpr float default_theta = 0.2f;
+    constexpr float default_softening = 5.f; //Wide enough that the collapse of the spheres doesn't need much smaller steps
+
+}
+
+//Runs the default scene without collisions for the same simulated time with every integrator and a few delta times, and prints how far
+//the total energy and momentum drift from where they started, against how many gravity evaluations and how long it took
+//Usage: gravity_integrator_bench [n_particles] [end_time] [n_threads] [--softening=<length>] [--solver=barnes-hut|fmm] [--theta=<angle>]
+int main(int argc, char** argv) {
+
+    std::size_t n_particles = 2000;
+    float end_time = 8.f;
+    std::size_t n_threads = 0;
+
+    std::vector<const char*> args = Arguments::positional(argc, argv);
+
+    if (args.size() >= 1 && !Arguments::parse_count(args[0], "particles", n_particles)) return EXIT_FAILURE;
+    if (args.size() >= 2 && !Arguments::parse_positive_float(args[1], "End time", end_time)) return EXIT_FAILURE;
+    if (args.size() >= 3 && !Arguments::parse_count(args[2], "threads", n_threads)) return EXIT_FAILURE;
+    if (n_threads == 0) n_threads = Simulation::default_thread_count();
+
+    Simulation::Simulation simulation(n_threads);
+    simulation.collisions = false;
+    simulation.gravity.softening = default_softening;
+
+    const char *softening = Arguments::find_option(argc, argv, "softening");
+    if (softening && !Arguments::parse_positive_float(softening, "Softening", simulation.gravity.softening)) return EXIT_FAILURE;
+
+    //Errors in the forces drift the energy too, no matter how small the steps are, so the tree is opened much further than usual
+    simulation.bh_tree.theta = default_theta;
+    simulation.fmm.theta = default_theta;
+    const char *theta = Arguments::find_option(argc, argv, "theta");
+    if (theta && !Arguments::parse_positive_float(theta, "Theta", simulation.bh_tree.theta)) return EXIT_FAILURE;
+    simulation.fmm.theta = simulation.bh_tree.theta;
+
+    const char *solver = Arguments::find_option(argc, argv, "solver");
+    if (solver && !Simulation::find_solver(solver, simulation.solver)) {
+        std::fprintf(stderr, "Error: Unknown solver \"%s\" (barnes-hut, fmm or tree-pm)!\n", solver);
+        return EXIT_FAILURE;
+    }
+    if (!simulation.check_settings()) return EXIT_FAILURE;
+
+    Particle::Store scene = Scenes::two_spheres(n_particles);
+    simulation.particles = scene;
+    Diagnostics::Totals start = simulation.measure_totals();
+
+    std::printf("Simulation using %zu threads, %zu particles, %f seconds of simulated time, %s gravity.\n", simulation.thread_count(),
+            scene.size(), end_time, Simulation::solver_name(simulation.solver));
+    std::printf("Starting energy: %e\n", start.energy());
+    std::printf("%10s %10s %12s %10s %14s %14s\n", "integrator", "dt", "evaluations", "seconds", "energy drift", "momentum drift");
+
+    for (Simulation::Integrator integrator : integrators) {
+
+        //check_settings rejects block timesteps with the fmm solver, which only computes gravity for every particle at once
+        if (integrator == Simulation::Integrator::block && simulation.solver == Simulation::Solver::fmm) continue;
+
+        for (float delta_time : delta_times) {
+
+            simulation.particles = scene;
+            simulation.integrator = integrator;
+
+            std::size_t n_steps = static_cast<std::size_t>(std::lround(end_time/delta_time));
+
+            simulation.gravity_evaluations = 0;
+
+            auto start_time = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < n_steps; i++) simulation.step(delta_time);
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+            //Relative to the starting energy, and to the sum of every particle's momentum at the end, since the total starts out at 0
+            Diagnostics::Totals end = simulation.measure_totals();
+            double energy_drift = std::fabs((end.energy() - start.energy())/start.energy());
+            double dx = end.momentum_x - start.momentum_x, dy = end.momentum_y - start.momentum_y, dz = end.momentum_z - start.momentum_z;
+            double momentum_drift = std::sqrt(dx*dx + dy*dy + dz*dz)/end.momentum_scale;
+
+            std::printf("%10s %10.5f %12zu %10.3f %14.3e %14.3e\n", Simulation::integrator_name(integrator), delta_time,
+                    simulation.gravity_evaluations/scene.size(), elapsed, energy_drift, momentum_drift);
+
+        }
+
+    }
+
+    return 0;
+
+}
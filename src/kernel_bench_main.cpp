@@ -0,0 +1,79 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "arguments.hpp"
+#include "gravity_kernels.hpp"
+#include "particle.hpp"
+#include "vectors.hpp"
+
+//Times the gravity kernel against the scalar Particle::apply_gravity path, with every target particle pulled by every source
+//Usage: gravity_kernel_bench [n_sources] [n_targets] [--softening=<length>]
+int main(int argc, char** argv) {
+
+    std::size_t n_sources = 4096;
+    std::size_t n_targets = 2048;
+
+    std::vector<const char*> args = Arguments::positional(argc, argv);
+
+    if (args.size() >= 1 && !Arguments::parse_count(args[0], "sources", n_sources)) return EXIT_FAILURE;
+    if (args.size() >= 2 && !Arguments::parse_count(args[1], "targets", n_targets)) return EXIT_FAILURE;
+
+    Kernels::Parameters gravity;
+    const char *softening = Arguments::find_option(argc, argv, "softening");
+    if (softening && !Arguments::parse_positive_float(softening, "Softening", gravity.softening)) return EXIT_FAILURE;
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> coord(-100.f, 100.f);
+
+    std::vector<Particle::Particle> source_particles(n_sources);
+    Kernels::Sources sources;
+    for (std::size_t i = 0; i < n_sources; i++) {
+        source_particles[i].position = {coord(rng), coord(rng), coord(rng)};
+        source_particles[i].mass = 10.f;
+        sources.push_back(source_particles[i].position.x, source_particles[i].position.y, source_particles[i].position.z, source_particles[i].mass);
+    }
+
+    std::vector<Vectors::Vec3> targets(n_targets);
+    for (std::size_t i = 0; i < n_targets; i++) targets[i] = {coord(rng), coord(rng), coord(rng)};
+
+    std::vector<Vectors::Vec3> scalar_results(n_targets), kernel_results(n_targets);
+
+    auto start_time = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < n_targets; i++) {
+        Particle::Particle target;
+        target.position = targets[i];
+        target.acceleration = {0.f, 0.f, 0.f};
+        for (std::size_t j = 0; j < n_sources; j++) target.apply_gravity(source_particles[j], gravity.G, gravity.softening);
+        scalar_results[i] = target.acceleration;
+    }
+    double scalar_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    start_time = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < n_targets; i++) {
+        Vectors::Vec3 a = {0.f, 0.f, 0.f};
+        Kernels::accumulate_gravity(sources, targets[i].x, targets[i].y, targets[i].z, gravity, a.x, a.y, a.z);
+        kernel_results[i] = a;
+    }
+    double kernel_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    double max_error = 0.0;
+    for (std::size_t i = 0; i < n_targets; i++) {
+        double error = (kernel_results[i] - scalar_results[i]).length() / scalar_results[i].length();
+        if (error > max_error) max_error = error;
+    }
+
+    double n_interactions = static_cast<double>(n_sources)*static_cast<double>(n_targets);
+    std::printf("%zu sources, %zu targets, softening length %f.\n", n_sources, n_targets, gravity.softening);
+    std::printf("Scalar Vec3 path: %10.2f million interactions/sec\n", n_interactions/scalar_time*1e-6);
+    std::printf("%-16s %10.2f million interactions/sec (%.1fx)\n", (std::string(Kernels::instruction_set()) + " kernel:").c_str(),
+            n_interactions/kernel_time*1e-6, scalar_time/kernel_time);
+    std::printf("Largest relative difference: %g\n", max_error);
+
+    return 0;
+
+}
@@ -0,0 +1,78 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "arguments.hpp"
+#include "scenes.hpp"
+#include "simulation.hpp"
+
+namespace {
+
+    constexpr std::size_t leaf_sizes[] = {1, 2, 4, 8, 16, 32, 64};
+    constexpr float delta_time = 1.f/60.f;
+
+}
+
+//Steps the default scene with every leaf size of the tree, from the same starting particles every time, to find the one that makes
+//a whole step fastest
+//Usage: gravity_leaf_bench [n_particles] [n_steps] [n_threads] [--group-size=<n>] [--solver=barnes-hut|fmm]
+int main(int argc, char** argv) {
+
+    std::size_t n_particles = 20000;
+    std::size_t n_steps = 20;
+    std::size_t n_threads = 0;
+
+    std::vector<const char*> args = Arguments::positional(argc, argv);
+
+    if (args.size() >= 1 && !Arguments::parse_count(args[0], "particles", n_particles)) return EXIT_FAILURE;
+    if (args.size() >= 2 && !Arguments::parse_count(args[1], "steps", n_steps)) return EXIT_FAILURE;
+    if (args.size() >= 3 && !Arguments::parse_count(args[2], "threads", n_threads)) return EXIT_FAILURE;
+    if (n_threads == 0) n_threads = Simulation::default_thread_count();
+
+    Simulation::Simulation simulation(n_threads);
+
+    const char *group_size = Arguments::find_option(argc, argv, "group-size");
+    if (group_size && !Arguments::parse_count(group_size, "particles per group", simulation.group_size)) return EXIT_FAILURE;
+
+    const char *solver = Arguments::find_option(argc, argv, "solver");
+    if (solver && !Simulation::find_solver(solver, simulation.solver)) {
+        std::fprintf(stderr, "Error: Unknown solver \"%s\" (barnes-hut, fmm or tree-pm)!\n", solver);
+        return EXIT_FAILURE;
+    }
+    if (!simulation.check_settings()) return EXIT_FAILURE;
+
+    Particle::Store scene = Scenes::two_spheres(n_particles);
+
+    std::printf("Simulation using %zu threads, %zu particles, %zu steps.\n", simulation.thread_count(), scene.size(), n_steps);
+    std::printf("Gravity solver: %s, up to %zu particles per group.\n", Simulation::solver_name(simulation.solver), simulation.group_size);
+    std::printf("%10s %14s %8s\n", "leaf size", "ms per step", "nodes");
+
+    std::size_t best_leaf_size = 0;
+    double best_time = 0.0;
+
+    for (std::size_t leaf_size : leaf_sizes) {
+
+        simulation.particles = scene;
+        simulation.bh_tree.leaf_size = leaf_size;
+        simulation.build_tree(); //A refit would keep the leaves of the last leaf size
+
+        auto start_time = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < n_steps; i++) simulation.step(delta_time);
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+        double step_time = elapsed/static_cast<double>(n_steps);
+        std::printf("%10zu %14.3f %8zu\n", leaf_size, step_time*1000.0, simulation.bh_tree.get_nodes().size());
+
+        if (best_leaf_size == 0 || step_time < best_time) {
+            best_leaf_size = leaf_size;
+            best_time = step_time;
+        }
+
+    }
+
+    std::printf("Fastest leaf size: %zu (%.3f ms per step).\n", best_leaf_size, best_time*1000.0);
+
+    return 0;
+
+}
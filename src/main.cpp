@@ -1,62 +1,24 @@
-#include <array>
-#include <cerrno>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
-#include <cstring>
-#include <thread>
-#include <vector>
 #include <cmath>
+#include <memory>
+#include <vector>
 
 #include "raylib.h"
+#include "arguments.hpp"
 #include "vectors.hpp"
 #include "particle.hpp"
+#include "particle_store.hpp"
 #include "barnes_hut.hpp"
-
-constexpr float G = 1.f;
-
-void simulate_particles(std::vector<Particle::Particle> &particles, std::size_t lower_limit, std::size_t upper_limit, const BarnesHut::Tree &bh_tree) {
-
-    for (std::size_t i = lower_limit; i <= upper_limit; i++) {
-
-        bh_tree.apply_gravity(particles.data(), i, particles.size(), G);
-
-        /*
-        //Barnes Hut algorithm for collision. For some reason doesn't work, planets start moving in -x, +y, +z direction (right, top, front)
-
-        BarnesHut::Box range;
-
-        range.x_min = particles[i].position.x - particles[i].radius*2.f;
-        range.y_min = particles[i].position.y - particles[i].radius*2.f;
-        range.z_min = particles[i].position.z - particles[i].radius*2.f;
-        
-        range.x_max = particles[i].position.x + particles[i].radius*2.f;
-        range.y_max = particles[i].position.y + particles[i].radius*2.f;
-        range.z_max = particles[i].position.z + particles[i].radius*2.f;
-
-        std::vector<std::size_t> count(particles.size(), 0);
-
-        std::vector<Particle::Particle*> found = bh_tree.query(range);
-        for (auto particle_ptr : found) {
-            if (particles[i].id == particle_ptr->id) continue;            
-            if (particles[i].position.dist(particle_ptr->position) > particles[i].radius+particle_ptr->radius) continue;
-
-            ++count[particle_ptr->id];
-
-            if (count[particle_ptr->id] > 1) std::printf("aaaaaaaaaaa\n");
-
-            particles[i].collision(*particle_ptr);
-        }*/
-
-        //Regular collision algorithm. Way slower but atleast it works
-        for (std::size_t j = 0; j < particles.size(); j++) {
-            if (i == j || particles[i].position.dist(particles[j].position) > particles[i].radius+particles[j].radius) continue;
-            //if (std::find(std::begin(found), std::end(found), &particles[j]) != std::end(found)) std::printf("asdfsdfasdf\n");
-            particles[i].collision(particles[j]);
-        }
-
-    }
-
-}
+#include "parallel.hpp"
+#include "profiling.hpp"
+#include "render.hpp"
+#include "runner.hpp"
+#include "scenes.hpp"
+#include "simulation.hpp"
+#include "snapshot.hpp"
+#include "trajectory.hpp"
 
 int main(int argc, char** argv) {
 
@@ -74,85 +36,104 @@ int main(int argc, char** argv) {
     Camera camera = {{0.f, 0.f, -100.f}, {0.f, 0.f, 100.f}, {0.f, 1.f, 0.f}, 59.f, CAMERA_PERSPECTIVE};
     float camera_move_speed = 20.f;
 
-    std::vector<Particle::Particle> particles;
-    {
-        std::size_t n_particles = 3000;
-        if (argc >= 2) {
-            errno = 0;
-            char* end_ptr = NULL;
-
-            n_particles = std::strtoul(argv[1], &end_ptr, 10);
-
-            if (errno != 0 && n_particles == 0) {
-                std::fprintf(stderr, "Error: Couldn't get number of particles: %s\n", strerror(errno));
-                return EXIT_FAILURE;
-            }
-            else if (end_ptr == argv[1]) {
-                std::fprintf(stderr, "Error: Number of particles is invalid (No digits found)!\n");
-                return EXIT_FAILURE;
-            }
-            else if (n_particles == 0) {
-                std::fprintf(stderr, "Error: Cannot use 0 particles!\n");
-                return EXIT_FAILURE;
-            }
-        }
-
-        std::printf("Using %zu particles.\n", n_particles);
-        particles.reserve(n_particles);
-
-        std::array<float, 2> sphere_particles_fraction = {2.f/3.f, 1.f/3.f};
-        for (std::size_t n = 0; n < 2; n++) {
-
-            Vectors::Vec3 center;
-            if (n == 0) center = {0.f, 0.f, 0.f};
-            else center = {-100.f, 0.f, 0.f};
-
-            float theta = 0.f;  //Azimuthal angle
-            float phi = 0.f;  //Altitude angle
-            float dist = 5.f;
-            float dist_inc = 5.f;
-            for (std::size_t i = 0; static_cast<float>(i) < static_cast<float>(n_particles)*sphere_particles_fraction[n]; i++) {
-                Particle::Particle particle;
-                
-                particle.position = {std::sin(phi)*std::cos(theta)*dist, std::sin(phi)*std::sin(theta)*dist, std::cos(phi)*dist}; //Spherical to cartesian coordinates
-                particle.position = particle.position + center;
-                theta += 0.5f;
-                if (theta >= 2.f*PI) {
-                    phi += 0.5f;
-                    theta -= 2.f*PI;
-                }
-                if (phi >= 2.f*PI) {
-                    dist += dist_inc;
-                    phi -= 2.f*PI;
-                }
-
-                particle.velocity = {0.f, 0.f, 0.f};
-                particle.acceleration = {0.f, 0.f, 0.f};
-                particle.prev_acceleration = {0.f, 0.f, 0.f};
-                particle.mass = 10.f;
-                particle.radius = 1.f;
-                particle.id = particles.size();
-                
-                particles.push_back(particle);
-            }
-        }
+    std::vector<const char*> args = Arguments::positional(argc, argv);
+
+    std::size_t n_particles = 3000;
+    if (args.size() >= 1 && !Arguments::parse_count(args[0], "particles", n_particles)) return EXIT_FAILURE;
+
+    std::size_t n_threads = 0;
+    if (args.size() >= 2 && !Arguments::parse_count(args[1], "threads", n_threads)) return EXIT_FAILURE;
+    if (n_threads == 0) n_threads = Simulation::default_thread_count();
+
+    Simulation::Simulation simulation(n_threads);
+
+    if (!Simulation::read_options(argc, argv, simulation)) return EXIT_FAILURE;
+
+    //The simulation steps on a thread of its own, always with steps of this length, as many as keep up with the clock. What happens
+    //doesn't depend on the frame rate, and a slow frame doesn't hold up the steps, nor the other way around
+    float fixed_delta_time = 1.f/60.f;
+    const char *fixed_dt = Arguments::find_option(argc, argv, "fixed-dt");
+    if (fixed_dt && !Arguments::parse_positive_float(fixed_dt, "Fixed delta time", fixed_delta_time)) return EXIT_FAILURE;
+
+    //Snapshots are written every so many steps on a thread of their own, and once more when the window is closed
+    const char *checkpoint_path = Arguments::find_option(argc, argv, "checkpoint");
+    std::size_t checkpoint_interval = 1000;
+    const char *checkpoint_every = Arguments::find_option(argc, argv, "checkpoint-every");
+    if (checkpoint_every && !Arguments::parse_count(checkpoint_every, "steps between checkpoints", checkpoint_interval)) return EXIT_FAILURE;
+
+    //Frames are streamed every so many steps into a compressed trajectory, by a thread of its own
+    Trajectory::Settings trajectory_settings;
+    const char *trajectory_path = Arguments::find_option(argc, argv, "trajectory");
+    std::size_t trajectory_interval = 10;
+    const char *trajectory_every = Arguments::find_option(argc, argv, "trajectory-every");
+    if (trajectory_every && !Arguments::parse_count(trajectory_every, "steps between trajectory frames", trajectory_interval)) return EXIT_FAILURE;
+    if (trajectory_interval == 0) trajectory_interval = 1;
+    const char *trajectory_fields = Arguments::find_option(argc, argv, "trajectory-fields");
+    if (trajectory_fields && !Trajectory::parse_fields(trajectory_fields, trajectory_settings.fields)) return EXIT_FAILURE;
+
+    Particle::Store &particles = simulation.particles;
+    Snapshot::Info snapshot_info;   //Steps and time simulated so far
+
+    const char *restart_path = Arguments::find_option(argc, argv, "restart");
+    if (restart_path) {
+        if (!Snapshot::load(restart_path, particles, snapshot_info)) return EXIT_FAILURE;
+        simulation.restore(snapshot_info.accelerations_are_current);
+        std::printf("Restarting from \"%s\", %llu steps and %f seconds in.\n", restart_path,
+                static_cast<unsigned long long>(snapshot_info.step), snapshot_info.time);
     }
+    else if (simulation.bh_tree.boundary == BarnesHut::Boundary::periodic) {
+        particles = Scenes::uniform_box(n_particles, simulation.bh_tree.period);
+    }
+    else {
+        particles = Scenes::two_spheres(n_particles);
+    }
+    std::printf("Using %zu particles.\n", particles.size());
 
-    Mesh mesh = GenMeshSphere(1.f, 10, 10);
-
-    Material mat_default = LoadMaterialDefault();
+    std::unique_ptr<Snapshot::Checkpointer> checkpointer;
+    if (checkpoint_path) checkpointer.reset(new Snapshot::Checkpointer(checkpoint_path));
 
-    std::size_t n_simulation_threads = std::thread::hardware_concurrency() / 2;
-    if (n_simulation_threads == 0) {
-        std::fprintf(stderr, "WARNING: Unable to detect maximum number of concurrent threads supported! Using 1 thread.\n");
-        n_simulation_threads = 1;
+    std::unique_ptr<Trajectory::Writer> trajectory;
+    if (trajectory_path) {
+        trajectory.reset(new Trajectory::Writer(trajectory_path, trajectory_settings));
+        if (!trajectory->is_open()) return EXIT_FAILURE;
     }
-    
-    std::printf("Simulation using %zu threads.\n", n_simulation_threads);
+
+    auto checkpoint = [&]() {
+        snapshot_info.accelerations_are_current = simulation.has_evaluated_accelerations();
+        checkpointer->save(particles, snapshot_info);
+        simulation.discard_tree();
+    };
+
+    auto step = [&](float step_delta_time) {
+        simulation.step(step_delta_time);
+        snapshot_info.step++;
+        snapshot_info.time += step_delta_time;
+        if (checkpointer && snapshot_info.step % checkpoint_interval == 0) checkpoint();
+        if (trajectory && snapshot_info.step % trajectory_interval == 0) trajectory->write(particles, snapshot_info.step, snapshot_info.time);
+    };
+
+    //Only the simulation thread touches the simulation from here on, until it's stopped
+    Simulation::Runner runner(simulation, fixed_delta_time, step);
+
+    //The particles are drawn from buffers filled by a pool of their own, which leaves the simulation's pool to the simulation
+    Parallel::ThreadPool render_pool(n_threads);
+    Render::InstanceBuffers instance_buffers;
+    std::unique_ptr<Render::Renderer> renderer(new Render::Renderer());   //Released before the window, which its mesh and shader belong to
+    Render::View view;
+    view.color1 = {BLUE.r, BLUE.g, BLUE.b, BLUE.a};
+    view.color2 = {RED.r, RED.g, RED.b, RED.a};
+    constexpr float min_sphere_pixels = 2.f;   //Particles with a smaller radius on the screen are drawn as sprites
+
+    std::printf("Simulation using %zu threads.\n", simulation.thread_count());
+    float solver_theta = simulation.solver == Simulation::Solver::fmm ? simulation.fmm.theta : simulation.bh_tree.theta;
+    std::printf("Gravity solver: %s, theta %.2f.\n", Simulation::solver_name(simulation.solver), solver_theta);
+    std::printf("Integrator: %s, steps of %f seconds.\n", Simulation::integrator_name(simulation.integrator), fixed_delta_time);
 
     float simulation_speed = 1.f;
+    bool show_stats = false;
 
     DisableCursor();
+    runner.start();
 
     while (!WindowShouldClose()) {
 
@@ -198,43 +179,22 @@ int main(int argc, char** argv) {
             new_particle.prev_acceleration = {0.f, 0.f, 0.f};
             new_particle.radius = 1.f;
             new_particle.mass = 10.f;
-            new_particle.id = particles.size();
 
-            particles.push_back(new_particle);
+            runner.run([new_particle](Simulation::Simulation &stepped) mutable {
+                new_particle.id = stepped.particles.size();
+                stepped.particles.push_back(new_particle);
+            });
         }
 
         if (IsKeyPressed(KEY_X)) {
-            float theta = 0.f;  //Azimuthal angle
-            float phi = 0.f;  //Altitude angle
-            float dist = 5.f;
-            float dist_inc = 5.f;
-            for (std::size_t i = 0; i < 100; i++) {
-                Particle::Particle new_particle;
-
-                new_particle.position = {std::sin(phi)*std::cos(theta)*dist, std::sin(phi)*std::sin(theta)*dist, std::cos(phi)*dist}; //Spherical to cartesian coordinates
-                Vectors::Vec3 cam_pos = {camera.position.x, camera.position.y, camera.position.z};
-                new_particle.position = new_particle.position + cam_pos;
-                theta += 0.5f;
-                if (theta >= 2.f*PI) {
-                    phi += 0.5f;
-                    theta -= 2.f*PI;
-                }
-                if (phi >= 2.f*PI) {
-                    dist += dist_inc;
-                    phi -= 2.f*PI;
-                }
-
-                new_particle.velocity = {0.f, 0.f, 0.f};
-                new_particle.acceleration = {0.f, 0.f, 0.f};
-                new_particle.prev_acceleration = {0.f, 0.f, 0.f};
-                new_particle.radius = 1.f;
-                new_particle.mass = 10.f;
-                new_particle.id = particles.size();
-
-                particles.push_back(new_particle);
-            }
+            Vectors::Vec3 cam_pos = {camera.position.x, camera.position.y, camera.position.z};
+            runner.run([cam_pos](Simulation::Simulation &stepped) {
+                Scenes::add_sphere(stepped.particles, cam_pos, 100);
+            });
         }
 
+        if (IsKeyPressed(KEY_P)) show_stats = !show_stats;
+
         if (IsKeyPressed(KEY_F)) {
             if (simulation_speed == 1.f) {
                 simulation_speed = 2.f;
@@ -242,45 +202,47 @@ int main(int argc, char** argv) {
             else {
                 simulation_speed = 1.f;
             }
+            runner.set_speed(simulation_speed);
         }
 
+        runner.set_paused(IsKeyDown(KEY_C));
+        runner.set_publish_tree(IsKeyDown(KEY_SPACE));
+
+        //The particles as of the last steps the simulation thread published, which it leaves alone while they're drawn
+        runner.update();
+        const Simulation::Published &published = runner.latest();
+        const Render::Frame &frame = published.particles;
+
         BeginDrawing();
         ClearBackground(BLACK);
         BeginMode3D(camera);
 
-        BarnesHut::Tree bh_tree;
-
-        //Construct the bh tree
-        for (std::size_t i = 0; i < particles.size(); i++) {
-            bh_tree.insert_particle(particles[i]);
+        for (const Render::Cube &cube : published.tree) DrawCubeWires(cube.center, cube.width, cube.width, cube.width, WHITE);
+
+        //The camera's right and up, so the sprites face it
+        Vectors::Vec3 forward = Vectors::Vec3{camera.target.x - camera.position.x, camera.target.y - camera.position.y,
+                camera.target.z - camera.position.z}.normalized();
+        Vectors::Vec3 right = Vectors::Vec3{forward.y*camera.up.z - forward.z*camera.up.y, forward.z*camera.up.x - forward.x*camera.up.z,
+                forward.x*camera.up.y - forward.y*camera.up.x}.normalized();
+        view.position = {camera.position.x, camera.position.y, camera.position.z};
+        view.right = right;
+        view.up = {right.y*forward.z - right.z*forward.y, right.z*forward.x - right.x*forward.z, right.x*forward.y - right.y*forward.x};
+        view.min_sphere_size = min_sphere_pixels*std::tan(camera.fovy*DEG2RAD*0.5f)/(0.5f*static_cast<float>(GetScreenHeight()));
+
+        double fill_seconds = 0.0;
+        double draw_seconds = 0.0;
+        {
+            Profiling::ScopedTimer timer(fill_seconds);
+            Render::fill(frame, view, instance_buffers, render_pool);
         }
-
-        if (IsKeyDown(KEY_SPACE)) bh_tree.render();
-
-        if (!IsKeyDown(KEY_C)) {
-            std::size_t n_threads = n_simulation_threads;
-            std::vector<std::thread> threads;
-            threads.reserve(n_threads);
-
-            std::size_t limit_inc_amount = static_cast<std::size_t>(std::ceil(static_cast<float>(particles.size()) / static_cast<float>(n_threads)));
-            for (std::size_t i = 0; i < n_threads; i++) {
-                std::size_t lower_limit = limit_inc_amount * i;
-                std::size_t upper_limit = limit_inc_amount * (i+1) - 1;
-                upper_limit = std::fmin(upper_limit, particles.size()-1);
-                threads.emplace_back(simulate_particles, std::ref(particles), lower_limit, upper_limit, std::ref(bh_tree));
-            }
-
-            for (std::size_t i = 0; i < n_threads; i++) threads[i].join();
+        {
+            Profiling::ScopedTimer timer(draw_seconds);
+            renderer->draw(instance_buffers, view);
         }
 
         std::size_t n_particles_near_origin = 0;
-        for (std::size_t i = 0; i < particles.size(); i++) {
-
-            if (!IsKeyDown(KEY_C)) particles[i].update(delta_time*simulation_speed);
-
-            particles[i].draw(mesh, mat_default);
-
-            if (particles[i].position.dist({0.f, 0.f, 0.f}) < 500.f) ++n_particles_near_origin;
+        for (std::size_t i = 0; i < frame.size(); i++) {
+            if (Vectors::Vec3{frame.x[i], frame.y[i], frame.z[i]}.dist({0.f, 0.f, 0.f}) < 500.f) ++n_particles_near_origin;
         }
 
         if (IsKeyDown(KEY_Z)) DrawSphere({0.f, 0.f, 0.f}, 500.f, {GOLD.r, GOLD.g, GOLD.b, 127});
@@ -288,12 +250,61 @@ int main(int argc, char** argv) {
         EndMode3D();
 
         DrawFPS(10, 10);
-        DrawText(TextFormat("%zu/%zu Particles within 500 units of the origin.", n_particles_near_origin, particles.size()), 10, 50, 20, WHITE);
-        DrawText(TextFormat("Simulation running at %fx speed\n", simulation_speed), 10, 70, 20, WHITE);
+        DrawText(TextFormat("%zu/%zu Particles within 500 units of the origin.", n_particles_near_origin, frame.size()), 10, 50, 20, WHITE);
+        DrawText(TextFormat("Simulation running at %fx speed, %.1f steps/s\n", simulation_speed, published.steps_per_second), 10, 70, 20, WHITE);
+
+        if (show_stats) {
+            //Of the steps the simulation thread took before it last published, not of this frame
+            const Profiling::Stats &stats = published.stats;
+            int y = 100;
+
+            DrawText(TextFormat("Rendering: %d FPS, simulation: %.1f steps/s, %llu steps", GetFPS(), published.steps_per_second,
+                    static_cast<unsigned long long>(published.steps)), 10, y, 20, WHITE);
+            y += 20;
+            DrawText(TextFormat("Simulation: %.2f ms", stats.step_seconds*1000.0), 10, y, 20, WHITE);
+            for (std::size_t i = 0; i < Profiling::phase_count; i++) {
+                y += 20;
+                DrawText(TextFormat("  %s: %.2f ms", Profiling::phase_name(static_cast<Profiling::Phase>(i)), stats.phase_seconds[i]*1000.0), 10, y, 20, WHITE);
+            }
+            y += 20;
+            DrawText(TextFormat("Filling the instance buffers: %.2f ms", fill_seconds*1000.0), 10, y, 20, WHITE);
+            y += 20;
+            DrawText(TextFormat("Drawing %zu spheres and %zu sprites: %.2f ms", instance_buffers.sphere_count(), instance_buffers.sprite_count(),
+                    draw_seconds*1000.0), 10, y, 20, WHITE);
+
+            for (std::size_t i = 0; i < stats.thread_seconds.size(); i++) {
+                y += 20;
+                DrawText(TextFormat("Thread %zu busy: %.2f ms", i, stats.thread_seconds[i]*1000.0), 10, y, 20, WHITE);
+            }
+
+            y += 30;
+            DrawText(TextFormat("Nodes visited: %llu", static_cast<unsigned long long>(stats.node_visits)), 10, y, 20, WHITE);
+            y += 20;
+            DrawText(TextFormat("Interactions: %llu", static_cast<unsigned long long>(stats.interactions)), 10, y, 20, WHITE);
+            y += 20;
+            DrawText(TextFormat("Collision tests: %llu", static_cast<unsigned long long>(stats.collision_tests)), 10, y, 20, WHITE);
+            y += 20;
+            DrawText(TextFormat("Tree: %u levels, %zu nodes", stats.tree_depth, stats.tree_nodes), 10, y, 20, WHITE);
+        }
         EndDrawing();
 
     }
 
+    runner.stop();
+
+    if (checkpointer) {
+        checkpoint();
+        checkpointer->finish();
+        std::printf("Wrote %zu checkpoints to \"%s\".\n", checkpointer->written(), checkpoint_path);
+    }
+
+    if (trajectory) {
+        trajectory->finish();
+        std::printf("Wrote %zu trajectory frames to \"%s\".\n", trajectory->frames_written(), trajectory_path);
+    }
+
+    renderer.reset();
+
     EnableCursor();
 
     CloseWindow();
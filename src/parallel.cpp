@@ -0,0 +1,169 @@
+#include "parallel.hpp"
+
+namespace Parallel {
+
+    ThreadPool::ThreadPool(std::size_t n_threads) {
+
+        n_participants = n_threads == 0 ? 1 : n_threads;
+        queues.reset(new Queue[n_participants]);
+        busy_seconds.reset(new double[n_participants]);
+        reset_busy_time();
+
+        workers.reserve(n_participants-1);
+        for (std::size_t i = 1; i < n_participants; i++) {
+            workers.emplace_back(&ThreadPool::worker_loop, this, i);
+        }
+
+    }
+
+    ThreadPool::~ThreadPool() {
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        start_cv.notify_all();
+
+        for (std::size_t i = 0; i < workers.size(); i++) workers[i].join();
+
+    }
+
+    std::size_t ThreadPool::size() const {
+
+        return n_participants;
+
+    }
+
+    double ThreadPool::busy_time(std::size_t participant) const {
+
+        return busy_seconds[participant];
+
+    }
+
+    void ThreadPool::reset_busy_time() {
+
+        for (std::size_t i = 0; i < n_participants; i++) busy_seconds[i] = 0.0;
+
+    }
+
+    void ThreadPool::worker_loop(std::size_t participant) {
+
+        std::uint64_t seen_generation = 0;
+
+        while (true) {
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                start_cv.wait(lock, [&]() { return stopping || generation != seen_generation; });
+                if (stopping) return;
+                seen_generation = generation;
+            }
+
+            run_chunks(participant);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--n_busy_workers == 0) done_cv.notify_one();
+            }
+
+        }
+
+    }
+
+    void ThreadPool::run_chunks(std::size_t participant) {
+
+        auto start_time = std::chrono::steady_clock::now();
+
+        std::size_t chunk;
+        while (next_chunk(participant, chunk)) {
+            std::size_t lower_limit = chunk*job_grain_size;
+            std::size_t upper_limit = lower_limit + job_grain_size - 1;
+            if (upper_limit > job_size-1) upper_limit = job_size-1;
+            job_invoke(job, lower_limit, upper_limit);
+        }
+
+        busy_seconds[participant] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    }
+
+    bool ThreadPool::next_chunk(std::size_t participant, std::size_t &chunk) {
+
+        Queue &own = queues[participant];
+        {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (own.begin < own.end) {
+                chunk = own.begin++;
+                return true;
+            }
+        }
+
+        //Out of work, so steal half of what's left from the first thread that still has anything
+        for (std::size_t i = 1; i < n_participants; i++) {
+
+            Queue &victim = queues[(participant+i) % n_participants];
+            std::size_t stolen_begin, stolen_end;
+            {
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                std::size_t remaining = victim.end - victim.begin;
+                if (remaining == 0) continue;
+
+                stolen_end = victim.end;
+                stolen_begin = victim.end - (remaining+1)/2;
+                victim.end = stolen_begin;
+            }
+
+            chunk = stolen_begin;
+            if (stolen_end - stolen_begin > 1) {
+                std::lock_guard<std::mutex> lock(own.mutex);
+                own.begin = stolen_begin+1;
+                own.end = stolen_end;
+            }
+            return true;
+
+        }
+
+        return false;
+
+    }
+
+    void ThreadPool::run(std::size_t n, std::size_t grain_size, void (*invoke)(void*, std::size_t, std::size_t), void *f) {
+
+        if (n == 0) return;
+        if (grain_size == 0) grain_size = 1;
+
+        std::size_t n_chunks = (n + grain_size - 1) / grain_size;
+        if (n_participants == 1 || n_chunks == 1) {
+            auto start_time = std::chrono::steady_clock::now();
+            invoke(f, 0, n-1);
+            busy_seconds[0] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+            return;
+        }
+
+        job_invoke = invoke;
+        job = f;
+        job_size = n;
+        job_grain_size = grain_size;
+
+        //Deal the chunks out evenly. The workers are all waiting for the next job, so nobody else is looking at the queues
+        for (std::size_t i = 0; i < n_participants; i++) {
+            std::lock_guard<std::mutex> lock(queues[i].mutex);
+            queues[i].begin = n_chunks*i / n_participants;
+            queues[i].end = n_chunks*(i+1) / n_participants;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++generation;
+            n_busy_workers = workers.size();
+        }
+        start_cv.notify_all();
+
+        run_chunks(0);
+
+        //Every chunk has been taken, but the workers may still be running theirs
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [&]() { return n_busy_workers == 0; });
+
+    }
+
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Parallel {
+
+    //Persistent pool of worker threads. The thread calling into the pool works along with the workers, so a pool of size 1 has no workers
+    //and just runs everything on the calling thread.
+    //Work is split into chunks which are dealt out evenly up front. A thread that runs out of chunks steals half of the remaining chunks from
+    //another thread, so ranges where some items take much longer than others still keep every thread busy.
+    //Only one thread may call into the pool at a time, and the work given to the pool must not call into the pool itself
+    class ThreadPool {
+
+        //The chunks [begin, end) a thread still has to run. The owner takes chunks from the front, thieves take them from the back
+        struct Queue {
+            std::mutex mutex;
+            std::size_t begin = 0;
+            std::size_t end = 0;
+            char padding[64];   //Keeps the queues of different threads off of the same cache line
+        };
+
+        std::size_t n_participants;
+        std::vector<std::thread> workers;
+        std::unique_ptr<Queue[]> queues;
+        std::unique_ptr<double[]> busy_seconds;  //Only ever written by the thread it belongs to, and read between jobs
+
+        std::mutex mutex;
+        std::condition_variable start_cv;
+        std::condition_variable done_cv;
+        std::uint64_t generation = 0;   //Incremented for every job, which is what wakes the workers
+        std::size_t n_busy_workers = 0;
+        bool stopping = false;
+
+        //The current job. Type erased, so the pool itself doesn't have to be a template
+        void (*job_invoke)(void *job, std::size_t lower_limit, std::size_t upper_limit) = nullptr;
+        void *job = nullptr;
+        std::size_t job_size = 0;
+        std::size_t job_grain_size = 1;
+
+        void worker_loop(std::size_t participant);
+        void run_chunks(std::size_t participant);
+        bool next_chunk(std::size_t participant, std::size_t &chunk);
+        void run(std::size_t n, std::size_t grain_size, void (*invoke)(void*, std::size_t, std::size_t), void *f);
+
+    public:
+
+        explicit ThreadPool(std::size_t n_threads);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        //Number of threads working on every job, including the calling thread
+        std::size_t size() const;
+
+        //Seconds a thread spent running chunks since the last reset_busy_time. Thread 0 is the calling thread.
+        //Only to be called when the pool isn't running anything
+        double busy_time(std::size_t participant) const;
+        void reset_busy_time();
+
+        //Runs f(lower_limit, upper_limit) on every chunk of grain_size items in [0, n). upper_limit is inclusive. Returns once every chunk is done
+        template<typename F>
+        void for_each_range(std::size_t n, std::size_t grain_size, F f) {
+
+            run(n, grain_size, [](void *job, std::size_t lower_limit, std::size_t upper_limit) {
+                (*static_cast<F*>(job))(lower_limit, upper_limit);
+            }, &f);
+
+        }
+
+        //Splits [0, n) into n_chunks equally sized contiguous chunks, and runs f(chunk, lower_limit, upper_limit) on every chunk.
+        //For work that keeps something per chunk, like a histogram, and so needs the chunks to be the same every time
+        template<typename F>
+        void for_each_chunk(std::size_t n, std::size_t n_chunks, F f) {
+
+            if (n == 0) return;
+            if (n_chunks == 0) n_chunks = 1;
+
+            std::size_t chunk_size = (n + n_chunks - 1) / n_chunks;
+            for_each_range(n_chunks, 1, [&](std::size_t first_chunk, std::size_t last_chunk) {
+                for (std::size_t chunk = first_chunk; chunk <= last_chunk; chunk++) {
+                    std::size_t lower_limit = chunk_size * chunk;
+                    if (lower_limit >= n) continue;
+                    std::size_t upper_limit = chunk_size * (chunk+1) - 1;
+                    if (upper_limit > n-1) upper_limit = n-1;
+                    f(chunk, lower_limit, upper_limit);
+                }
+            });
+
+        }
+
+    };
+
+
+    //Hands values from one thread that writes them to one thread that reads them, without either ever waiting for the other.
+    //The writer fills write_buffer and publishes it, the reader picks up the latest published value with update and reads it from
+    //read_buffer, which stays as it is until the next update. Values published in between are skipped.
+    //The buffer a writer gets after publishing holds an older value, so it has to be filled all over again
+    template<typename T>
+    class TripleBuffer {
+
+        static constexpr std::uint32_t index_mask = 3;
+        static constexpr std::uint32_t fresh_bit = 4;   //Set while the middle buffer holds a value the reader hasn't picked up yet
+
+        T buffers[3];
+        std::atomic<std::uint32_t> middle{1};   //The buffer neither thread holds
+        std::uint32_t write_idx = 0;    //Only touched by the writer
+        std::uint32_t read_idx = 2;     //Only touched by the reader
+
+    public:
+
+        T &write_buffer() {
+
+            return buffers[write_idx];
+
+        }
+
+        void publish() {
+
+            write_idx = middle.exchange(write_idx | fresh_bit, std::memory_order_acq_rel) & index_mask;
+
+        }
+
+        //Whether the value published last is still waiting for the reader to pick it up. Until it is, a writer can skip filling another one,
+        //the reader then gets the waiting value instead of a newer one
+        bool is_waiting() const {
+
+            return (middle.load(std::memory_order_acquire) & fresh_bit) != 0;
+
+        }
+
+        //Returns false if nothing was published since the last update
+        bool update() {
+
+            if (!(middle.load(std::memory_order_acquire) & fresh_bit)) return false;
+            read_idx = middle.exchange(read_idx, std::memory_order_acq_rel) & index_mask;
+            return true;
+
+        }
+
+        const T &read_buffer() const {
+
+            return buffers[read_idx];
+
+        }
+
+    };
+
+}
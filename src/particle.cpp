@@ -1,21 +1,17 @@
 #include <cmath>
 #include <cstdio>
 
-#include "raylib.h"
-#include "raymath.h"
 #include "vectors.hpp"
 #include "particle.hpp"
 
 namespace Particle {
 
-    void Particle::apply_gravity(const Particle &other, float G) {
+    void Particle::apply_gravity(const Particle &other, float G, float softening) {
 
-        if (position.dist(other.position) == 0.f) return;
-
-        //a = MG/r²
-        float a = other.mass*G/std::pow(position.dist(other.position), 2.f);
-        Vectors::Vec3 dir = (other.position - position).normalized();
-        acceleration = acceleration + dir*a;
+        //a = MG*d/(r²+eps²)^(3/2). d/r is the direction and MG/r² the magnitude, so d never has to be normalized
+        Vectors::Vec3 d = other.position - position;
+        float inv_dist = 1.f / std::sqrt(d.dot(d) + softening*softening);
+        acceleration = acceleration + d*(other.mass*G*inv_dist*inv_dist*inv_dist);
 
     }
     
@@ -29,14 +25,14 @@ namespace Particle {
 
     }
 
-    void Particle::collision(Particle &other) {
+    void Particle::collision(const Particle &other, Vectors::Vec3 &received_velocity) {
 
         float dist = position.dist(other.position);
 
         //If the distance is greater than the combined radii, then there cannot physically be a collision
         if (dist >= radius+other.radius) return;
 
-        float move_back_amount = (radius+other.radius)-dist;  //Move just enough to get outside of the radius of the other particle
+        float move_back_amount = ((radius+other.radius)-dist)*0.5f;  //Together with other moving back, just enough to get outside of the radius of the other particle
         Vectors::Vec3 move_back_dir = (position-other.position);  //Move away from the other particle
         if (move_back_dir.length() == 0.f) return;  //For some reason, this vector is sometimes all zeroes
         move_back_dir = move_back_dir.normalized();
@@ -48,27 +44,13 @@ namespace Particle {
         float this_d = velocity.dot(n);
         if (this_d > 0.f) {
             velocity = velocity - n*this_d;
-
-            other.velocity = other.velocity + (n*this_d/1.1f)*mass/other.mass;
         }
 
-    }
-
-    void Particle::draw(Mesh mesh, Material material) {
-
-        //Lerp between color1 and color2 depending on acceleration
-        Vectors::Vec3 color_v_1 = {static_cast<float>(color1.r), static_cast<float>(color1.g), static_cast<float>(color1.b)};
-        Vectors::Vec3 color_v_2 = {static_cast<float>(color2.r), static_cast<float>(color2.g), static_cast<float>(color2.b)};
-        float t = prev_acceleration.length() / 100.f;
-        t = std::fmin(1.f, t); //Clamp it between 0 and 1
-        Vectors::Vec3 color_v = color_v_1.lerp(color_v_2, t);
-
-        Color color = {static_cast<unsigned char>(color_v.x), static_cast<unsigned char>(color_v.y), static_cast<unsigned char>(color_v.z), 255};
-        material.maps[MATERIAL_MAP_DIFFUSE].color = color;
-
-        //DrawSphere(position, radius, color);
-        //DrawCube(position, radius*2.f, radius*2.f, radius*2.f, color);
-        DrawMesh(mesh, material, MatrixTranslate(position.x, position.y, position.z));
+        //The part of other's velocity that went toward this particle gets passed on to this particle
+        float other_d = other.velocity.dot(move_back_dir);
+        if (other_d > 0.f) {
+            received_velocity = received_velocity + (move_back_dir*other_d/1.1f)*other.mass/mass;
+        }
 
     }
 
@@ -3,7 +3,6 @@
 #include <cstddef>
 
 #include "vectors.hpp"
-#include "raylib.h"
 
 namespace Particle {
 
@@ -19,15 +18,14 @@ namespace Particle {
         float radius;
         float mass;
 
-        Color color1 = BLUE;
-        Color color2 = RED;
-
         std::size_t counter = 0;
 
-        void apply_gravity(const Particle &other, float G);
+        void apply_gravity(const Particle &other, float G, float softening);
         void update(float delta_time);
-        void collision(Particle &other);
-        void draw(Mesh mesh, Material material);
+        //Pushes this particle halfway out of other (other gets pushed the other half when it resolves its own collisions), and removes the part of the
+        //velocity that goes toward other. The velocity other's impact would give this particle is added to received_velocity.
+        //Only this particle is modified, so every particle can resolve its collisions in parallel against a copy of itself
+        void collision(const Particle &other, Vectors::Vec3 &received_velocity);
 
         std::size_t id;
 
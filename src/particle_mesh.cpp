@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <cmath>
+
+#include "particle_mesh.hpp"
+
+namespace {
+
+    constexpr double pi = 3.14159265358979323846;
+
+    constexpr std::size_t min_auto_cells = 8;
+    constexpr std::size_t max_auto_cells = 128;
+
+    constexpr std::size_t line_grain_size = 16;     //Lines of the mesh per chunk handed to the pool
+    constexpr std::size_t plane_grain_size = 1;
+    constexpr std::size_t particle_grain_size = 4096;
+
+    //Where a coordinate falls on the mesh: the mesh point below it, and how far towards the next one it is
+    void locate(Vectors::Coordinate position, float half_period, float inv_spacing, std::size_t n, std::size_t &point, float &fraction) {
+
+        float u = static_cast<float>((position + half_period)*inv_spacing);
+        float below = std::floor(u);
+        fraction = u - below;
+        std::int64_t i = static_cast<std::int64_t>(below) % static_cast<std::int64_t>(n);
+        point = static_cast<std::size_t>(i < 0 ? i + static_cast<std::int64_t>(n) : i);
+
+    }
+
+    //sin(x)/x, the cloud in cell weights in k space along one axis squared
+    double sinc(double x) {
+
+        return x == 0.0 ? 1.0 : std::sin(x)/x;
+
+    }
+
+}
+
+namespace PM {
+
+    void Solver::resize(std::size_t new_cells, float period) {
+
+        short_range.set(split_cells*period/static_cast<float>(new_cells), cutoff_splits*split_cells*period/static_cast<float>(new_cells));
+
+        if (new_cells == n && period == mesh_period) return;
+        n = new_cells;
+        mesh_period = period;
+
+        std::size_t n_points = n*n*n;
+        density.resize(n_points);
+        work.resize(n_points);
+        acceleration_x.resize(n_points);
+        acceleration_y.resize(n_points);
+        acceleration_z.resize(n_points);
+
+        twiddles.resize(n/2);
+        for (std::size_t k = 0; k < n/2; k++) {
+            double angle = -2.0*pi*static_cast<double>(k)/static_cast<double>(n);
+            twiddles[k] = {static_cast<float>(std::cos(angle)), static_cast<float>(std::sin(angle))};
+        }
+
+    }
+
+    void Solver::deposit(const Particle::Store &particles, Parallel::ThreadPool &pool) {
+
+        float half_period = 0.5f*mesh_period;
+        float inv_spacing = static_cast<float>(n)/mesh_period;
+        float inv_cell_volume = inv_spacing*inv_spacing*inv_spacing;
+
+        //Counting sort by plane, which keeps the particles of every plane in the order they're in
+        plane_starts.assign(n+1, 0);
+        plane_particles.resize(particles.size());
+        for (std::size_t i = 0; i < particles.size(); i++) {
+            std::size_t k;
+            float fraction;
+            locate(particles.z[i], half_period, inv_spacing, n, k, fraction);
+            plane_starts[k+1]++;
+        }
+        for (std::size_t k = 0; k < n; k++) plane_starts[k+1] += plane_starts[k];
+        std::vector<std::uint32_t> next(plane_starts.begin(), plane_starts.end()-1);
+        for (std::size_t i = 0; i < particles.size(); i++) {
+            std::size_t k;
+            float fraction;
+            locate(particles.z[i], half_period, inv_spacing, n, k, fraction);
+            plane_particles[next[k]++] = static_cast<std::uint32_t>(i);
+        }
+
+        //Plane k gets the upper part of the particles of the plane below it and the lower part of its own, always in that order,
+        //and nothing else writes to it
+        pool.for_each_range(n, plane_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            for (std::size_t k = lower_limit; k <= upper_limit; k++) {
+                std::complex<float> *plane = &density[k*n*n];
+                std::fill(plane, plane + n*n, std::complex<float>(0.f, 0.f));
+
+                std::size_t planes[2] = {(k + n - 1) % n, k};
+                for (std::size_t side = 0; side < 2; side++) {
+                    for (std::uint32_t p = plane_starts[planes[side]]; p < plane_starts[planes[side]+1]; p++) {
+                        std::uint32_t i = plane_particles[p];
+                        std::size_t x0, y0, z0;
+                        float fx, fy, fz;
+                        locate(particles.x[i], half_period, inv_spacing, n, x0, fx);
+                        locate(particles.y[i], half_period, inv_spacing, n, y0, fy);
+                        locate(particles.z[i], half_period, inv_spacing, n, z0, fz);
+
+                        float wz = (side == 0 ? fz : 1.f - fz)*particles.mass[i]*inv_cell_volume;
+                        std::size_t x1 = (x0 + 1) % n, y1 = (y0 + 1) % n;
+                        plane[x0 + y0*n] += (1.f - fx)*(1.f - fy)*wz;
+                        plane[x1 + y0*n] += fx*(1.f - fy)*wz;
+                        plane[x0 + y1*n] += (1.f - fx)*fy*wz;
+                        plane[x1 + y1*n] += fx*fy*wz;
+                    }
+                }
+            }
+        });
+
+    }
+
+    void Solver::transform_line(std::complex<float> *line, bool inverse) const {
+
+        //Iterative radix 2, bit reversed order first
+        for (std::size_t i = 1, j = 0; i < n; i++) {
+            std::size_t bit = n >> 1;
+            for (; j & bit; bit >>= 1) j ^= bit;
+            j ^= bit;
+            if (i < j) std::swap(line[i], line[j]);
+        }
+
+        for (std::size_t length = 2; length <= n; length <<= 1) {
+            std::size_t half = length/2;
+            std::size_t step = n/length;
+            for (std::size_t start = 0; start < n; start += length) {
+                for (std::size_t k = 0; k < half; k++) {
+                    std::complex<float> w = twiddles[k*step];
+                    if (inverse) w = std::conj(w);
+                    std::complex<float> u = line[start + k];
+                    std::complex<float> v = line[start + k + half]*w;
+                    line[start + k] = u + v;
+                    line[start + k + half] = u - v;
+                }
+            }
+        }
+
+    }
+
+    void Solver::transform(std::vector<std::complex<float>> &grid, bool inverse, Parallel::ThreadPool &pool) {
+
+        //One axis after the other, every line of the mesh along it on its own. Lines along y and z are copied out and back in again
+        for (std::size_t axis = 0; axis < 3; axis++) {
+            std::size_t stride = axis == 0 ? 1 : axis == 1 ? n : n*n;
+            pool.for_each_range(n*n, line_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+                std::vector<std::complex<float>> line(n);
+                for (std::size_t l = lower_limit; l <= upper_limit; l++) {
+                    //The first point of line l, counting through the other two axes
+                    std::size_t a = l % n, b = l / n;
+                    std::size_t first = axis == 0 ? (a*n + b*n*n) : axis == 1 ? (a + b*n*n) : (a + b*n);
+
+                    for (std::size_t i = 0; i < n; i++) line[i] = grid[first + i*stride];
+                    transform_line(line.data(), inverse);
+                    for (std::size_t i = 0; i < n; i++) grid[first + i*stride] = line[i];
+                }
+            });
+        }
+
+    }
+
+    void Solver::compute_mesh(const Particle::Store &particles, float period, const Kernels::Parameters &gravity, Parallel::ThreadPool &pool) {
+
+        std::size_t new_cells = cells;
+        if (new_cells == 0) {
+            new_cells = min_auto_cells;
+            while (new_cells < max_auto_cells && new_cells*new_cells*new_cells < particles.size()) new_cells *= 2;
+        }
+        resize(new_cells, period);
+
+        deposit(particles, pool);
+        transform(density, false, pool);
+
+        //The potential in k space: -4*pi*G*rho/k², without the short range part, and with the cloud in cell weights of the deposit and of
+        //the interpolation back taken out again. The mean density is the background of the periodic box, and has no potential
+        double split = static_cast<double>(short_range.split());
+        double k_unit = 2.0*pi/static_cast<double>(period);
+        auto wave_number = [this](std::size_t i) -> double {
+            return i < n/2 ? static_cast<double>(i) : static_cast<double>(i) - static_cast<double>(n);
+        };
+
+        pool.for_each_range(n, plane_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            for (std::size_t k = lower_limit; k <= upper_limit; k++) {
+                for (std::size_t j = 0; j < n; j++) {
+                    for (std::size_t i = 0; i < n; i++) {
+                        std::size_t p = i + j*n + k*n*n;
+                        double wx = wave_number(i), wy = wave_number(j), wz = wave_number(k);
+                        double k_sq = (wx*wx + wy*wy + wz*wz)*k_unit*k_unit;
+                        if (k_sq == 0.0) {
+                            density[p] = 0.f;
+                            continue;
+                        }
+
+                        double window = sinc(pi*wx/n)*sinc(pi*wy/n)*sinc(pi*wz/n);
+                        double window_sq = window*window;
+                        double green = -4.0*pi*gravity.G*std::exp(-k_sq*split*split)/(k_sq*window_sq*window_sq);
+                        density[p] *= static_cast<float>(green);
+                    }
+                }
+            }
+        });
+
+        //a = -grad(potential), which is -i*k times the potential in k space. The Nyquist wave number has no sign, so it adds nothing
+        std::vector<float> *accelerations[3] = {&acceleration_x, &acceleration_y, &acceleration_z};
+        float normalization = 1.f/static_cast<float>(n*n*n);
+        for (std::size_t axis = 0; axis < 3; axis++) {
+
+            pool.for_each_range(n, plane_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+                for (std::size_t k = lower_limit; k <= upper_limit; k++) {
+                    for (std::size_t j = 0; j < n; j++) {
+                        for (std::size_t i = 0; i < n; i++) {
+                            std::size_t p = i + j*n + k*n*n;
+                            std::size_t index = axis == 0 ? i : axis == 1 ? j : k;
+                            float w = index == n/2 ? 0.f : static_cast<float>(wave_number(index)*k_unit);
+                            work[p] = std::complex<float>(0.f, -w)*density[p];
+                        }
+                    }
+                }
+            });
+
+            transform(work, true, pool);
+
+            std::vector<float> &acceleration = *accelerations[axis];
+            pool.for_each_range(n*n*n, particle_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+                for (std::size_t p = lower_limit; p <= upper_limit; p++) acceleration[p] = work[p].real()*normalization;
+            });
+
+        }
+
+    }
+
+    void Solver::add_long_range(Particle::Store &particles, std::size_t particle_idx) const {
+
+        float half_period = 0.5f*mesh_period;
+        float inv_spacing = static_cast<float>(n)/mesh_period;
+        std::size_t x0, y0, z0;
+        float fx, fy, fz;
+        locate(particles.x[particle_idx], half_period, inv_spacing, n, x0, fx);
+        locate(particles.y[particle_idx], half_period, inv_spacing, n, y0, fy);
+        locate(particles.z[particle_idx], half_period, inv_spacing, n, z0, fz);
+        std::size_t x1 = (x0 + 1) % n, y1 = (y0 + 1) % n, z1 = (z0 + 1) % n;
+
+        const std::size_t points[8] = {x0 + y0*n + z0*n*n, x1 + y0*n + z0*n*n, x0 + y1*n + z0*n*n, x1 + y1*n + z0*n*n,
+            x0 + y0*n + z1*n*n, x1 + y0*n + z1*n*n, x0 + y1*n + z1*n*n, x1 + y1*n + z1*n*n};
+        const float weights[8] = {(1.f - fx)*(1.f - fy)*(1.f - fz), fx*(1.f - fy)*(1.f - fz), (1.f - fx)*fy*(1.f - fz), fx*fy*(1.f - fz),
+            (1.f - fx)*(1.f - fy)*fz, fx*(1.f - fy)*fz, (1.f - fx)*fy*fz, fx*fy*fz};
+
+        float ax = 0.f, ay = 0.f, az = 0.f;
+        for (std::size_t c = 0; c < 8; c++) {
+            ax += weights[c]*acceleration_x[points[c]];
+            ay += weights[c]*acceleration_y[points[c]];
+            az += weights[c]*acceleration_z[points[c]];
+        }
+
+        particles.ax[particle_idx] += ax;
+        particles.ay[particle_idx] += ay;
+        particles.az[particle_idx] += az;
+
+    }
+
+    const Kernels::ShortRange &Solver::get_short_range() const {
+
+        return short_range;
+
+    }
+
+    std::size_t Solver::mesh_cells() const {
+
+        return n;
+
+    }
+
+}
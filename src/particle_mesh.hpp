@@ -0,0 +1,60 @@
+#pragma once
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "gravity_kernels.hpp"
+#include "parallel.hpp"
+#include "particle_store.hpp"
+
+namespace PM {
+
+    //The long range part of gravity in a periodic box, on a mesh, for TreePM. The mass of every particle is spread over the 8 mesh points
+    //around it (cloud in cell), Poisson's equation is solved with FFTs, with the short range part filtered out of it by exp(-k²s²) for
+    //the split length s, and the acceleration is read back from the mesh with the same weights. The tree adds the short range part, which
+    //is Newton's law times Kernels::ShortRange for the same split, and nothing beyond its cutoff.
+    //Every step is split over the planes or lines of the mesh, and gives the same mesh for any number of threads
+    class Solver {
+
+        std::size_t n = 0;          //Cells along every axis of the current mesh
+        float mesh_period = 0.f;
+        std::vector<std::complex<float>> density;   //Mass per volume, then the potential in k space
+        std::vector<std::complex<float>> work;      //One component of the acceleration, in k space and then on the mesh
+        std::vector<float> acceleration_x, acceleration_y, acceleration_z;
+        std::vector<std::complex<float>> twiddles;  //exp(-2*pi*i*k/n) for k up to n/2
+
+        //Particles sorted by the plane of the mesh below them, so every plane can be deposited onto by one thread
+        std::vector<std::uint32_t> plane_starts;
+        std::vector<std::uint32_t> plane_particles;
+
+        Kernels::ShortRange short_range;
+
+        void resize(std::size_t cells, float period);
+        void deposit(const Particle::Store &particles, Parallel::ThreadPool &pool);
+        void transform(std::vector<std::complex<float>> &grid, bool inverse, Parallel::ThreadPool &pool);
+        void transform_line(std::complex<float> *line, bool inverse) const;
+
+    public:
+
+        //Cells of the mesh along every axis, a power of two. 0 picks the smallest with at least one cell per particle, up to 128
+        std::size_t cells = 0;
+        //The split length in cells of the mesh, and where the tree stops, in split lengths (Springel 2005)
+        float split_cells = 1.25f;
+        float cutoff_splits = 4.5f;
+
+        //Computes the long range acceleration on every point of the mesh from where the particles are now. Every particle has to be inside of
+        //the periodic box of width period around the origin
+        void compute_mesh(const Particle::Store &particles, float period, const Kernels::Parameters &gravity, Parallel::ThreadPool &pool);
+
+        //Adds the long range acceleration at the particle to its acceleration, from the last compute_mesh
+        void add_long_range(Particle::Store &particles, std::size_t particle_idx) const;
+
+        //What the tree has to add to the last compute_mesh
+        const Kernels::ShortRange &get_short_range() const;
+        std::size_t mesh_cells() const;
+
+    };
+
+}
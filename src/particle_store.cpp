@@ -0,0 +1,131 @@
+#include "particle_store.hpp"
+
+namespace Particle {
+
+    std::size_t Store::size() const {
+
+        return x.size();
+
+    }
+
+    bool Store::empty() const {
+
+        return x.empty();
+
+    }
+
+    void Store::clear() {
+
+        resize(0);
+
+    }
+
+    void Store::reserve(std::size_t n) {
+
+        x.reserve(n); y.reserve(n); z.reserve(n);
+        vx.reserve(n); vy.reserve(n); vz.reserve(n);
+        ax.reserve(n); ay.reserve(n); az.reserve(n);
+        mass.reserve(n);
+        radius.reserve(n);
+        prev_ax.reserve(n); prev_ay.reserve(n); prev_az.reserve(n);
+        id.reserve(n);
+
+    }
+
+    void Store::resize(std::size_t n) {
+
+        x.resize(n); y.resize(n); z.resize(n);
+        vx.resize(n); vy.resize(n); vz.resize(n);
+        ax.resize(n); ay.resize(n); az.resize(n);
+        mass.resize(n);
+        radius.resize(n);
+        prev_ax.resize(n); prev_ay.resize(n); prev_az.resize(n);
+        id.resize(n);
+
+    }
+
+    void Store::push_back(const Particle &particle) {
+
+        resize(size()+1);
+        set(size()-1, particle);
+
+    }
+
+    Particle Store::get(std::size_t i) const {
+
+        Particle particle;
+        particle.position = position(i).rounded();
+        particle.velocity = {vx[i], vy[i], vz[i]};
+        particle.acceleration = {ax[i], ay[i], az[i]};
+        particle.prev_acceleration = {prev_ax[i], prev_ay[i], prev_az[i]};
+        particle.mass = mass[i];
+        particle.radius = radius[i];
+        particle.id = id[i];
+
+        return particle;
+
+    }
+
+    void Store::set(std::size_t i, const Particle &particle) {
+
+        x[i] = particle.position.x; y[i] = particle.position.y; z[i] = particle.position.z;
+        vx[i] = particle.velocity.x; vy[i] = particle.velocity.y; vz[i] = particle.velocity.z;
+        ax[i] = particle.acceleration.x; ay[i] = particle.acceleration.y; az[i] = particle.acceleration.z;
+        prev_ax[i] = particle.prev_acceleration.x; prev_ay[i] = particle.prev_acceleration.y; prev_az[i] = particle.prev_acceleration.z;
+        mass[i] = particle.mass;
+        radius[i] = particle.radius;
+        id[i] = particle.id;
+
+    }
+
+    Vectors::Point Store::position(std::size_t i) const {
+
+        return {x[i], y[i], z[i]};
+
+    }
+
+    Vectors::Vec3 Store::velocity(std::size_t i) const {
+
+        return {vx[i], vy[i], vz[i]};
+
+    }
+
+    void Store::swap(Store &other) {
+
+        x.swap(other.x); y.swap(other.y); z.swap(other.z);
+        vx.swap(other.vx); vy.swap(other.vy); vz.swap(other.vz);
+        ax.swap(other.ax); ay.swap(other.ay); az.swap(other.az);
+        mass.swap(other.mass);
+        radius.swap(other.radius);
+        prev_ax.swap(other.prev_ax); prev_ay.swap(other.prev_ay); prev_az.swap(other.prev_az);
+        id.swap(other.id);
+
+    }
+
+    std::uint64_t Store::hash() const {
+
+        constexpr std::uint64_t fnv_offset_basis = 0xcbf29ce484222325ull;
+        constexpr std::uint64_t fnv_prime = 0x100000001b3ull;
+
+        std::uint64_t h = fnv_offset_basis;
+        auto add_bytes = [&h](const void *data, std::size_t n_bytes) {
+            const unsigned char *bytes = static_cast<const unsigned char*>(data);
+            for (std::size_t i = 0; i < n_bytes; i++) {
+                h ^= bytes[i];
+                h *= fnv_prime;
+            }
+        };
+
+        for (const std::vector<Vectors::Coordinate> *column : {&x, &y, &z}) {
+            add_bytes(column->data(), column->size()*sizeof(Vectors::Coordinate));
+        }
+        for (const std::vector<float> *column : {&vx, &vy, &vz, &ax, &ay, &az, &mass, &radius, &prev_ax, &prev_ay, &prev_az}) {
+            add_bytes(column->data(), column->size()*sizeof(float));
+        }
+        add_bytes(id.data(), id.size()*sizeof(std::size_t));
+
+        return h;
+
+    }
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "particle.hpp"
+#include "vectors.hpp"
+
+namespace Particle {
+
+    //Every particle of the simulation, stored as one array per component (structure of arrays). The hot loops only touch the arrays
+    //they need, and the kernels can load 8 or 16 particles at a time. Particle is still used to add and read single particles
+    class Store {
+
+    public:
+        //Hot, touched every step. Positions are Vectors::Coordinate, everything else float
+        std::vector<Vectors::Coordinate> x, y, z;
+        std::vector<float> vx, vy, vz;
+        std::vector<float> ax, ay, az;
+        std::vector<float> mass;
+        std::vector<float> radius;
+
+        //Cold, only used for coloring and bookkeeping
+        std::vector<float> prev_ax, prev_ay, prev_az;
+        std::vector<std::size_t> id;
+
+        std::size_t size() const;
+        bool empty() const;
+
+        void clear();
+        void reserve(std::size_t n);
+        void resize(std::size_t n);
+        void push_back(const Particle &particle);
+
+        //Particle has float positions, so get rounds them if positions are double
+        Particle get(std::size_t i) const;
+        void set(std::size_t i, const Particle &particle);
+
+        Vectors::Point position(std::size_t i) const;
+        Vectors::Vec3 velocity(std::size_t i) const;
+
+        void swap(Store &other);
+
+        //FNV-1a over the bits of every particle's state, so two stores hash the same only if they're bit for bit identical (barring collisions)
+        std::uint64_t hash() const;
+
+    };
+
+}
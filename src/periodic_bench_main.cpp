@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "arguments.hpp"
+#include "ewald.hpp"
+#include "profiling.hpp"
+#include "scenes.hpp"
+#include "simulation.hpp"
+
+namespace {
+
+    constexpr std::size_t n_reference_particles = 100;
+    constexpr std::size_t n_table_samples = 20000;
+    constexpr std::size_t n_repeats = 3;
+    constexpr std::size_t default_max_particles = 131072;
+
+    //The net pull in a uniform box is a small leftover of the pulls from every side, so it needs a smaller theta than the open default
+    constexpr float default_theta = 0.5f;
+
+    //Largest mean relative error of the periodic tree and of TreePM against the direct periodic sum that still passes
+    constexpr double max_mean_error = 0.01;
+
+    class Errors {
+
+    public:
+        double mean = 0.0;
+        double max = 0.0;
+
+    };
+
+    //The acceleration on particle i from every particle and every image of it, summed directly in doubles: every pair through the closest
+    //image with the same softening as the kernels, plus the exact Ewald correction
+    void periodic_reference(const Particle::Store &particles, std::size_t i, const Kernels::Parameters &gravity, float period,
+            double &ax, double &ay, double &az) {
+
+        ax = ay = az = 0.0;
+        double softening_sq = static_cast<double>(gravity.softening)*gravity.softening;
+
+        for (std::size_t j = 0; j < particles.size(); j++) {
+            if (j == i) continue;
+
+            double dx = BarnesHut::wrap(particles.x[j] - particles.x[i], period);
+            double dy = BarnesHut::wrap(particles.y[j] - particles.y[i], period);
+            double dz = BarnesHut::wrap(particles.z[j] - particles.z[i], period);
+            double r_sq = dx*dx + dy*dy + dz*dz + softening_sq;
+            double s = particles.mass[j]/(r_sq*std::sqrt(r_sq));
+
+            double cx, cy, cz;
+            Ewald::exact_correction(dx, dy, dz, period, cx, cy, cz);
+
+            ax += gravity.G*(dx*s + particles.mass[j]*cx);
+            ay += gravity.G*(dy*s + particles.mass[j]*cy);
+            az += gravity.G*(dz*s + particles.mass[j]*cz);
+        }
+
+    }
+
+    //Errors of the accelerations of every stride'th particle against the reference, relative to the mean size of the reference accelerations.
+    //Relative to every particle's own acceleration would blow up for the particles that happen to be pulled about equally from every side
+    Errors measure_errors(const Particle::Store &particles, const std::vector<double> &reference, std::size_t stride) {
+
+        double total_error = 0.0, max_error = 0.0, total_size = 0.0;
+        std::size_t n_checked = 0;
+
+        for (std::size_t i = 0, k = 0; i < particles.size(); i += stride, k += 3) {
+            double dx = particles.ax[i] - reference[k], dy = particles.ay[i] - reference[k+1], dz = particles.az[i] - reference[k+2];
+            double error = std::sqrt(dx*dx + dy*dy + dz*dz);
+            total_error += error;
+            max_error = std::max(max_error, error);
+            total_size += std::sqrt(reference[k]*reference[k] + reference[k+1]*reference[k+1] + reference[k+2]*reference[k+2]);
+            n_checked++;
+        }
+
+        double mean_size = total_size/static_cast<double>(n_checked);
+        return {total_error/static_cast<double>(n_checked)/mean_size, max_error/mean_size};
+
+    }
+
+    //Moves every particle into the box around the origin
+    void wrap_into_box(Particle::Store &particles, float period) {
+
+        for (std::size_t i = 0; i < particles.size(); i++) {
+            particles.x[i] = BarnesHut::wrap(particles.x[i], period);
+            particles.y[i] = BarnesHut::wrap(particles.y[i], period);
+            particles.z[i] = BarnesHut::wrap(particles.z[i], period);
+        }
+
+    }
+
+    //Fastest of a few runs of building the tree and computing gravity
+    double time_gravity(Simulation::Simulation &simulation) {
+
+        double best_time = 0.0;
+
+        for (std::size_t repeat = 0; repeat < n_repeats; repeat++) {
+            Particle::Store &particles = simulation.particles;
+            std::fill(particles.ax.begin(), particles.ax.end(), 0.f);
+            std::fill(particles.ay.begin(), particles.ay.end(), 0.f);
+            std::fill(particles.az.begin(), particles.az.end(), 0.f);
+
+            double elapsed = 0.0;
+            {
+                Profiling::ScopedTimer timer(elapsed);
+                simulation.build_tree();
+                simulation.compute_accelerations();
+            }
+
+            if (repeat == 0 || elapsed < best_time) best_time = elapsed;
+        }
+
+        return best_time;
+
+    }
+
+}
+
+//Checks periodic boundaries against a direct periodic sum. First the interpolated Ewald correction against the exact one, then the
+//accelerations the periodic tree and TreePM give a uniform and a clustered scene against every particle and every image of it summed
+//directly, for every so many particles. The same accelerations with the open tree show how much the images matter. Fails if the periodic
+//tree or TreePM is off by more than 1% on average.
+//Then times the periodic tree against TreePM for a uniform box of twice as many particles every time, from n_particles up to max_particles
+//Usage: gravity_periodic_bench [n_particles] [n_threads] [max_particles] [--theta=<angle>], theta 0.5 by default
+int main(int argc, char** argv) {
+
+    std::size_t n_particles = 4000;
+    std::size_t n_threads = 0;
+    std::size_t max_particles = default_max_particles;
+
+    std::vector<const char*> args = Arguments::positional(argc, argv);
+
+    if (args.size() >= 1 && !Arguments::parse_count(args[0], "particles", n_particles)) return EXIT_FAILURE;
+    if (args.size() >= 2 && !Arguments::parse_count(args[1], "threads", n_threads)) return EXIT_FAILURE;
+    if (args.size() >= 3 && !Arguments::parse_count(args[2], "particles", max_particles)) return EXIT_FAILURE;
+    if (n_threads == 0) n_threads = Simulation::default_thread_count();
+
+    Simulation::Simulation simulation(n_threads);
+    simulation.bh_tree.period = Scenes::uniform_cube_width(n_particles);
+    simulation.bh_tree.theta = default_theta;
+
+    const char *theta = Arguments::find_option(argc, argv, "theta");
+    if (theta && !Arguments::parse_positive_float(theta, "Theta", simulation.bh_tree.theta)) return EXIT_FAILURE;
+
+    float period = simulation.bh_tree.period;
+    std::printf("%zu particles in a periodic box %.1f meters wide, theta %.2f, %zu threads.\n", n_particles, period, simulation.bh_tree.theta,
+            simulation.thread_count());
+
+    Parallel::ThreadPool pool(simulation.thread_count());
+    Ewald::Table table;
+    double build_seconds = 0.0;
+    {
+        Profiling::ScopedTimer timer(build_seconds);
+        table.build(period, pool);
+    }
+
+    std::mt19937 rng(4);
+    std::uniform_real_distribution<float> offset(-0.5f*period, 0.5f*period);
+    double worst_table_error = 0.0, largest_correction = 0.0;
+    for (std::size_t i = 0; i < n_table_samples; i++) {
+        float dx = offset(rng), dy = offset(rng), dz = offset(rng);
+        float cx, cy, cz;
+        double exact_x, exact_y, exact_z;
+        table.correction(dx, dy, dz, cx, cy, cz);
+        Ewald::exact_correction(dx, dy, dz, period, exact_x, exact_y, exact_z);
+        double error_x = cx - exact_x, error_y = cy - exact_y, error_z = cz - exact_z;
+        worst_table_error = std::max(worst_table_error, std::sqrt(error_x*error_x + error_y*error_y + error_z*error_z));
+        largest_correction = std::max(largest_correction, std::sqrt(exact_x*exact_x + exact_y*exact_y + exact_z*exact_z));
+    }
+    std::printf("Ewald table built in %.3f s, worst error %.2e of the largest correction over %zu offsets.\n", build_seconds,
+            worst_table_error/largest_correction, n_table_samples);
+
+    Particle::Store scenes[] = {Scenes::uniform_cube(n_particles), Scenes::plummer(n_particles, simulation.gravity.G)};
+    const char *scene_names[] = {"uniform", "plummer"};
+
+    std::printf("%10s %12s %12s %12s %12s %12s %12s %10s %10s %10s\n", "scene", "tree mean", "tree max", "tree-pm mean", "tree-pm max",
+            "open mean", "open max", "tree s", "tree-pm s", "open s");
+
+    bool failed = false;
+    for (std::size_t s = 0; s < 2; s++) {
+
+        //The open tree sees the same particles, already in the box
+        simulation.particles = scenes[s];
+        wrap_into_box(simulation.particles, period);
+
+        std::size_t stride = std::max<std::size_t>(1, simulation.particles.size()/n_reference_particles);
+        std::vector<double> reference;
+        for (std::size_t i = 0; i < simulation.particles.size(); i += stride) {
+            double ax, ay, az;
+            periodic_reference(simulation.particles, i, simulation.gravity, period, ax, ay, az);
+            reference.insert(reference.end(), {ax, ay, az});
+        }
+
+        simulation.bh_tree.boundary = BarnesHut::Boundary::periodic;
+        simulation.solver = Simulation::Solver::barnes_hut;
+        double tree_seconds = time_gravity(simulation);
+        Errors tree_errors = measure_errors(simulation.particles, reference, stride);
+
+        simulation.solver = Simulation::Solver::tree_pm;
+        double tree_pm_seconds = time_gravity(simulation);
+        Errors tree_pm_errors = measure_errors(simulation.particles, reference, stride);
+
+        simulation.bh_tree.boundary = BarnesHut::Boundary::open;
+        simulation.solver = Simulation::Solver::barnes_hut;
+        double open_seconds = time_gravity(simulation);
+        Errors open_errors = measure_errors(simulation.particles, reference, stride);
+
+        std::printf("%10s %12.5f %12.5f %12.5f %12.5f %12.5f %12.5f %10.5f %10.5f %10.5f\n", scene_names[s], tree_errors.mean, tree_errors.max,
+                tree_pm_errors.mean, tree_pm_errors.max, open_errors.mean, open_errors.max, tree_seconds, tree_pm_seconds, open_seconds);
+
+        if (tree_errors.mean > max_mean_error) {
+            std::fprintf(stderr, "Error: The periodic tree is off by %.2f%% on average for the %s scene!\n", tree_errors.mean*100.0, scene_names[s]);
+            failed = true;
+        }
+        if (tree_pm_errors.mean > max_mean_error) {
+            std::fprintf(stderr, "Error: TreePM is off by %.2f%% on average for the %s scene!\n", tree_pm_errors.mean*100.0, scene_names[s]);
+            failed = true;
+        }
+
+    }
+
+    //The tree walks grow with the number of particles times their log, while the mesh of TreePM grows with its cells, which are kept at about one
+    //per particle, times their log, and the short range walks stay about as long with the density the same
+    std::printf("\n%10s %8s %10s %10s %10s %10s %8s\n", "particles", "mesh", "tree s", "tree-pm s", "mesh s", "walks s", "speedup");
+    simulation.bh_tree.boundary = BarnesHut::Boundary::periodic;
+    for (std::size_t n = n_particles; n <= max_particles; n *= 2) {
+
+        float box_width = Scenes::uniform_cube_width(n);
+        simulation.bh_tree.period = box_width;
+        simulation.particles = Scenes::uniform_cube(n);
+        wrap_into_box(simulation.particles, box_width);
+
+        simulation.solver = Simulation::Solver::barnes_hut;
+        double tree_seconds = time_gravity(simulation);
+
+        simulation.solver = Simulation::Solver::tree_pm;
+        double tree_pm_seconds = time_gravity(simulation);
+
+        double mesh_seconds = 0.0;
+        {
+            Profiling::ScopedTimer timer(mesh_seconds);
+            simulation.pm.compute_mesh(simulation.particles, box_width, simulation.gravity, pool);
+        }
+
+        std::printf("%10zu %7zu³ %10.4f %10.4f %10.4f %10.4f %7.2fx\n", n, simulation.pm.mesh_cells(), tree_seconds, tree_pm_seconds, mesh_seconds,
+                tree_pm_seconds - mesh_seconds, tree_seconds/tree_pm_seconds);
+
+    }
+
+    return failed ? EXIT_FAILURE : 0;
+
+}
@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "arguments.hpp"
+#include "scenes.hpp"
+#include "simulation.hpp"
+
+namespace {
+
+    constexpr double offsets[] = {0.0, 1e3, 1e4, 1e5, 1e6};
+
+    //Largest mean relative error against the scene at the origin that still passes, with double positions
+    constexpr double max_mean_error = 1e-3;
+
+    class Setup {
+
+    public:
+        const char *name;
+        Simulation::Solver solver;
+        std::size_t group_size;
+
+    };
+
+    //The accelerations the simulation computes for the particles, as they are
+    std::vector<float> accelerations(Simulation::Simulation &simulation) {
+
+        Particle::Store &particles = simulation.particles;
+        std::fill(particles.ax.begin(), particles.ax.end(), 0.f);
+        std::fill(particles.ay.begin(), particles.ay.end(), 0.f);
+        std::fill(particles.az.begin(), particles.az.end(), 0.f);
+
+        simulation.build_tree();
+        simulation.compute_accelerations();
+
+        std::vector<float> a;
+        for (std::size_t i = 0; i < particles.size(); i++) a.insert(a.end(), {particles.ax[i], particles.ay[i], particles.az[i]});
+        return a;
+
+    }
+
+    //Mean error of every particle's acceleration against the reference, relative to the mean size of the reference accelerations
+    double mean_error(const std::vector<float> &a, const std::vector<float> &reference) {
+
+        double total_error = 0.0, total_size = 0.0;
+        for (std::size_t k = 0; k < a.size(); k += 3) {
+            double dx = a[k] - reference[k], dy = a[k+1] - reference[k+1], dz = a[k+2] - reference[k+2];
+            total_error += std::sqrt(dx*dx + dy*dy + dz*dz);
+            total_size += std::sqrt(static_cast<double>(reference[k])*reference[k] + static_cast<double>(reference[k+1])*reference[k+1] +
+                    static_cast<double>(reference[k+2])*reference[k+2]);
+        }
+        return total_size > 0.0 ? total_error/total_size : 0.0;
+
+    }
+
+}
+
+//Moves the same clustered scene further and further away from the origin, and compares the accelerations every solver gives it against
+//the ones it gives the scene at the origin. With float positions the particles snap to coarser and coarser steps far out, and the
+//accelerations drift away. With double positions (GRAVITY_SIM_DOUBLE_POSITIONS) they should stay the same, since every walk works
+//with offsets from its own center. Fails if positions are double and any solver is off by more than 0.1% on average
+//Usage: gravity_precision_bench [n_particles] [n_threads]
+int main(int argc, char** argv) {
+
+    std::size_t n_particles = 20000;
+    std::size_t n_threads = 0;
+
+    std::vector<const char*> args = Arguments::positional(argc, argv);
+
+    if (args.size() >= 1 && !Arguments::parse_count(args[0], "particles", n_particles)) return EXIT_FAILURE;
+    if (args.size() >= 2 && !Arguments::parse_count(args[1], "threads", n_threads)) return EXIT_FAILURE;
+    if (n_threads == 0) n_threads = Simulation::default_thread_count();
+
+    bool has_double_positions = sizeof(Vectors::Coordinate) == sizeof(double);
+    Simulation::Simulation simulation(n_threads);
+    Particle::Store scene = Scenes::plummer(n_particles, simulation.gravity.G);
+
+    std::printf("%zu particles, positions stored as %s, %zu threads.\n", scene.size(), has_double_positions ? "doubles" : "floats",
+            simulation.thread_count());
+
+    const Setup setups[] = {
+        {"barnes-hut", Simulation::Solver::barnes_hut, 1},
+        {"groups", Simulation::Solver::barnes_hut, simulation.group_size},
+        {"fmm", Simulation::Solver::fmm, simulation.group_size}
+    };
+
+    std::printf("%10s", "offset");
+    for (const Setup &setup : setups) std::printf(" %12s", setup.name);
+    std::printf("\n");
+
+    std::vector<std::vector<float>> references;
+    bool failed = false;
+    for (double offset : offsets) {
+
+        simulation.particles = scene;
+        for (std::size_t i = 0; i < scene.size(); i++) {
+            simulation.particles.x[i] = static_cast<Vectors::Coordinate>(scene.x[i] + offset);
+            simulation.particles.y[i] = static_cast<Vectors::Coordinate>(scene.y[i] + offset);
+            simulation.particles.z[i] = static_cast<Vectors::Coordinate>(scene.z[i] + offset);
+        }
+
+        std::printf("%10.0e", offset);
+        for (std::size_t s = 0; s < sizeof(setups)/sizeof(setups[0]); s++) {
+            simulation.solver = setups[s].solver;
+            simulation.group_size = setups[s].group_size;
+            std::vector<float> a = accelerations(simulation);
+
+            if (offset == 0.0) {
+                references.push_back(a);
+                std::printf(" %12s", "-");
+                continue;
+            }
+
+            double error = mean_error(a, references[s]);
+            std::printf(" %12.2e", error);
+            if (has_double_positions && error > max_mean_error) failed = true;
+        }
+        std::printf("\n");
+
+    }
+
+    if (failed) {
+        std::fprintf(stderr, "Error: Moving the scene away from the origin changed its accelerations by more than %.1f%%!\n", max_mean_error*100.0);
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+
+}
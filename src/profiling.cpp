@@ -0,0 +1,126 @@
+#include <cstring>
+
+#include "profiling.hpp"
+
+namespace Profiling {
+
+    const char *phase_name(Phase phase) {
+
+        switch (phase) {
+            case Phase::tree: return "tree";
+            case Phase::gravity: return "gravity";
+            case Phase::collisions: return "collisions";
+            case Phase::integration: return "integration";
+            case Phase::count: break;
+        }
+        return "unknown";
+
+    }
+
+    double &Stats::seconds(Phase phase) {
+
+        return phase_seconds[static_cast<std::size_t>(phase)];
+
+    }
+
+    double Stats::seconds(Phase phase) const {
+
+        return phase_seconds[static_cast<std::size_t>(phase)];
+
+    }
+
+    void Stats::add(const Stats &other) {
+
+        for (std::size_t i = 0; i < phase_count; i++) phase_seconds[i] += other.phase_seconds[i];
+        step_seconds += other.step_seconds;
+
+        if (thread_seconds.size() < other.thread_seconds.size()) thread_seconds.resize(other.thread_seconds.size(), 0.0);
+        for (std::size_t i = 0; i < other.thread_seconds.size(); i++) thread_seconds[i] += other.thread_seconds[i];
+
+        node_visits += other.node_visits;
+        interactions += other.interactions;
+        collision_tests += other.collision_tests;
+
+        tree_depth = other.tree_depth;
+        tree_nodes = other.tree_nodes;
+
+    }
+
+    ScopedTimer::ScopedTimer(double &seconds) : seconds(seconds), start_time(std::chrono::steady_clock::now()) {}
+
+    ScopedTimer::~ScopedTimer() {
+
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    }
+
+    Writer::Writer(const char *path) {
+
+        file = std::fopen(path, "w");
+        if (!file) {
+            std::fprintf(stderr, "Error: Couldn't open \"%s\" to write the stats to!\n", path);
+            return;
+        }
+
+        std::size_t length = std::strlen(path);
+        is_json = length >= 5 && std::strcmp(path + length - 5, ".json") == 0;
+
+    }
+
+    Writer::~Writer() {
+
+        if (!file) return;
+
+        if (is_json) std::fputs(n_rows == 0 ? "[]\n" : "\n]\n", file);
+        std::fclose(file);
+
+    }
+
+    bool Writer::is_open() const {
+
+        return file != NULL;
+
+    }
+
+    void Writer::write(std::size_t step, const Stats &stats) {
+
+        if (!file) return;
+
+        //Times are written in milliseconds, which is what a step takes
+        if (n_rows == 0) {
+            n_threads = stats.thread_seconds.size();
+
+            if (!is_json) {
+                std::fprintf(file, "step,step_ms");
+                for (std::size_t i = 0; i < phase_count; i++) std::fprintf(file, ",%s_ms", phase_name(static_cast<Phase>(i)));
+                for (std::size_t i = 0; i < n_threads; i++) std::fprintf(file, ",thread%zu_ms", i);
+                std::fprintf(file, ",node_visits,interactions,collision_tests,tree_depth,tree_nodes\n");
+            }
+        }
+
+        if (is_json) {
+            std::fprintf(file, "%s{\"step\": %zu, \"step_ms\": %.6f", n_rows == 0 ? "[\n" : ",\n", step, stats.step_seconds*1000.0);
+            for (std::size_t i = 0; i < phase_count; i++) {
+                std::fprintf(file, ", \"%s_ms\": %.6f", phase_name(static_cast<Phase>(i)), stats.phase_seconds[i]*1000.0);
+            }
+            std::fprintf(file, ", \"thread_ms\": [");
+            for (std::size_t i = 0; i < stats.thread_seconds.size(); i++) std::fprintf(file, "%s%.6f", i == 0 ? "" : ", ", stats.thread_seconds[i]*1000.0);
+            std::fprintf(file, "], \"node_visits\": %llu, \"interactions\": %llu, \"collision_tests\": %llu, \"tree_depth\": %u, \"tree_nodes\": %zu}",
+                    static_cast<unsigned long long>(stats.node_visits), static_cast<unsigned long long>(stats.interactions),
+                    static_cast<unsigned long long>(stats.collision_tests), stats.tree_depth, stats.tree_nodes);
+        }
+        else {
+            std::fprintf(file, "%zu,%.6f", step, stats.step_seconds*1000.0);
+            for (std::size_t i = 0; i < phase_count; i++) std::fprintf(file, ",%.6f", stats.phase_seconds[i]*1000.0);
+            //Every row has the columns of the first one
+            for (std::size_t i = 0; i < n_threads; i++) std::fprintf(file, ",%.6f", i < stats.thread_seconds.size() ? stats.thread_seconds[i]*1000.0 : 0.0);
+            std::fprintf(file, ",%llu,%llu,%llu,%u,%zu\n", static_cast<unsigned long long>(stats.node_visits),
+                    static_cast<unsigned long long>(stats.interactions), static_cast<unsigned long long>(stats.collision_tests),
+                    stats.tree_depth, stats.tree_nodes);
+        }
+
+        n_rows++;
+
+    }
+
+}
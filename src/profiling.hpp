@@ -0,0 +1,86 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace Profiling {
+
+    //The parts of a step that are timed separately
+    enum class Phase {
+        tree,           //Building or refitting the tree
+        gravity,
+        collisions,
+        integration,    //Moving the particles and changing their velocities
+        count
+    };
+
+    constexpr std::size_t phase_count = static_cast<std::size_t>(Phase::count);
+
+    const char *phase_name(Phase phase);
+
+    //Where the time of one or more steps went, and how much work the tree walks and collisions did in it
+    class Stats {
+
+    public:
+        double phase_seconds[phase_count] = {};
+        double step_seconds = 0.0;          //All of step, including everything between the phases
+        std::vector<double> thread_seconds; //Time every thread of the pool spent working, the thread calling step first
+
+        std::uint64_t node_visits = 0;      //Nodes looked at by the Barnes-Hut walks. The FMM's walks aren't counted
+        std::uint64_t interactions = 0;     //Particles and nodes that pulled on a particle, over every particle that got Barnes-Hut gravity
+        std::uint64_t collision_tests = 0;  //Pairs of particles checked for a collision
+
+        //The tree as it was at the end of the step
+        std::uint32_t tree_depth = 0;
+        std::size_t tree_nodes = 0;
+
+        double &seconds(Phase phase);
+        double seconds(Phase phase) const;
+
+        //Adds the times and counters of another step, and takes the tree from it
+        void add(const Stats &other);
+
+    };
+
+    //Adds the time from its construction to its destruction to seconds
+    class ScopedTimer {
+
+        double &seconds;
+        std::chrono::steady_clock::time_point start_time;
+
+    public:
+
+        explicit ScopedTimer(double &seconds);
+        ~ScopedTimer();
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    };
+
+    //Writes the stats of every step to a file, one row per step. As CSV, or as a JSON array of objects if the file name ends in .json
+    class Writer {
+
+        std::FILE *file = NULL;
+        bool is_json = false;
+        std::size_t n_rows = 0;
+        std::size_t n_threads = 0;  //Of the first row, which sets the columns
+
+    public:
+
+        //Prints an error if the file can't be opened, is_open tells if it was
+        explicit Writer(const char *path);
+        ~Writer();
+
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+
+        bool is_open() const;
+        void write(std::size_t step, const Stats &stats);
+
+    };
+
+}
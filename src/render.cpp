@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#ifndef GRAVITY_SIM_HEADLESS
+#include "raylib.h"
+#include "rlgl.h"
+#endif
+#include "render.hpp"
+
+namespace {
+
+    //Enough chunks to keep every thread busy, always as many, so the chunks and the buffers are the same for any number of threads
+    constexpr std::size_t n_chunks = 256;
+
+    constexpr std::size_t capture_grain_size = 16384;   //Particles per chunk of capture, which only copies them
+
+    Render::Rgba lerp(const Render::Rgba &color1, const Render::Rgba &color2, float t) {
+
+        auto channel = [t](std::uint8_t c1, std::uint8_t c2) {
+            return static_cast<std::uint8_t>(static_cast<float>(c1) + (static_cast<float>(c2) - static_cast<float>(c1))*t);
+        };
+        return {channel(color1.r, color2.r), channel(color1.g, color2.g), channel(color1.b, color2.b), 255};
+
+    }
+
+#ifndef GRAVITY_SIM_HEADLESS
+    //Every instance gets its matrix and its color from an attribute of its own, so the shader doesn't depend on how raylib lays out the matrix
+    const char *instancing_vertex_shader = R"(
+#version 330
+in vec3 vertexPosition;
+in mat4 instanceTransform;
+in float instanceColor;
+
+uniform mat4 mvp;
+uniform vec4 colDiffuse;
+uniform vec4 color2;
+
+out vec4 fragColor;
+
+void main() {
+    fragColor = mix(colDiffuse, color2, instanceColor);
+    gl_Position = mvp*instanceTransform*vec4(vertexPosition, 1.0);
+}
+)";
+
+    const char *instancing_fragment_shader = R"(
+#version 330
+in vec4 fragColor;
+out vec4 finalColor;
+
+void main() {
+    finalColor = fragColor;
+}
+)";
+
+    //Sprites are handed to rlgl this many at a time, few enough to always fit into its batch
+    constexpr std::size_t sprites_per_batch = 1024;
+#endif
+
+}
+
+namespace Render {
+
+    std::size_t InstanceBuffers::sphere_count() const {
+
+        return transforms.size();
+
+    }
+
+    std::size_t InstanceBuffers::sprite_count() const {
+
+        return sprite_colors.size();
+
+    }
+
+    std::size_t Frame::size() const {
+
+        return x.size();
+
+    }
+
+    float color_fraction(const Particle::Store &particles, std::size_t i) {
+
+        float ax = particles.prev_ax[i], ay = particles.prev_ay[i], az = particles.prev_az[i];
+        return std::fmin(1.f, std::sqrt(ax*ax + ay*ay + az*az) / 100.f);
+
+    }
+
+    void capture(const Particle::Store &particles, Frame &frame, Parallel::ThreadPool &pool) {
+
+        std::size_t n = particles.size();
+        frame.x.resize(n);
+        frame.y.resize(n);
+        frame.z.resize(n);
+        frame.radius.resize(n);
+        frame.color.resize(n);
+
+        pool.for_each_range(n, capture_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+                frame.x[i] = static_cast<float>(particles.x[i]);
+                frame.y[i] = static_cast<float>(particles.y[i]);
+                frame.z[i] = static_cast<float>(particles.z[i]);
+                frame.radius[i] = particles.radius[i];
+                frame.color[i] = color_fraction(particles, i);
+            }
+        });
+
+    }
+
+    void fill(const Frame &frame, const View &view, InstanceBuffers &buffers, Parallel::ThreadPool &pool) {
+
+        std::size_t n = frame.size();
+        float min_size_sq = view.min_sphere_size*view.min_sphere_size;
+
+        //First every chunk counts its spheres, then the counts tell every chunk where to write its spheres and sprites
+        buffers.is_sphere.resize(n);
+        buffers.chunk_spheres.assign(n_chunks+1, 0);
+        pool.for_each_chunk(n, n_chunks, [&](std::size_t chunk, std::size_t lower_limit, std::size_t upper_limit) {
+            std::size_t n_spheres = 0;
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+                float dx = frame.x[i] - view.position.x;
+                float dy = frame.y[i] - view.position.y;
+                float dz = frame.z[i] - view.position.z;
+                float radius = frame.radius[i];
+                bool is_sphere = radius*radius >= min_size_sq*(dx*dx + dy*dy + dz*dz);
+                buffers.is_sphere[i] = is_sphere;
+                n_spheres += is_sphere;
+            }
+            buffers.chunk_spheres[chunk+1] = n_spheres;
+        });
+
+        for (std::size_t i = 0; i < n_chunks; i++) buffers.chunk_spheres[i+1] += buffers.chunk_spheres[i];
+
+        std::size_t n_spheres = buffers.chunk_spheres[n_chunks];
+        buffers.transforms.resize(n_spheres);
+        buffers.sphere_colors.resize(n_spheres);
+        buffers.sprite_vertices.resize(12*(n - n_spheres));
+        buffers.sprite_colors.resize(n - n_spheres);
+
+        pool.for_each_chunk(n, n_chunks, [&](std::size_t chunk, std::size_t lower_limit, std::size_t upper_limit) {
+            std::size_t sphere_idx = buffers.chunk_spheres[chunk];
+            std::size_t sprite_idx = lower_limit - sphere_idx;
+
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+                float x = frame.x[i], y = frame.y[i], z = frame.z[i];
+                float radius = frame.radius[i];
+                float t = frame.color[i];
+
+                if (buffers.is_sphere[i]) {
+                    float *m = buffers.transforms[sphere_idx].m;
+                    m[0] = radius;  m[1] = 0.f;     m[2] = 0.f;      m[3] = x;
+                    m[4] = 0.f;     m[5] = radius;  m[6] = 0.f;      m[7] = y;
+                    m[8] = 0.f;     m[9] = 0.f;     m[10] = radius;  m[11] = z;
+                    m[12] = 0.f;    m[13] = 0.f;    m[14] = 0.f;     m[15] = 1.f;
+                    buffers.sphere_colors[sphere_idx++] = t;
+                    continue;
+                }
+
+                //Top left, bottom left, bottom right, top right, counter clockwise as seen from the camera
+                float rx = view.right.x*radius, ry = view.right.y*radius, rz = view.right.z*radius;
+                float ux = view.up.x*radius, uy = view.up.y*radius, uz = view.up.z*radius;
+                const float corner_signs[4][2] = {{-1.f, 1.f}, {-1.f, -1.f}, {1.f, -1.f}, {1.f, 1.f}};
+
+                float *vertices = &buffers.sprite_vertices[12*sprite_idx];
+                for (std::size_t k = 0; k < 4; k++) {
+                    float sr = corner_signs[k][0], su = corner_signs[k][1];
+                    vertices[3*k] = x + sr*rx + su*ux;
+                    vertices[3*k+1] = y + sr*ry + su*uy;
+                    vertices[3*k+2] = z + sr*rz + su*uz;
+                }
+                buffers.sprite_colors[sprite_idx++] = lerp(view.color1, view.color2, t);
+            }
+        });
+
+    }
+
+#ifndef GRAVITY_SIM_HEADLESS
+    static_assert(sizeof(Transform) == sizeof(Matrix), "Render::Transform must have the layout of raylib's Matrix");
+
+    Renderer::Renderer() {
+
+        mesh = GenMeshSphere(1.f, 10, 10);
+        material = LoadMaterialDefault();
+
+        shader = LoadShaderFromMemory(instancing_vertex_shader, instancing_fragment_shader);
+        is_instanced = shader.id != rlGetShaderIdDefault();
+        if (is_instanced) {
+            shader.locs[SHADER_LOC_MATRIX_MODEL] = GetShaderLocationAttrib(shader, "instanceTransform");
+            color_location = GetShaderLocationAttrib(shader, "instanceColor");
+            color2_location = GetShaderLocation(shader, "color2");
+            material.shader = shader;
+        }
+        else {
+            std::fprintf(stderr, "Error: Couldn't compile the instancing shader, drawing every particle on its own!\n");
+        }
+
+    }
+
+    Renderer::~Renderer() {
+
+        if (color_buffer != 0) rlUnloadVertexBuffer(color_buffer);
+        //The material unloads the shader it holds, unless it's the default one
+        UnloadMaterial(material);
+        UnloadMesh(mesh);
+
+    }
+
+    void Renderer::draw(const InstanceBuffers &buffers, const View &view) {
+
+        material.maps[MATERIAL_MAP_DIFFUSE].color = {view.color1.r, view.color1.g, view.color1.b, view.color1.a};
+
+        if (is_instanced && buffers.sphere_count() > 0) {
+            const float color2[4] = {view.color2.r/255.f, view.color2.g/255.f, view.color2.b/255.f, view.color2.a/255.f};
+            SetShaderValue(shader, color2_location, color2, SHADER_UNIFORM_VEC4);
+
+            //The buffer only grows, so that it isn't reallocated every frame. The attribute stays part of the mesh's vertex array,
+            //which DrawMeshInstanced binds before adding the transforms to it
+            int colors_size = static_cast<int>(buffers.sphere_count()*sizeof(float));
+            rlEnableVertexArray(mesh.vaoId);
+            if (buffers.sphere_count() > color_buffer_size) {
+                if (color_buffer != 0) rlUnloadVertexBuffer(color_buffer);
+                color_buffer_size = buffers.sphere_count() + buffers.sphere_count()/2;
+                color_buffer = rlLoadVertexBuffer(NULL, static_cast<int>(color_buffer_size*sizeof(float)), true);
+            }
+            rlEnableVertexBuffer(color_buffer);
+            rlUpdateVertexBuffer(color_buffer, buffers.sphere_colors.data(), colors_size, 0);
+            rlSetVertexAttribute(static_cast<unsigned int>(color_location), 1, RL_FLOAT, false, 0, 0);
+            rlEnableVertexAttribute(static_cast<unsigned int>(color_location));
+            rlSetVertexAttributeDivisor(static_cast<unsigned int>(color_location), 1);
+            rlDisableVertexBuffer();
+            rlDisableVertexArray();
+
+            DrawMeshInstanced(mesh, material, reinterpret_cast<const Matrix*>(buffers.transforms.data()), static_cast<int>(buffers.sphere_count()));
+        }
+        else if (!is_instanced) {
+            for (std::size_t i = 0; i < buffers.sphere_count(); i++) {
+                Rgba color = lerp(view.color1, view.color2, buffers.sphere_colors[i]);
+                material.maps[MATERIAL_MAP_DIFFUSE].color = {color.r, color.g, color.b, color.a};
+                DrawMesh(mesh, material, *reinterpret_cast<const Matrix*>(&buffers.transforms[i]));
+            }
+        }
+
+        rlSetTexture(rlGetTextureIdDefault());
+        for (std::size_t first = 0; first < buffers.sprite_count(); first += sprites_per_batch) {
+            std::size_t last = std::min(first + sprites_per_batch, buffers.sprite_count());
+            rlCheckRenderBatchLimit(static_cast<int>(4*(last - first)));
+
+            rlBegin(RL_QUADS);
+            for (std::size_t i = first; i < last; i++) {
+                const Rgba &color = buffers.sprite_colors[i];
+                const float *vertices = &buffers.sprite_vertices[12*i];
+                rlColor4ub(color.r, color.g, color.b, color.a);
+                for (std::size_t k = 0; k < 4; k++) rlVertex3f(vertices[3*k], vertices[3*k+1], vertices[3*k+2]);
+            }
+            rlEnd();
+        }
+        rlSetTexture(0);
+
+    }
+#endif
+
+}
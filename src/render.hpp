@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "parallel.hpp"
+#include "particle_store.hpp"
+#include "vectors.hpp"
+#ifndef GRAVITY_SIM_HEADLESS
+#include "raylib.h"
+#endif
+
+namespace Render {
+
+    class Rgba {
+
+    public:
+        std::uint8_t r, g, b, a;
+
+    };
+
+    //The same 16 floats in the same order as raylib's Matrix (m0, m4, m8, m12, m1, ...), so an array of them can be handed to
+    //DrawMeshInstanced as it is. Holds a translation and a uniform scale, and nothing else
+    class Transform {
+
+    public:
+        float m[16];
+
+    };
+
+    //What is drawn of the particles, copied out of the particle arrays so the simulation can go on stepping while it's drawn
+    class Frame {
+
+    public:
+        std::vector<float> x, y, z;     //Rounded to float if positions are double, which is plenty to draw them
+        std::vector<float> radius;
+        std::vector<float> color;   //How far the color of every particle is from color1 towards color2, 0 to 1
+
+        std::size_t size() const;
+
+    };
+
+    //A node of the tree, drawn as a wireframe cube
+    class Cube {
+
+    public:
+        Vectors::Vec3 center;
+        float width;
+
+    };
+
+    //Where the particles are seen from
+    class View {
+
+    public:
+        Vectors::Vec3 position = {0.f, 0.f, 0.f};
+        Vectors::Vec3 right = {1.f, 0.f, 0.f};  //Of the camera, unit length. Sprites are drawn facing the camera
+        Vectors::Vec3 up = {0.f, 1.f, 0.f};
+
+        //Particles whose radius is smaller than this times their distance to the camera are too small to see as spheres, and are
+        //drawn as sprites instead. 0 draws every particle as a sphere
+        float min_sphere_size = 0.f;
+
+        //Particles are shaded from color1 to color2 by how much gravity they're under. raylib's BLUE and RED
+        Rgba color1 = {0, 121, 241, 255};
+        Rgba color2 = {230, 41, 55, 255};
+
+    };
+
+    //What the particles of one frame are drawn from, filled in parallel straight from the particle arrays. Spheres and sprites each keep the
+    //order the particles are in
+    class InstanceBuffers {
+
+    public:
+        std::vector<Transform> transforms;  //Of the particles drawn as spheres
+        std::vector<float> sphere_colors;   //One per sphere, 0 for color1 up to 1 for color2
+        std::vector<float> sprite_vertices; //The 4 corners of every particle drawn as a sprite, 12 floats per sprite
+        std::vector<Rgba> sprite_colors;    //One per sprite
+
+        std::vector<std::uint8_t> is_sphere;    //Per particle, whether it's drawn as a sphere
+        std::vector<std::size_t> chunk_spheres; //Per chunk of particles, the spheres before it
+
+        std::size_t sphere_count() const;
+        std::size_t sprite_count() const;
+
+    };
+
+    //How far the color of a particle is from color1 towards color2, by how much gravity it's under
+    float color_fraction(const Particle::Store &particles, std::size_t i);
+
+    //Copies what is drawn of every particle into frame, replacing what was there, spread across the pool
+    void capture(const Particle::Store &particles, Frame &frame, Parallel::ThreadPool &pool);
+
+    //Sorts every particle of frame into a sphere or a sprite, and fills buffers with them. The same buffers for any number of threads
+    void fill(const Frame &frame, const View &view, InstanceBuffers &buffers, Parallel::ThreadPool &pool);
+
+#ifndef GRAVITY_SIM_HEADLESS
+    //Draws InstanceBuffers: every sphere with one DrawMeshInstanced call, and every sprite as a quad of rlgl's batch.
+    //Needs a window, and only one can exist at a time. If the instancing shader can't be compiled, the spheres are drawn one by one instead
+    class Renderer {
+
+        Mesh mesh;
+        Material material;
+        Shader shader;
+        bool is_instanced = false;
+        int color2_location = -1;
+
+        //The colors of the spheres, a per instance attribute of the mesh next to the transforms DrawMeshInstanced hands over itself
+        int color_location = -1;
+        unsigned int color_buffer = 0;
+        std::size_t color_buffer_size = 0;
+
+    public:
+
+        Renderer();
+        ~Renderer();
+
+        Renderer(const Renderer&) = delete;
+        Renderer& operator=(const Renderer&) = delete;
+
+        void draw(const InstanceBuffers &buffers, const View &view);
+
+    };
+#endif
+
+}
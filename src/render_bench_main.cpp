@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "arguments.hpp"
+#include "parallel.hpp"
+#include "profiling.hpp"
+#include "render.hpp"
+#include "runner.hpp"
+#include "scenes.hpp"
+#include "simulation.hpp"
+
+namespace {
+
+    //The camera main.cpp starts with, on a 1280x720 window
+    constexpr float camera_z = -100.f;
+    constexpr float camera_fovy = 59.f;
+    constexpr float screen_height = 720.f;
+    constexpr float min_sphere_pixels = 2.f;
+
+    constexpr std::size_t default_runner_particles = 20000;
+    constexpr float default_runner_seconds = 2.f;
+    constexpr float delta_time = 1.f/60.f;
+
+    //What drawing the particles one by one did on the cpu before every DrawMesh call: read the particle out of the store, lerp its color and
+    //build its matrix. Returns a sum of the results, so none of it can be optimized away
+    float per_particle_path(const Particle::Store &particles, const Render::View &view) {
+
+        Vectors::Vec3 color1 = {static_cast<float>(view.color1.r), static_cast<float>(view.color1.g), static_cast<float>(view.color1.b)};
+        Vectors::Vec3 color2 = {static_cast<float>(view.color2.r), static_cast<float>(view.color2.g), static_cast<float>(view.color2.b)};
+
+        float sum = 0.f;
+        for (std::size_t i = 0; i < particles.size(); i++) {
+            Particle::Particle particle = particles.get(i);
+            float t = std::fmin(1.f, particle.prev_acceleration.length() / 100.f);
+            Vectors::Vec3 color = color1.lerp(color2, t);
+
+            float matrix[16] = {1.f, 0.f, 0.f, particle.position.x, 0.f, 1.f, 0.f, particle.position.y, 0.f, 0.f, 1.f, particle.position.z,
+                    0.f, 0.f, 0.f, 1.f};
+            sum += color.x + matrix[3] + matrix[7] + matrix[11];
+        }
+        return sum;
+
+    }
+
+    bool same_buffers(const Render::InstanceBuffers &a, const Render::InstanceBuffers &b) {
+
+        return a.transforms.size() == b.transforms.size() && a.sprite_colors.size() == b.sprite_colors.size() &&
+                std::memcmp(a.transforms.data(), b.transforms.data(), a.transforms.size()*sizeof(Render::Transform)) == 0 &&
+                std::memcmp(a.sphere_colors.data(), b.sphere_colors.data(), a.sphere_colors.size()*sizeof(float)) == 0 &&
+                std::memcmp(a.sprite_vertices.data(), b.sprite_vertices.data(), a.sprite_vertices.size()*sizeof(float)) == 0 &&
+                std::memcmp(a.sprite_colors.data(), b.sprite_colors.data(), a.sprite_colors.size()*sizeof(Render::Rgba)) == 0;
+
+    }
+
+}
+
+//Times filling the instance buffers the window draws the particles from, without a window: the default scene seen from the camera the
+//window starts with, with 1, 2, 4, ... threads up to max_threads, against the per particle work the window used to do before every DrawMesh.
+//Fails if the buffers aren't the same for every number of threads.
+//Then steps a smaller scene on a simulation thread for a few seconds as fast as it can, while this thread fills the buffers from whatever it
+//published last as fast as it can, to show neither waits for the other
+//Usage: gravity_render_bench [n_particles] [n_frames] [max_threads] [--min-sphere-pixels=<pixels>] [--runner-particles=<n>] [--runner-seconds=<seconds>]
+int main(int argc, char** argv) {
+
+    std::size_t n_particles = 1000000;
+    std::size_t n_frames = 20;
+    std::size_t max_threads = 0;
+
+    std::vector<const char*> args = Arguments::positional(argc, argv);
+
+    if (args.size() >= 1 && !Arguments::parse_count(args[0], "particles", n_particles)) return EXIT_FAILURE;
+    if (args.size() >= 2 && !Arguments::parse_count(args[1], "frames", n_frames)) return EXIT_FAILURE;
+    if (args.size() >= 3 && !Arguments::parse_count(args[2], "threads", max_threads)) return EXIT_FAILURE;
+    if (max_threads == 0) max_threads = Simulation::default_thread_count();
+
+    float sphere_pixels = min_sphere_pixels;
+    const char *pixels = Arguments::find_option(argc, argv, "min-sphere-pixels");
+    if (pixels && !Arguments::parse_positive_float(pixels, "Sphere pixels", sphere_pixels)) return EXIT_FAILURE;
+
+    std::size_t runner_particles = default_runner_particles;
+    const char *runner_n = Arguments::find_option(argc, argv, "runner-particles");
+    if (runner_n && !Arguments::parse_count(runner_n, "particles to step", runner_particles)) return EXIT_FAILURE;
+
+    float runner_seconds = default_runner_seconds;
+    const char *runner_time = Arguments::find_option(argc, argv, "runner-seconds");
+    if (runner_time && !Arguments::parse_positive_float(runner_time, "Runner seconds", runner_seconds)) return EXIT_FAILURE;
+
+    Particle::Store particles = Scenes::two_spheres(n_particles);
+
+    Render::View view;
+    view.position = {0.f, 0.f, camera_z};
+    view.right = {-1.f, 0.f, 0.f};  //Looking down +z with +y up
+    view.up = {0.f, 1.f, 0.f};
+    view.min_sphere_size = sphere_pixels*std::tan(camera_fovy*3.14159265f/180.f*0.5f)/(0.5f*screen_height);
+
+    double per_particle_seconds = 0.0;
+    float checksum = 0.f;
+    {
+        Profiling::ScopedTimer timer(per_particle_seconds);
+        for (std::size_t i = 0; i < n_frames; i++) checksum += per_particle_path(particles, view);
+    }
+
+    //What the simulation thread publishes after a step, on the simulation's threads
+    Render::Frame frame;
+    double capture_seconds = 0.0;
+    {
+        Parallel::ThreadPool pool(max_threads);
+        Render::capture(particles, frame, pool);    //Allocates the frame, which later captures reuse
+        Profiling::ScopedTimer timer(capture_seconds);
+        for (std::size_t i = 0; i < n_frames; i++) Render::capture(particles, frame, pool);
+    }
+
+    double frames = static_cast<double>(n_frames);
+    std::printf("%zu particles, %zu frames, spheres at least %.1f pixels across.\n", particles.size(), n_frames, 2.f*sphere_pixels);
+    std::printf("Per particle path: %.3f ms per frame (checksum %g).\n", per_particle_seconds/frames*1000.0, checksum);
+    std::printf("Capturing the particles for the window on %zu threads: %.3f ms.\n", max_threads, capture_seconds/frames*1000.0);
+    std::printf("%8s %10s %12s %10s %10s %10s\n", "threads", "fill ms", "ns/particle", "speedup", "spheres", "sprites");
+
+    Render::InstanceBuffers reference;
+    double single_thread_seconds = 0.0;
+    for (std::size_t n_threads = 1;; n_threads = std::min(2*n_threads, max_threads)) {
+
+        Parallel::ThreadPool pool(n_threads);
+        Render::InstanceBuffers buffers;
+        Render::fill(frame, view, buffers, pool);    //Allocates the buffers, which later frames reuse
+
+        double fill_seconds = 0.0;
+        {
+            Profiling::ScopedTimer timer(fill_seconds);
+            for (std::size_t i = 0; i < n_frames; i++) Render::fill(frame, view, buffers, pool);
+        }
+        if (n_threads == 1) {
+            single_thread_seconds = fill_seconds;
+            reference = buffers;
+        }
+        else if (!same_buffers(buffers, reference)) {
+            std::fprintf(stderr, "Error: The buffers filled with %zu threads aren't the same as with 1!\n", n_threads);
+            return EXIT_FAILURE;
+        }
+
+        std::printf("%8zu %10.3f %12.2f %9.2fx %10zu %10zu\n", n_threads, fill_seconds/frames*1000.0,
+                fill_seconds/(frames*particles.size())*1e9, single_thread_seconds/fill_seconds, buffers.sphere_count(), buffers.sprite_count());
+
+        if (n_threads == max_threads) break;
+
+    }
+
+    //Far faster than the clock, so the thread steps flat out
+    Simulation::Simulation simulation(max_threads);
+    simulation.particles = Scenes::two_spheres(runner_particles);
+    Simulation::Runner runner(simulation, delta_time, [&simulation](float step_delta_time) { simulation.step(step_delta_time); });
+    runner.set_speed(1e6f);
+
+    Parallel::ThreadPool pool(max_threads);
+    Render::InstanceBuffers buffers;
+    std::size_t n_drawn = 0;
+    std::size_t n_new = 0;
+    double render_seconds = 0.0;
+    {
+        Profiling::ScopedTimer timer(render_seconds);
+        auto start_time = std::chrono::steady_clock::now();
+        runner.start();
+        while (std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count() < runner_seconds) {
+            if (runner.update()) n_new++;
+            Render::fill(runner.latest().particles, view, buffers, pool);
+            n_drawn++;
+        }
+        runner.stop();
+    }
+    runner.update();
+
+    std::printf("\nSimulation thread with %zu particles for %.1f seconds: %.1f steps/s, while the buffers were filled %.1f times/s (%zu of them with new steps).\n",
+            simulation.particles.size(), render_seconds, static_cast<double>(runner.latest().steps)/render_seconds, static_cast<double>(n_drawn)/render_seconds,
+            n_new);
+
+    return 0;
+
+}
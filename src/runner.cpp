@@ -0,0 +1,196 @@
+#include <algorithm>
+
+#include "runner.hpp"
+
+namespace {
+
+    //A thread that fell behind the clock drops the time beyond this many steps, instead of taking ever more steps to catch up
+    constexpr double max_steps_behind = 8.0;
+
+    //How long the thread sleeps at most while waiting for the next step, so commands and stop don't wait long
+    constexpr double max_sleep_seconds = 0.005;
+
+    //Even without any steps, something is published this often, so the steps per second drop to 0 while paused
+    constexpr double rate_interval_seconds = 0.5;
+
+}
+
+namespace Simulation {
+
+    Runner::Runner(Simulation &simulation, float delta_time, std::function<void(float)> step)
+        : simulation(simulation), step(step), delta_time(delta_time) {}
+
+    Runner::~Runner() {
+
+        stop();
+
+    }
+
+    void Runner::start() {
+
+        if (thread.joinable()) return;
+
+        stopping = false;
+        rate_start = std::chrono::steady_clock::now();
+        rate_steps = n_steps;
+        publish();
+        thread = std::thread(&Runner::loop, this);
+
+    }
+
+    void Runner::stop() {
+
+        if (!thread.joinable()) return;
+
+        stopping = true;
+        thread.join();
+
+    }
+
+    void Runner::set_paused(bool is_paused) {
+
+        paused = is_paused;
+
+    }
+
+    void Runner::set_speed(float simulation_speed) {
+
+        if (simulation_speed > 0.f) speed = simulation_speed;
+
+    }
+
+    void Runner::set_publish_tree(bool should_publish) {
+
+        publish_tree = should_publish;
+
+    }
+
+    void Runner::run(std::function<void(Simulation&)> command) {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        commands.push_back(std::move(command));
+
+    }
+
+    bool Runner::update() {
+
+        return published.update();
+
+    }
+
+    const Published &Runner::latest() const {
+
+        return published.read_buffer();
+
+    }
+
+    bool Runner::run_commands() {
+
+        std::vector<std::function<void(Simulation&)>> waiting;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            waiting.swap(commands);
+        }
+
+        for (std::function<void(Simulation&)> &command : waiting) command(simulation);
+        return !waiting.empty();
+
+    }
+
+    void Runner::publish() {
+
+        Published &frame = published.write_buffer();
+
+        Render::capture(simulation.particles, frame.particles, simulation.get_pool());
+
+        frame.tree.clear();
+        if (publish_tree) {
+            //The tree the last step used. If it was discarded since, or the particles changed, a tree of the runner's own is built instead
+            const BarnesHut::Tree *tree = &simulation.bh_tree;
+            if (tree->get_nodes().empty() || tree->particle_count() != simulation.particles.size()) {
+                display_tree.leaf_size = simulation.bh_tree.leaf_size;
+                display_tree.boundary = simulation.bh_tree.boundary;
+                display_tree.period = simulation.bh_tree.period;
+                display_tree.build(simulation.particles, display_pool);
+                tree = &display_tree;
+            }
+            for (const BarnesHut::Node &node : tree->get_nodes()) frame.tree.push_back({node.center.rounded(), tree->node_width(node)});
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        double rate_seconds = std::chrono::duration<double>(now - rate_start).count();
+        if (rate_seconds >= rate_interval_seconds) {
+            steps_per_second = static_cast<double>(n_steps - rate_steps)/rate_seconds;
+            rate_start = now;
+            rate_steps = n_steps;
+        }
+
+        frame.steps = n_steps;
+        frame.steps_per_second = steps_per_second;
+        frame.stats = simulation.read_stats();
+        simulation.reset_stats();
+
+        published.publish();
+
+    }
+
+    void Runner::loop() {
+
+        auto last_time = std::chrono::steady_clock::now();
+        auto last_publish = last_time;
+        double unsimulated_time = 0.0;  //Clock time times speed that hasn't been stepped yet
+        bool tree_was_published = publish_tree;
+        bool has_unpublished_steps = false;
+
+        while (!stopping) {
+
+            bool has_changed = run_commands();
+
+            auto now = std::chrono::steady_clock::now();
+            double elapsed = std::chrono::duration<double>(now - last_time).count();
+            last_time = now;
+
+            if (paused) unsimulated_time = 0.0;
+            else unsimulated_time = std::min(unsimulated_time + elapsed*speed, max_steps_behind*delta_time);
+
+            //Every step the window is ready for is published, so a thread that can't keep up with the clock still shows every step it takes.
+            //Publishing copies every particle, so it's skipped while the window hasn't picked up the last one yet, and done once the steps
+            //have caught up with the clock instead
+            bool has_stepped = false;
+            while (unsimulated_time >= delta_time && !stopping) {
+                step(delta_time);
+                unsimulated_time -= delta_time;
+                n_steps++;
+                has_stepped = true;
+
+                if (published.is_waiting()) {
+                    has_unpublished_steps = true;
+                    continue;
+                }
+                tree_was_published = publish_tree;
+                publish();
+                last_publish = std::chrono::steady_clock::now();
+                has_unpublished_steps = false;
+            }
+            if (has_stepped) continue;
+
+            bool wants_tree = publish_tree;
+            now = std::chrono::steady_clock::now();
+            if (has_changed || has_unpublished_steps || wants_tree != tree_was_published ||
+                    std::chrono::duration<double>(now - last_publish).count() >= rate_interval_seconds) {
+                tree_was_published = wants_tree;
+                publish();
+                last_publish = now;
+                has_unpublished_steps = false;
+                continue;
+            }
+
+            //Nothing to do until the clock has moved on by another step
+            double wait_seconds = paused ? max_sleep_seconds : (delta_time - unsimulated_time)/speed;
+            std::this_thread::sleep_for(std::chrono::duration<double>(std::min(wait_seconds, max_sleep_seconds)));
+
+        }
+
+    }
+
+}
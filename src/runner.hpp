@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "barnes_hut.hpp"
+#include "parallel.hpp"
+#include "profiling.hpp"
+#include "render.hpp"
+#include "simulation.hpp"
+
+namespace Simulation {
+
+    //What the simulation thread hands to the window after it stepped. Never changed once published
+    class Published {
+
+    public:
+        Render::Frame particles;
+        std::vector<Render::Cube> tree;     //Every node of the tree, only if it was asked for
+
+        std::uint64_t steps = 0;            //Taken by the thread so far
+        double steps_per_second = 0.0;      //Over the last half second or so
+        Profiling::Stats stats;             //Of the steps since the last time something was published
+
+    };
+
+    //Steps a simulation on a thread of its own with a fixed delta time, keeping up with the clock (times speed), and publishes the particles
+    //after every batch of steps through a triple buffer, which the window reads without ever waiting for a step to finish.
+    //Nothing but the thread touches the simulation while it runs, changes to it are handed to the thread with run
+    class Runner {
+
+        Simulation &simulation;
+        std::function<void(float)> step;
+        float delta_time;
+
+        std::thread thread;
+        std::atomic<bool> stopping{false};
+        std::atomic<bool> paused{false};
+        std::atomic<bool> publish_tree{false};
+        std::atomic<float> speed{1.f};
+
+        std::mutex mutex;
+        std::vector<std::function<void(Simulation&)>> commands;  //Waiting to be run on the thread, oldest first
+
+        Parallel::TripleBuffer<Published> published;
+
+        //Only touched by the thread
+        std::uint64_t n_steps = 0;
+        //Built for showing only, when the simulation has no tree for the particles as they are. The simulation's own tree is never touched,
+        //so showing the tree doesn't change the steps or their stats
+        BarnesHut::Tree display_tree;
+        Parallel::ThreadPool display_pool{1};
+        std::uint64_t rate_steps = 0;   //n_steps when the steps per second were last measured
+        std::chrono::steady_clock::time_point rate_start;
+        double steps_per_second = 0.0;
+
+        void loop();
+        bool run_commands();
+        void publish();
+
+    public:
+
+        //step is called on the thread to take every step, with delta_time, so it can do whatever has to happen after a step as well
+        Runner(Simulation &simulation, float delta_time, std::function<void(float)> step);
+        ~Runner();
+
+        Runner(const Runner&) = delete;
+        Runner& operator=(const Runner&) = delete;
+
+        //Publishes the particles as they are and starts stepping
+        void start();
+        //Waits for the step being taken and stops the thread. The simulation can be used by the caller again after
+        void stop();
+
+        void set_paused(bool is_paused);
+        void set_speed(float simulation_speed);  //Simulated seconds per second of the clock
+        void set_publish_tree(bool should_publish);
+
+        //Runs command on the thread between two steps
+        void run(std::function<void(Simulation&)> command);
+
+        //For the thread reading what was published. update picks up the latest, and returns false if nothing new was published since the
+        //last call. latest stays as it is until the next update
+        bool update();
+        const Published &latest() const;
+
+    };
+
+}
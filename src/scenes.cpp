@@ -0,0 +1,175 @@
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <random>
+
+#include "scenes.hpp"
+
+namespace {
+
+    constexpr float pi = 3.14159265358979323846f;
+
+    constexpr float particle_mass = 10.f;
+    constexpr float particle_radius = 1.f;
+    constexpr float random_scene_spacing = 5.f;
+
+    //mt19937 gives the same numbers on every platform, the standard distributions don't, so the conversion to a float is done here.
+    //Uniform in [0, 1)
+    float random_unit(std::mt19937 &rng) {
+
+        return static_cast<float>(rng() >> 8) * (1.f/16777216.f);
+
+    }
+
+    //Uniform on the sphere of the given radius
+    Vectors::Vec3 random_direction(std::mt19937 &rng, float radius) {
+
+        float z = 2.f*random_unit(rng) - 1.f;
+        float angle = 2.f*pi*random_unit(rng);
+        float r_xy = std::sqrt(std::fmax(0.f, 1.f - z*z));
+        return {r_xy*std::cos(angle)*radius, r_xy*std::sin(angle)*radius, z*radius};
+
+    }
+
+    Particle::Particle particle_at(const Vectors::Vec3 &position, const Vectors::Vec3 &velocity, std::size_t id) {
+
+        Particle::Particle particle;
+        particle.position = position;
+        particle.velocity = velocity;
+        particle.acceleration = {0.f, 0.f, 0.f};
+        particle.prev_acceleration = {0.f, 0.f, 0.f};
+        particle.mass = particle_mass;
+        particle.radius = particle_radius;
+        particle.id = id;
+        return particle;
+
+    }
+
+}
+
+namespace Scenes {
+
+    void add_sphere(Particle::Store &particles, const Vectors::Vec3 &center, std::size_t n_particles) {
+
+        float theta = 0.f;  //Azimuthal angle
+        float phi = 0.f;  //Altitude angle
+        float dist = 5.f;
+        float dist_inc = 5.f;
+        for (std::size_t i = 0; i < n_particles; i++) {
+            Particle::Particle particle;
+
+            particle.position = {std::sin(phi)*std::cos(theta)*dist, std::sin(phi)*std::sin(theta)*dist, std::cos(phi)*dist}; //Spherical to cartesian coordinates
+            particle.position = particle.position + center;
+            theta += 0.5f;
+            if (theta >= 2.f*pi) {
+                phi += 0.5f;
+                theta -= 2.f*pi;
+            }
+            if (phi >= 2.f*pi) {
+                dist += dist_inc;
+                phi -= 2.f*pi;
+            }
+
+            particle.velocity = {0.f, 0.f, 0.f};
+            particle.acceleration = {0.f, 0.f, 0.f};
+            particle.prev_acceleration = {0.f, 0.f, 0.f};
+            particle.mass = 10.f;
+            particle.radius = 1.f;
+            particle.id = particles.size();
+
+            particles.push_back(particle);
+        }
+
+    }
+
+    Particle::Store two_spheres(std::size_t n_particles) {
+
+        Particle::Store particles;
+        particles.reserve(n_particles);
+
+        std::array<float, 2> sphere_particles_fraction = {2.f/3.f, 1.f/3.f};
+        for (std::size_t n = 0; n < 2; n++) {
+
+            Vectors::Vec3 center;
+            if (n == 0) center = {0.f, 0.f, 0.f};
+            else center = {-100.f, 0.f, 0.f};
+
+            //Same rounding as counting up while i < n_particles*fraction
+            std::size_t n_sphere_particles = static_cast<std::size_t>(std::ceil(static_cast<float>(n_particles)*sphere_particles_fraction[n]));
+            add_sphere(particles, center, n_sphere_particles);
+        }
+
+        return particles;
+
+    }
+
+    Particle::Store uniform_cube(std::size_t n_particles) {
+
+        Particle::Store particles;
+        particles.reserve(n_particles);
+
+        std::mt19937 rng(1);
+        float width = uniform_cube_width(n_particles);
+
+        for (std::size_t i = 0; i < n_particles; i++) {
+            Vectors::Vec3 position = {(random_unit(rng) - 0.5f)*width, (random_unit(rng) - 0.5f)*width, (random_unit(rng) - 0.5f)*width};
+            particles.push_back(particle_at(position, {0.f, 0.f, 0.f}, i));
+        }
+
+        return particles;
+
+    }
+
+    float uniform_cube_width(std::size_t n_particles) {
+
+        return random_scene_spacing*std::cbrt(static_cast<float>(n_particles));
+
+    }
+
+    Particle::Store uniform_box(std::size_t n_particles, float width) {
+
+        Particle::Store particles = uniform_cube(n_particles);
+        float stretch = width/uniform_cube_width(n_particles);
+        for (std::size_t i = 0; i < particles.size(); i++) {
+            particles.x[i] *= stretch;
+            particles.y[i] *= stretch;
+            particles.z[i] *= stretch;
+        }
+        return particles;
+
+    }
+
+    Particle::Store plummer(std::size_t n_particles, float G) {
+
+        Particle::Store particles;
+        particles.reserve(n_particles);
+
+        std::mt19937 rng(2);
+
+        //Scaled like the cube, so the particles outside of the core are about as far apart
+        float scale_radius = 0.5f*random_scene_spacing*std::cbrt(static_cast<float>(n_particles));
+        float total_mass = particle_mass*static_cast<float>(n_particles);
+
+        for (std::size_t i = 0; i < n_particles; i++) {
+
+            //The radius holding a random fraction of the mass. The last 0.1% is left out, it would reach out hundreds of scale radii
+            float mass_fraction = 0.999f*random_unit(rng) + 1e-6f;
+            float radius = scale_radius/std::sqrt(std::pow(mass_fraction, -2.f/3.f) - 1.f);
+
+            //Speed as a fraction q of the escape speed, by rejection sampling g(q) = q²(1 - q²)^3.5, which is at most 0.1
+            float q, g;
+            do {
+                q = random_unit(rng);
+                g = 0.1f*random_unit(rng);
+            } while (g > q*q*std::pow(1.f - q*q, 3.5f));
+            float escape_speed = std::sqrt(2.f*G*total_mass/std::sqrt(radius*radius + scale_radius*scale_radius));
+
+            particles.push_back(particle_at(random_direction(rng, radius), random_direction(rng, q*escape_speed), i));
+
+        }
+
+        return particles;
+
+    }
+
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+
+#include "particle_store.hpp"
+#include "vectors.hpp"
+
+namespace Scenes {
+
+    //Appends n_particles particles spiraling outwards from center in spherical shells, all at rest
+    void add_sphere(Particle::Store &particles, const Vectors::Vec3 &center, std::size_t n_particles);
+
+    //The default scene. Two spheres, one holding 2/3 of the particles at the origin, and one holding 1/3 of them 100 units away in -x
+    Particle::Store two_spheres(std::size_t n_particles);
+
+    //Particles at rest, spread uniformly at random over a cube around the origin, about 5 units apart whatever their number.
+    //The same particles every time for the same n_particles
+    Particle::Store uniform_cube(std::size_t n_particles);
+    //Width of the cube uniform_cube spreads n_particles over
+    float uniform_cube_width(std::size_t n_particles);
+    //The particles of uniform_cube, stretched to fill a cube of the given width around the origin. The starting scene of a periodic box
+    Particle::Store uniform_box(std::size_t n_particles, float width);
+
+    //A Plummer sphere around the origin in equilibrium: positions and velocities drawn from its distribution function for gravity G,
+    //following Aarseth, Henon & Wielen (1974). Most of the mass is in a dense core, which is the hard case for the tree.
+    //The same particles every time for the same n_particles and G
+    Particle::Store plummer(std::size_t n_particles, float G);
+
+}
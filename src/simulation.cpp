@@ -0,0 +1,872 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "arguments.hpp"
+#include "parallel.hpp"
+#include "profiling.hpp"
+#include "simulation.hpp"
+
+namespace {
+
+    //Particles per chunk handed to the pool. Small enough that the threads can even out the particles deep inside the spheres,
+    //which take much longer to simulate than the ones on the outside
+    constexpr std::size_t gravity_grain_size = 64;
+    constexpr std::size_t group_grain_size = 2;
+    constexpr std::size_t collision_grain_size = 256;
+    constexpr std::size_t integration_grain_size = 4096;
+
+    //A group walks the tree once for all of its active particles if at least 1 in this many of its particles are active
+    constexpr std::uint32_t min_active_fraction = 4;
+
+    //Yoshida 1990, "Construction of higher order symplectic integrators". Three leapfrog steps of w1, w0 and w1 times the step,
+    //with w0 negative so the second one goes backwards. As drifts and kicks, with the half drifts between the leapfrog steps merged
+    constexpr double yoshida_w1 = 1.3512071919596578;  //1/(2 - 2^(1/3))
+    constexpr double yoshida_w0 = -1.7024143839193153; //-2^(1/3)/(2 - 2^(1/3))
+    constexpr float yoshida_drifts[] = {static_cast<float>(yoshida_w1*0.5), static_cast<float>((yoshida_w0+yoshida_w1)*0.5),
+        static_cast<float>((yoshida_w0+yoshida_w1)*0.5), static_cast<float>(yoshida_w1*0.5)};
+    constexpr float yoshida_kicks[] = {static_cast<float>(yoshida_w1), static_cast<float>(yoshida_w0), static_cast<float>(yoshida_w1)};
+
+    //What the tree walks of a whole gravity evaluation cost. Every range of the pool adds its own walks once, so the threads rarely
+    //touch the counters at the same time
+    class WalkCounters {
+
+    public:
+        std::atomic<std::uint64_t> node_visits{0};
+        std::atomic<std::uint64_t> interactions{0};
+
+        void add(const BarnesHut::WalkCost &cost) {
+
+            node_visits.fetch_add(cost.node_visits, std::memory_order_relaxed);
+            interactions.fetch_add(cost.interactions, std::memory_order_relaxed);
+
+        }
+
+        void add_to(Profiling::Stats &stats) const {
+
+            stats.node_visits += node_visits.load();
+            stats.interactions += interactions.load();
+
+        }
+
+    };
+
+    void add_cost(BarnesHut::WalkCost &total, const BarnesHut::WalkCost &cost) {
+
+        total.node_visits += cost.node_visits;
+        total.interactions += cost.interactions;
+
+    }
+
+    BarnesHut::WalkCost simulate_particles(Particle::Store &particles, std::size_t lower_limit, std::size_t upper_limit, const BarnesHut::Tree &bh_tree,
+            const Kernels::Parameters &gravity) {
+
+        //One per thread, so the tree walks don't allocate once it has grown
+        static thread_local Kernels::Sources sources;
+        static thread_local Kernels::Multipoles multipoles;
+
+        BarnesHut::WalkCost cost;
+        for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+            add_cost(cost, bh_tree.apply_gravity(particles, i, gravity, sources, multipoles));
+        }
+        return cost;
+
+    }
+
+    BarnesHut::WalkCost simulate_active_particles(Particle::Store &particles, const std::uint32_t *first, const std::uint32_t *last,
+            const BarnesHut::Tree &bh_tree, const Kernels::Parameters &gravity) {
+
+        static thread_local Kernels::Sources sources;
+        static thread_local Kernels::Multipoles multipoles;
+
+        BarnesHut::WalkCost cost;
+        for (const std::uint32_t *i = first; i != last; i++) {
+            add_cost(cost, bh_tree.apply_gravity(particles, *i, gravity, sources, multipoles));
+        }
+        return cost;
+
+    }
+
+    BarnesHut::WalkCost simulate_groups(Particle::Store &particles, std::size_t lower_limit, std::size_t upper_limit, const BarnesHut::Tree &bh_tree,
+            const Kernels::Parameters &gravity) {
+
+        static thread_local Kernels::Sources sources;
+        static thread_local Kernels::Multipoles multipoles;
+
+        BarnesHut::WalkCost cost;
+        for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+            add_cost(cost, bh_tree.apply_gravity_to_group(particles, i, gravity, sources, multipoles));
+        }
+        return cost;
+
+    }
+
+    //The long range gravity from the mesh and the short range gravity from the tree, on one particle
+    BarnesHut::WalkCost simulate_tree_pm(Particle::Store &particles, std::size_t particle_idx, const BarnesHut::Tree &bh_tree, const PM::Solver &pm,
+            const Kernels::Parameters &gravity) {
+
+        static thread_local Kernels::Sources sources;
+
+        pm.add_long_range(particles, particle_idx);
+        return bh_tree.apply_short_range_gravity(particles, particle_idx, gravity, pm.get_short_range(), sources);
+
+    }
+
+    //Resolves the collisions of every particle in the range against the particles found by the grid. Nothing but the resolved particles
+    //are written to, so the particles stay the same for every thread until all of them are done. Every collision is worked out around
+    //the particle, with the others at their offsets from it, so positions keep their precision. Returns the number of pairs tested
+    std::size_t resolve_collisions(const Particle::Store &particles, std::size_t lower_limit, std::size_t upper_limit, const Collision::Grid &grid,
+            Particle::Store &resolved) {
+
+        std::size_t n_tests = 0;
+
+        for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+
+            Vectors::Point position = particles.position(i);
+            Particle::Particle particle = particles.get(i);
+            particle.position = {0.f, 0.f, 0.f};
+            Vectors::Vec3 received_velocity = {0.f, 0.f, 0.f};
+
+            grid.for_each_nearby(position, [&](std::size_t j) {
+                if (i == j) return;
+                n_tests++;
+
+                //Most particles in the cells around don't touch this one, which their position and radius are enough to tell.
+                //The rest of the other particle is only gathered for the ones that do
+                Vectors::Vec3 offset = particles.position(j) - position;
+                if (particle.position.dist(offset) >= particle.radius + particles.radius[j]) return;
+
+                Particle::Particle other;
+                other.position = offset;
+                other.velocity = particles.velocity(j);
+                other.radius = particles.radius[j];
+                other.mass = particles.mass[j];
+                particle.collision(other, received_velocity);
+            });
+
+            particle.velocity = particle.velocity + received_velocity;
+            resolved.set(i, particle);
+
+            Vectors::Point moved = position + particle.position;
+            resolved.x[i] = moved.x;
+            resolved.y[i] = moved.y;
+            resolved.z[i] = moved.z;
+
+        }
+
+        return n_tests;
+
+    }
+
+}
+
+namespace Simulation {
+
+    Simulation::Simulation(std::size_t n_threads) : pool(n_threads) {}
+
+    std::size_t Simulation::thread_count() const {
+
+        return pool.size();
+
+    }
+
+    Parallel::ThreadPool &Simulation::get_pool() {
+
+        return pool;
+
+    }
+
+    void Simulation::build_tree() {
+
+        wrap_positions();
+
+        Profiling::ScopedTimer timer(stats.seconds(Profiling::Phase::tree));
+
+        bh_tree.build(particles, pool);
+        if (uses_groups()) bh_tree.build_groups(group_size);
+        tree_rebuilds++;
+
+    }
+
+    void Simulation::update_tree() {
+
+        wrap_positions();
+
+        bool needs_groups = uses_groups();
+        bool can_refit = refit_tree && !bh_tree.get_nodes().empty() && bh_tree.particle_count() == particles.size() &&
+                (!needs_groups || bh_tree.group_count() > 0);
+
+        //Whether the nodes still fit the particles is measured first, and the mass of the nodes is only recomputed if they do. A tree
+        //that has to be rebuilt anyway doesn't pay for a whole refit first
+        if (can_refit) {
+            {
+                Profiling::ScopedTimer timer(stats.seconds(Profiling::Phase::tree));
+                bh_tree.fit(particles, pool);
+            }
+
+            bool fits = static_cast<float>(bh_tree.particles_out_of_leaf()) <= max_out_of_leaf_fraction*static_cast<float>(particles.size()) &&
+                    bh_tree.root_growth() <= max_root_growth;
+            if (fits) {
+                {
+                    Profiling::ScopedTimer timer(stats.seconds(Profiling::Phase::tree));
+                    bh_tree.refit_mass(particles, pool);
+                }
+                tree_refits++;
+                tree_out_of_leaf_total += bh_tree.particles_out_of_leaf();
+                return;
+            }
+        }
+
+        build_tree();
+
+    }
+
+    void Simulation::compute_accelerations() {
+
+        if (particles.empty()) return;
+
+        Profiling::ScopedTimer timer(stats.seconds(Profiling::Phase::gravity));
+        gravity_evaluations += particles.size();
+
+        WalkCounters counters;
+
+        if (solver == Solver::fmm && bh_tree.boundary == BarnesHut::Boundary::open) {
+            fmm.compute_accelerations(particles, bh_tree, gravity, group_size, pool);
+        }
+        else if (uses_mesh()) {
+            pm.compute_mesh(particles, bh_tree.period, gravity, pool);
+            pool.for_each_range(particles.size(), gravity_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+                BarnesHut::WalkCost cost;
+                for (std::size_t i = lower_limit; i <= upper_limit; i++) add_cost(cost, simulate_tree_pm(particles, i, bh_tree, pm, gravity));
+                counters.add(cost);
+            });
+        }
+        else if (uses_groups()) {
+            pool.for_each_range(bh_tree.group_count(), group_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+                counters.add(simulate_groups(particles, lower_limit, upper_limit, bh_tree, gravity));
+            });
+        }
+        else {
+            pool.for_each_range(particles.size(), gravity_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+                counters.add(simulate_particles(particles, lower_limit, upper_limit, bh_tree, gravity));
+            });
+        }
+
+        counters.add_to(stats);
+
+    }
+
+    void Simulation::compute_forces() {
+
+        if (particles.empty()) return;
+
+        compute_accelerations();
+        if (collisions) collide();
+
+    }
+
+    void Simulation::collide() {
+
+        if (particles.empty()) return;
+
+        Profiling::ScopedTimer timer(stats.seconds(Profiling::Phase::collisions));
+
+        collision_grid.build(particles, pool);
+        resolved_particles.resize(particles.size());
+
+        std::atomic<std::uint64_t> n_tests(0);
+        pool.for_each_range(particles.size(), collision_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            n_tests.fetch_add(resolve_collisions(particles, lower_limit, upper_limit, collision_grid, resolved_particles), std::memory_order_relaxed);
+        });
+        stats.collision_tests += n_tests.load();
+
+        particles.swap(resolved_particles);
+
+    }
+
+    void Simulation::integrate(float delta_time) {
+
+        Profiling::ScopedTimer timer(stats.seconds(Profiling::Phase::integration));
+
+        //Same as Particle::update, on the arrays directly
+        pool.for_each_range(particles.size(), integration_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+                particles.vx[i] += particles.ax[i]*delta_time;
+                particles.vy[i] += particles.ay[i]*delta_time;
+                particles.vz[i] += particles.az[i]*delta_time;
+
+                particles.x[i] += particles.vx[i]*delta_time;
+                particles.y[i] += particles.vy[i]*delta_time;
+                particles.z[i] += particles.vz[i]*delta_time;
+
+                particles.prev_ax[i] = particles.ax[i];
+                particles.prev_ay[i] = particles.ay[i];
+                particles.prev_az[i] = particles.az[i];
+                particles.ax[i] = 0.f;
+                particles.ay[i] = 0.f;
+                particles.az[i] = 0.f;
+            }
+        });
+
+        wrap_positions();
+
+    }
+
+    void Simulation::drift(float delta_time) {
+
+        Profiling::ScopedTimer timer(stats.seconds(Profiling::Phase::integration));
+
+        pool.for_each_range(particles.size(), integration_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+                particles.x[i] += particles.vx[i]*delta_time;
+                particles.y[i] += particles.vy[i]*delta_time;
+                particles.z[i] += particles.vz[i]*delta_time;
+            }
+        });
+
+        wrap_positions();
+
+    }
+
+    void Simulation::wrap_positions() {
+
+        if (bh_tree.boundary != BarnesHut::Boundary::periodic) return;
+
+        float period = bh_tree.period;
+        pool.for_each_range(particles.size(), integration_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+                particles.x[i] = BarnesHut::wrap(particles.x[i], period);
+                particles.y[i] = BarnesHut::wrap(particles.y[i], period);
+                particles.z[i] = BarnesHut::wrap(particles.z[i], period);
+            }
+        });
+
+    }
+
+    bool Simulation::uses_groups() const {
+
+        return solver == Solver::barnes_hut && group_size > 1 && bh_tree.boundary == BarnesHut::Boundary::open;
+
+    }
+
+    bool Simulation::uses_mesh() const {
+
+        return solver == Solver::tree_pm && bh_tree.boundary == BarnesHut::Boundary::periodic;
+
+    }
+
+    void Simulation::kick(float delta_time) {
+
+        update_tree();
+        compute_accelerations();
+
+        Profiling::ScopedTimer timer(stats.seconds(Profiling::Phase::integration));
+        pool.for_each_range(particles.size(), integration_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+                particles.vx[i] += particles.ax[i]*delta_time;
+                particles.vy[i] += particles.ay[i]*delta_time;
+                particles.vz[i] += particles.az[i]*delta_time;
+
+                particles.prev_ax[i] = particles.ax[i];
+                particles.prev_ay[i] = particles.ay[i];
+                particles.prev_az[i] = particles.az[i];
+                particles.ax[i] = 0.f;
+                particles.ay[i] = 0.f;
+                particles.az[i] = 0.f;
+            }
+        });
+
+    }
+
+    void Simulation::step(float delta_time) {
+
+        Profiling::ScopedTimer timer(stats.step_seconds);
+
+        switch (integrator) {
+            case Integrator::euler:
+                update_tree();
+                compute_forces();
+                integrate(delta_time);
+                return;
+
+            case Integrator::leapfrog:
+                drift(delta_time*0.5f);
+                kick(delta_time);
+                drift(delta_time*0.5f);
+                break;
+
+            case Integrator::yoshida4:
+                for (std::size_t i = 0; i < 3; i++) {
+                    drift(delta_time*yoshida_drifts[i]);
+                    kick(delta_time*yoshida_kicks[i]);
+                }
+                drift(delta_time*yoshida_drifts[3]);
+                break;
+
+            case Integrator::block:
+                step_block(delta_time); //Resolves collisions itself, before the last gravity evaluation
+                return;
+        }
+
+        //Collisions aren't part of the integration, they only move particles apart once their positions are final
+        if (collisions) collide();
+
+    }
+
+    bool Simulation::check_settings() const {
+
+        bool is_periodic = bh_tree.boundary == BarnesHut::Boundary::periodic;
+
+        if (solver == Solver::tree_pm && !is_periodic) {
+            std::fprintf(stderr, "Error: The tree-pm solver needs a periodic box!\n");
+            return false;
+        }
+        if (solver == Solver::fmm && is_periodic) {
+            std::fprintf(stderr, "Error: A periodic box needs the barnes-hut or tree-pm solver!\n");
+            return false;
+        }
+        if (solver == Solver::fmm && integrator == Integrator::block) {
+            std::fprintf(stderr, "Error: The block integrator can't be used with the fmm solver, which only computes gravity for every particle at once!\n");
+            return false;
+        }
+
+        return true;
+
+    }
+
+    bool Simulation::has_evaluated_accelerations() const {
+
+        std::size_t n = particles.size();
+        if (n == 0 || evaluated_x.size() != n) return false;
+
+        return std::memcmp(evaluated_x.data(), particles.x.data(), n*sizeof(Vectors::Coordinate)) == 0 &&
+                std::memcmp(evaluated_y.data(), particles.y.data(), n*sizeof(Vectors::Coordinate)) == 0 &&
+                std::memcmp(evaluated_z.data(), particles.z.data(), n*sizeof(Vectors::Coordinate)) == 0 &&
+                std::memcmp(evaluated_mass.data(), particles.mass.data(), n*sizeof(float)) == 0;
+
+    }
+
+    void Simulation::discard_tree() {
+
+        bh_tree.clear();
+
+    }
+
+    void Simulation::restore(bool accelerations_are_current) {
+
+        discard_tree();
+
+        if (accelerations_are_current) {
+            evaluated_x = particles.x;
+            evaluated_y = particles.y;
+            evaluated_z = particles.z;
+            evaluated_mass = particles.mass;
+        }
+        else {
+            evaluated_x.clear();
+            evaluated_y.clear();
+            evaluated_z.clear();
+            evaluated_mass.clear();
+        }
+
+    }
+
+    std::uint32_t Simulation::timestep_level(std::size_t particle_idx, float delta_time) const {
+
+        std::size_t i = particle_idx;
+        float a_sq = particles.prev_ax[i]*particles.prev_ax[i] + particles.prev_ay[i]*particles.prev_ay[i] + particles.prev_az[i]*particles.prev_az[i];
+        float v_sq = particles.vx[i]*particles.vx[i] + particles.vy[i]*particles.vy[i] + particles.vz[i]*particles.vz[i];
+
+        //Long enough to move at most about one radius, and for the acceleration to move it at most about one radius
+        float timestep = delta_time;
+        if (a_sq > 0.f) timestep = std::fmin(timestep, timestep_accuracy*std::sqrt(particles.radius[i]/std::sqrt(a_sq)));
+        if (v_sq > 0.f) timestep = std::fmin(timestep, timestep_accuracy*particles.radius[i]/std::sqrt(v_sq));
+
+        std::uint32_t level = 0;
+        while (level < max_timestep_level && delta_time/static_cast<float>(1u << level) > timestep) level++;
+        return level;
+
+    }
+
+    void Simulation::sort_by_level(std::size_t first, std::uint32_t first_level) {
+
+        std::size_t n = particles.size() - first;
+        std::size_t n_levels = max_timestep_level + 1;
+        std::size_t n_chunks = pool.size();
+
+        //Every chunk counts its particles on every level, which tells every chunk where to put each of its particles without waiting for
+        //the others, and keeps the particles of a level in the order they were in
+        chunk_level_counts.assign(n_chunks*n_levels, 0);
+        pool.for_each_chunk(n, n_chunks, [&](std::size_t chunk, std::size_t lower_limit, std::size_t upper_limit) {
+            std::size_t *counts = &chunk_level_counts[chunk*n_levels];
+            for (std::size_t k = lower_limit; k <= upper_limit; k++) counts[timestep_levels[particles_by_level[first + k]]]++;
+        });
+
+        std::size_t offset = first;
+        for (std::size_t level = first_level; level < n_levels; level++) {
+            level_starts[level] = offset;
+            for (std::size_t chunk = 0; chunk < n_chunks; chunk++) {
+                std::size_t count = chunk_level_counts[chunk*n_levels + level];
+                chunk_level_counts[chunk*n_levels + level] = offset;
+                offset += count;
+            }
+        }
+        level_starts[n_levels] = offset;
+
+        particles_by_level_scratch.resize(particles.size());
+        pool.for_each_chunk(n, n_chunks, [&](std::size_t chunk, std::size_t lower_limit, std::size_t upper_limit) {
+            std::size_t *offsets = &chunk_level_counts[chunk*n_levels];
+            for (std::size_t k = lower_limit; k <= upper_limit; k++) {
+                std::uint32_t i = particles_by_level[first + k];
+                particles_by_level_scratch[offsets[timestep_levels[i]]++] = i;
+            }
+        });
+        pool.for_each_range(n, integration_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            std::copy(particles_by_level_scratch.begin() + first + lower_limit, particles_by_level_scratch.begin() + first + upper_limit + 1,
+                    particles_by_level.begin() + first + lower_limit);
+        });
+
+    }
+
+    void Simulation::compute_active_accelerations(const std::uint32_t *first, const std::uint32_t *last) {
+
+        Profiling::ScopedTimer timer(stats.seconds(Profiling::Phase::gravity));
+        std::size_t n_active = last - first;
+        gravity_evaluations += n_active;
+
+        WalkCounters counters;
+
+        if (uses_mesh()) {
+            //The mesh is cheap next to the walks, so it's always computed again from every particle where it is now
+            pm.compute_mesh(particles, bh_tree.period, gravity, pool);
+            pool.for_each_range(n_active, gravity_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+                BarnesHut::WalkCost cost;
+                for (std::size_t k = lower_limit; k <= upper_limit; k++) add_cost(cost, simulate_tree_pm(particles, first[k], bh_tree, pm, gravity));
+                counters.add(cost);
+            });
+            counters.add_to(stats);
+            return;
+        }
+
+        if (!uses_groups() || bh_tree.group_count() == 0) {
+            //No groups, with group_size 1 or a periodic boundary. The FMM can't do only some of the particles either, which is why
+            //check_settings doesn't let it be used with block timesteps
+            pool.for_each_range(n_active, gravity_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+                counters.add(simulate_active_particles(particles, first + lower_limit, first + upper_limit + 1, bh_tree, gravity));
+            });
+            counters.add_to(stats);
+            return;
+        }
+
+        //Groups with enough active particles still share one walk between them. The walk for a whole group finds more nodes than the walk
+        //for a single particle, so the active particles of the other groups walk the tree one by one. Only the groups of the active particles
+        //are looked at, so a sub step with few of them doesn't go through every particle or group
+        is_active.resize(particles.size(), 0);
+        group_active_counts.resize(bh_tree.group_count(), 0);
+        active_groups.clear();
+        lone_particles.clear();
+
+        for (const std::uint32_t *i = first; i != last; i++) {
+            is_active[*i] = 1;
+            std::uint32_t g = bh_tree.group_of(*i);
+            if (group_active_counts[g]++ == 0) active_groups.push_back(g);
+        }
+
+        //Groups with too few active particles are dropped again, and their count set back to 0 tells their particles to walk on their own
+        std::size_t n_shared = 0;
+        for (std::uint32_t g : active_groups) {
+            const BarnesHut::Group &group = bh_tree.get_group(g);
+            if (group_active_counts[g]*min_active_fraction >= group.particle_end - group.particle_begin) active_groups[n_shared++] = g;
+            else group_active_counts[g] = 0;
+        }
+        active_groups.resize(n_shared);
+        for (const std::uint32_t *i = first; i != last; i++) {
+            if (group_active_counts[bh_tree.group_of(*i)] == 0) lone_particles.push_back(*i);
+        }
+
+        pool.for_each_range(active_groups.size(), group_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            static thread_local Kernels::Sources sources;
+            static thread_local Kernels::Multipoles multipoles;
+            BarnesHut::WalkCost cost;
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+                add_cost(cost, bh_tree.apply_gravity_to_group(particles, active_groups[i], gravity, sources, multipoles, is_active.data()));
+            }
+            counters.add(cost);
+        });
+        pool.for_each_range(lone_particles.size(), gravity_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            counters.add(simulate_active_particles(particles, &lone_particles[lower_limit], &lone_particles[upper_limit]+1, bh_tree, gravity));
+        });
+
+        for (std::uint32_t g : active_groups) group_active_counts[g] = 0;
+        for (const std::uint32_t *i = first; i != last; i++) is_active[*i] = 0;
+
+        counters.add_to(stats);
+
+    }
+
+    void Simulation::step_block(float delta_time) {
+
+        if (particles.empty()) return;
+
+        std::size_t n = particles.size();
+
+        //Sub steps are counted in units of the shortest possible timestep. A particle on level k takes steps of span(k) units,
+        //which always start and end on a multiple of span(k), so that every particle is back in sync at the end of the step
+        std::size_t n_units = std::size_t(1) << max_timestep_level;
+        float unit_time = delta_time/static_cast<float>(n_units);
+        auto span = [n_units](std::uint32_t level) -> std::size_t {
+            return n_units >> level;
+        };
+
+        //The accelerations at the end of the last step are still good if nothing moved the particles since, which saves a full evaluation
+        update_tree();
+        if (!has_evaluated_accelerations()) {
+            compute_accelerations();
+            for (std::size_t i = 0; i < n; i++) {
+                particles.prev_ax[i] = particles.ax[i];
+                particles.prev_ay[i] = particles.ay[i];
+                particles.prev_az[i] = particles.az[i];
+                particles.ax[i] = 0.f;
+                particles.ay[i] = 0.f;
+                particles.az[i] = 0.f;
+            }
+        }
+
+        timestep_levels.resize(n);
+        particles_by_level.resize(n);
+        level_starts.resize(max_timestep_level + 2);
+        pool.for_each_range(n, integration_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+            for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+                timestep_levels[i] = timestep_level(i, delta_time);
+                particles_by_level[i] = static_cast<std::uint32_t>(i);
+            }
+        });
+        sort_by_level(0, 0);
+
+        //Opening half kick of every particle
+        {
+            Profiling::ScopedTimer timer(stats.seconds(Profiling::Phase::integration));
+            pool.for_each_range(n, integration_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+                for (std::size_t i = lower_limit; i <= upper_limit; i++) {
+                    float half_step = 0.5f*unit_time*static_cast<float>(span(timestep_levels[i]));
+                    particles.vx[i] += particles.prev_ax[i]*half_step;
+                    particles.vy[i] += particles.prev_ay[i]*half_step;
+                    particles.vz[i] += particles.prev_az[i]*half_step;
+                }
+            });
+        }
+
+        std::size_t now = 0;
+        while (now < n_units) {
+
+            //Every particle drifts to the next time any particle's step ends. Velocities only change at those times, so nothing in between is needed
+            std::uint32_t finest_level = max_timestep_level;
+            while (finest_level > 0 && level_starts[finest_level] == n) finest_level--;
+            std::size_t next = (now/span(finest_level) + 1)*span(finest_level);
+            drift(unit_time*static_cast<float>(next - now));
+            now = next;
+
+            //The particles whose step ends now are the ones on every level whose step now is a multiple of
+            std::uint32_t first_level = 0;
+            while (now % span(first_level) != 0) first_level++;
+            std::size_t first_active = level_starts[first_level];
+            std::size_t n_active = n - first_active;
+            const std::uint32_t *active_particles = particles_by_level.data() + first_active;
+
+            bool is_last = now == n_units;
+            if (is_last && collisions) collide();
+
+            update_tree();
+            //Everyone's step ends at the end, so then the whole tree is evaluated the usual way
+            if (is_last) compute_accelerations();
+            else compute_active_accelerations(active_particles, active_particles + n_active);
+
+            //Closing half kick, and then the opening half kick of the next step. The next step's level is picked from the acceleration just
+            //computed and the velocity after the closing kick, so a particle heading into a close encounter shortens its step right away.
+            //A particle can only move to a longer step if now is on a multiple of it, so it can't end after the end of the whole step, and it
+            //never moves below first_level
+            {
+                Profiling::ScopedTimer timer(stats.seconds(Profiling::Phase::integration));
+                pool.for_each_range(n_active, integration_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+                    for (std::size_t k = lower_limit; k <= upper_limit; k++) {
+                        std::uint32_t i = active_particles[k];
+
+                        float half_step = 0.5f*unit_time*static_cast<float>(span(timestep_levels[i]));
+                        particles.vx[i] += particles.ax[i]*half_step;
+                        particles.vy[i] += particles.ay[i]*half_step;
+                        particles.vz[i] += particles.az[i]*half_step;
+
+                        particles.prev_ax[i] = particles.ax[i];
+                        particles.prev_ay[i] = particles.ay[i];
+                        particles.prev_az[i] = particles.az[i];
+                        particles.ax[i] = 0.f;
+                        particles.ay[i] = 0.f;
+                        particles.az[i] = 0.f;
+
+                        if (is_last) continue;
+
+                        std::uint32_t level = timestep_level(i, delta_time);
+                        while (now % span(level) != 0) level++;
+                        timestep_levels[i] = level;
+
+                        half_step = 0.5f*unit_time*static_cast<float>(span(level));
+                        particles.vx[i] += particles.prev_ax[i]*half_step;
+                        particles.vy[i] += particles.prev_ay[i]*half_step;
+                        particles.vz[i] += particles.prev_az[i]*half_step;
+                    }
+                });
+            }
+
+            if (!is_last) sort_by_level(first_active, first_level);
+
+        }
+
+        evaluated_x = particles.x;
+        evaluated_y = particles.y;
+        evaluated_z = particles.z;
+        evaluated_mass = particles.mass;
+
+    }
+
+    Diagnostics::Totals Simulation::measure_totals() {
+
+        return Diagnostics::measure(particles, gravity, pool);
+
+    }
+
+    void Simulation::reset_stats() {
+
+        stats = Profiling::Stats();
+        pool.reset_busy_time();
+
+    }
+
+    const Profiling::Stats &Simulation::read_stats() {
+
+        stats.thread_seconds.resize(pool.size());
+        for (std::size_t i = 0; i < pool.size(); i++) stats.thread_seconds[i] = pool.busy_time(i);
+
+        stats.tree_depth = bh_tree.depth();
+        stats.tree_nodes = bh_tree.get_nodes().size();
+
+        return stats;
+
+    }
+
+    const char *solver_name(Solver solver) {
+
+        switch (solver) {
+            case Solver::barnes_hut: return "barnes-hut";
+            case Solver::fmm: return "fmm";
+            case Solver::tree_pm: return "tree-pm";
+        }
+        return "unknown";
+
+    }
+
+    bool find_solver(const char *name, Solver &solver) {
+
+        for (Solver candidate : {Solver::barnes_hut, Solver::fmm, Solver::tree_pm}) {
+            if (std::strcmp(name, solver_name(candidate)) == 0) {
+                solver = candidate;
+                return true;
+            }
+        }
+        return false;
+
+    }
+
+    const char *integrator_name(Integrator integrator) {
+
+        switch (integrator) {
+            case Integrator::euler: return "euler";
+            case Integrator::leapfrog: return "leapfrog";
+            case Integrator::yoshida4: return "yoshida4";
+            case Integrator::block: return "block";
+        }
+        return "unknown";
+
+    }
+
+    bool find_integrator(const char *name, Integrator &integrator) {
+
+        for (Integrator candidate : {Integrator::euler, Integrator::leapfrog, Integrator::yoshida4, Integrator::block}) {
+            if (std::strcmp(name, integrator_name(candidate)) == 0) {
+                integrator = candidate;
+                return true;
+            }
+        }
+        return false;
+
+    }
+
+    bool read_options(int argc, char** argv, Simulation &simulation) {
+
+        const char *softening = Arguments::find_option(argc, argv, "softening");
+        if (softening && !Arguments::parse_positive_float(softening, "Softening", simulation.gravity.softening)) return false;
+
+        const char *group_size = Arguments::find_option(argc, argv, "group-size");
+        if (group_size && !Arguments::parse_count(group_size, "particles per group", simulation.group_size)) return false;
+
+        const char *leaf_size = Arguments::find_option(argc, argv, "leaf-size");
+        if (leaf_size && !Arguments::parse_count(leaf_size, "particles per leaf", simulation.bh_tree.leaf_size)) return false;
+
+        const char *solver = Arguments::find_option(argc, argv, "solver");
+        if (solver && !find_solver(solver, simulation.solver)) {
+            std::fprintf(stderr, "Error: Unknown solver \"%s\" (barnes-hut, fmm or tree-pm)!\n", solver);
+            return false;
+        }
+
+        const char *integrator = Arguments::find_option(argc, argv, "integrator");
+        if (integrator && !find_integrator(integrator, simulation.integrator)) {
+            std::fprintf(stderr, "Error: Unknown integrator \"%s\" (euler, leapfrog, yoshida4 or block)!\n", integrator);
+            return false;
+        }
+
+        const char *max_out_of_leaf = Arguments::find_option(argc, argv, "max-out-of-leaf");
+        if (max_out_of_leaf && !Arguments::parse_positive_float(max_out_of_leaf, "Fraction out of leaf", simulation.max_out_of_leaf_fraction)) return false;
+
+        const char *max_root_growth = Arguments::find_option(argc, argv, "max-root-growth");
+        if (max_root_growth && !Arguments::parse_positive_float(max_root_growth, "Root growth", simulation.max_root_growth)) return false;
+
+        const char *periodic = Arguments::find_option(argc, argv, "periodic");
+        if (periodic) {
+            if (!Arguments::parse_positive_float(periodic, "Period", simulation.bh_tree.period)) return false;
+            simulation.bh_tree.boundary = BarnesHut::Boundary::periodic;
+        }
+
+        const char *mesh = Arguments::find_option(argc, argv, "mesh");
+        if (mesh) {
+            if (!Arguments::parse_count(mesh, "mesh cells", simulation.pm.cells)) return false;
+            if ((simulation.pm.cells & (simulation.pm.cells - 1)) != 0) {
+                std::fprintf(stderr, "Error: The mesh needs a power of two cells along every axis, not %zu!\n", simulation.pm.cells);
+                return false;
+            }
+        }
+
+        //The opening angle of whichever solver is used, they measure it differently
+        const char *theta = Arguments::find_option(argc, argv, "theta");
+        float &theta_value = simulation.solver == Solver::fmm ? simulation.fmm.theta : simulation.bh_tree.theta;
+        if (theta && !Arguments::parse_positive_float(theta, "Theta", theta_value)) return false;
+
+        return simulation.check_settings();
+
+    }
+
+    std::size_t default_thread_count() {
+
+        std::size_t n_threads = std::thread::hardware_concurrency() / 2;
+        if (n_threads == 0) {
+            std::fprintf(stderr, "WARNING: Unable to detect maximum number of concurrent threads supported! Using 1 thread.\n");
+            n_threads = 1;
+        }
+
+        return n_threads;
+
+    }
+
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "particle_store.hpp"
+#include "barnes_hut.hpp"
+#include "collision_grid.hpp"
+#include "diagnostics.hpp"
+#include "fmm.hpp"
+#include "gravity_kernels.hpp"
+#include "parallel.hpp"
+#include "particle_mesh.hpp"
+#include "profiling.hpp"
+
+namespace Simulation {
+
+    //How gravity is computed. All of them use the same tree. tree_pm splits gravity between a mesh for the long range part and the tree for
+    //the short range part, and only works in a periodic box
+    enum class Solver {
+        barnes_hut,
+        fmm,
+        tree_pm
+    };
+
+    //How a step moves the particles. euler is semi-implicit Euler: first order, one gravity evaluation per step.
+    //leapfrog is drift-kick-drift: second order and symplectic, also one gravity evaluation per step.
+    //yoshida4 is three leapfrog steps with Yoshida's weights: fourth order, three gravity evaluations per step.
+    //block is kick-drift-kick leapfrog with a timestep for every particle: the step is split into power of two sub steps, and every particle
+    //only has its gravity computed as often as its own acceleration and velocity need it. The FMM only computes gravity for every particle at
+    //once, so block can't be used with it
+    enum class Integrator {
+        euler,
+        leapfrog,
+        yoshida4,
+        block
+    };
+
+    //Owns the particles and steps them forward in time. Knows nothing about rendering, so it can be driven by the
+    //raylib loop in main.cpp as well as by the headless runner.
+    //With a periodic boundary on bh_tree, particles are moved back into the box whenever they're moved, and gravity is always computed with
+    //Barnes-Hut walking the tree once for every particle, or with TreePM, since neither the FMM nor the group walks know about the images. Collisions
+    //don't reach across the faces of the box
+    //A step gives bit for bit the same particles for any number of threads: every particle's gravity and collisions only read the particles
+    //of the previous stage and only write to that particle, always in the same order, and nothing is summed across threads
+    class Simulation {
+
+        Parallel::ThreadPool pool;   //Used for every parallel part of a step, so no threads are started while stepping
+
+        Profiling::Stats stats;     //Added to by every step until reset_stats
+
+        Collision::Grid collision_grid;
+        Particle::Store resolved_particles; //Collisions are written here, and then swapped with particles
+
+        //For block timesteps. The timestep of particle i is the step divided by 2^timestep_levels[i]
+        std::vector<std::uint32_t> timestep_levels;
+        //Every particle sorted by level, and where every level starts in it, with one more for the end. The particles due at any time are
+        //the ones from some level on, so they're always the end of particles_by_level, and only they're sorted again once they've moved
+        std::vector<std::uint32_t> particles_by_level;
+        std::vector<std::uint32_t> particles_by_level_scratch;
+        std::vector<std::size_t> level_starts;
+        std::vector<std::size_t> chunk_level_counts;
+        //All 0 between sub steps, only the active particles and their groups are set and cleared again
+        std::vector<std::uint8_t> is_active;
+        std::vector<std::uint32_t> group_active_counts;
+        std::vector<std::uint32_t> active_groups; //Groups of the tree that share one walk between their active particles
+        std::vector<std::uint32_t> lone_particles; //Active particles that walk the tree on their own
+        //Where prev_a* was computed, to tell if it can be reused
+        std::vector<Vectors::Coordinate> evaluated_x, evaluated_y, evaluated_z;
+        std::vector<float> evaluated_mass;
+
+        void drift(float delta_time);   //Moves every particle along its velocity
+        void kick(float delta_time);    //Builds the tree, computes gravity and changes every velocity by it
+        void collide();
+        void wrap_positions();  //Moves every particle into the periodic box, if the tree has a periodic boundary
+        bool uses_groups() const;   //Whether the tree is split into groups for the gravity walks
+        bool uses_mesh() const;     //Whether gravity is split between the mesh and the tree
+
+        void step_block(float delta_time);
+        std::uint32_t timestep_level(std::size_t particle_idx, float delta_time) const; //From prev_a* and the velocity as they are now
+        void sort_by_level(std::size_t first, std::uint32_t first_level); //Sorts particles_by_level from first on, which holds no level below first_level
+        void compute_active_accelerations(const std::uint32_t *first, const std::uint32_t *last); //Gravity on these particles only, against the tree as it is
+
+    public:
+        Particle::Store particles;
+        BarnesHut::Tree bh_tree;
+
+        Kernels::Parameters gravity;   //G and the softening length
+
+        //At most this many particles share one walk of the tree. 1 walks the tree once for every particle
+        std::size_t group_size = 32;
+
+        Solver solver = Solver::barnes_hut;
+        FMM::Solver fmm;
+        PM::Solver pm;
+
+        Integrator integrator = Integrator::leapfrog;
+        bool collisions = true; //Whether particles bounce off each other. Without them, only the integrator changes the total energy
+
+        //With block timesteps, every particle takes steps of about timestep_accuracy*min(sqrt(radius/|a|), radius/|v|), rounded down to the
+        //step divided by a power of two, but never shorter than the step divided by 2^max_timestep_level
+        float timestep_accuracy = 0.5f;
+        std::uint32_t max_timestep_level = 8;
+
+        //How many times the gravity on a particle was computed, over every step so far. Divided by the number of particles, it's the number
+        //of full gravity evaluations
+        std::size_t gravity_evaluations = 0;
+
+        //Steps refit the tree they built before instead of building a new one, until more than max_out_of_leaf_fraction of the particles
+        //have left the cell of their leaf, or the root has grown to more than max_root_growth times the width of the root box.
+        //Particles that left their leaf aren't moved to another one, which would break up the runs of particles the leaves are made of,
+        //their leaf grows to still hold them instead, and the next rebuild sorts them into the right one. Only the width of the nodes is
+        //measured before deciding, the mass is recomputed once the tree is known to still fit
+        bool refit_tree = true;
+        float max_out_of_leaf_fraction = 0.05f;
+        float max_root_growth = 1.5f;
+
+        //How the tree was kept up to date, over every step so far. tree_refits only counts the refits that were kept instead of rebuilt,
+        //and tree_out_of_leaf_total sums the particles that were outside of their leaf at every one of them. None of them is moved to
+        //another leaf, their leaf grows to hold them instead
+        std::size_t tree_rebuilds = 0;
+        std::size_t tree_refits = 0;
+        std::size_t tree_out_of_leaf_total = 0;
+
+        explicit Simulation(std::size_t n_threads);
+
+        std::size_t thread_count() const;
+        //The threads the steps run on, for work on the particles between two steps, like copying them out for the window
+        Parallel::ThreadPool &get_pool();
+
+        void build_tree();  //Always builds a new tree
+        void update_tree(); //Refits the tree if it still fits the particles well enough, otherwise builds a new one
+        void compute_accelerations(); //Adds gravity to the acceleration of every particle, using the selected solver. Expects the tree to be built
+        void compute_forces();  //Gravity and then collisions, spread across the thread pool. Expects the tree to be built
+        void integrate(float delta_time); //Semi-implicit Euler with the accelerations from compute_forces
+
+        //Whether the solver, the integrator and the boundary of the tree work together: tree_pm needs a periodic boundary, the FMM doesn't
+        //know about one, and block timesteps need gravity on only some of the particles, which the FMM can't do. Prints an error and returns
+        //false if they don't. step doesn't check, it falls back to Barnes-Hut walks where the solver can't be used
+        bool check_settings() const;
+
+        //Moves the particles forward by delta_time with the selected integrator. The tree is updated before every gravity evaluation
+        void step(float delta_time);
+
+        //Energy and momentum of the particles, summed directly over every pair
+        Diagnostics::Totals measure_totals();
+
+        bool has_evaluated_accelerations() const;   //Whether prev_a* still holds the gravity on the particles where they are now
+
+        //Makes the next step build the tree from scratch instead of refitting the last one. The tree isn't part of a snapshot, so a run
+        //that takes a snapshot calls this to step on the same way a run restarted from the snapshot will
+        void discard_tree();
+
+        //After the particles were replaced by ones from partway through a run. prev_a* is taken to be the gravity where the particles are
+        //if has_evaluated_accelerations was true when they were saved, so block timesteps reuse it the same way the saving run does
+        void restore(bool accelerations_are_current);
+
+        //Where the time of every step since the last reset_stats went, with the time every thread of the pool was busy and the tree as it is now.
+        //Timing a phase only costs two reads of the clock, and the counters are only added to once per chunk of particles, so they're always on
+        void reset_stats();
+        const Profiling::Stats &read_stats();
+
+    };
+
+    //The name of a solver on the command line, and the other way around. find_solver returns false if there is no solver with the name
+    const char *solver_name(Solver solver);
+    bool find_solver(const char *name, Solver &solver);
+
+    //Same for integrators
+    const char *integrator_name(Integrator integrator);
+    bool find_integrator(const char *name, Integrator &integrator);
+
+    //Sets up the simulation from every option that changes how it steps: --softening, --group-size, --leaf-size, --solver, --integrator,
+    //--max-out-of-leaf, --max-root-growth, --periodic, --mesh and --theta, and checks them with check_settings. Prints an error and returns
+    //false if any of them is invalid. The same options always set up the same simulation, so a second one can be set up the same way
+    bool read_options(int argc, char** argv, Simulation &simulation);
+
+    //Half of the hardware threads, or 1 if that can't be detected
+    std::size_t default_thread_count();
+
+}
@@ -0,0 +1,408 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define GRAVITY_SIM_HAS_MMAP
+#endif
+
+#include "snapshot.hpp"
+
+namespace {
+
+    constexpr char magic[8] = {'G', 'R', 'A', 'V', 'S', 'N', 'A', 'P'};
+    constexpr std::uint32_t byte_order_mark = 0x01020304;
+    constexpr std::size_t column_alignment = 64;
+    constexpr std::size_t n_position_columns = 3;
+    constexpr std::size_t n_columns = 14;     //Positions first, then floats, not counting the ids
+    constexpr std::uint32_t accelerations_are_current_flag = 1;
+    constexpr std::uint32_t double_positions_flag = 2;
+
+    //Laid out so that nothing needs padding, and written as it is
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byte_order;
+        std::uint64_t n_particles;
+        std::uint64_t step;
+        double time;
+        std::uint32_t flags;
+        std::uint32_t reserved[5];
+    };
+
+    static_assert(sizeof(Header) == 64, "The snapshot header must be 64 bytes");
+
+    std::size_t align(std::size_t n_bytes) {
+
+        return (n_bytes + column_alignment - 1) / column_alignment * column_alignment;
+
+    }
+
+    //Where column k starts, the position columns first, then the float columns and then the ids
+    std::size_t column_offset(std::size_t k, std::size_t n_particles, std::size_t position_bytes) {
+
+        std::size_t n_positions = std::min(k, n_position_columns);
+        return sizeof(Header) + n_positions*align(n_particles*position_bytes) + (k - n_positions)*align(n_particles*sizeof(float));
+
+    }
+
+    //Not counting the padding of the columns
+    std::size_t bytes_per_particle(std::size_t position_bytes) {
+
+        return n_position_columns*position_bytes + (n_columns - n_position_columns)*sizeof(float) + sizeof(std::uint64_t);
+
+    }
+
+    std::size_t file_size(std::size_t n_particles, std::size_t position_bytes) {
+
+        return column_offset(n_columns, n_particles, position_bytes) + align(n_particles*sizeof(std::uint64_t));
+
+    }
+
+    //In the order of the layout
+    std::vector<const std::vector<Vectors::Coordinate>*> position_columns(const Particle::Store &p) {
+
+        return {&p.x, &p.y, &p.z};
+
+    }
+
+    std::vector<std::vector<Vectors::Coordinate>*> position_columns(Particle::Store &p) {
+
+        return {&p.x, &p.y, &p.z};
+
+    }
+
+    std::vector<const std::vector<float>*> float_columns(const Particle::Store &p) {
+
+        return {&p.vx, &p.vy, &p.vz, &p.ax, &p.ay, &p.az, &p.mass, &p.radius, &p.prev_ax, &p.prev_ay, &p.prev_az};
+
+    }
+
+    std::vector<std::vector<float>*> float_columns(Particle::Store &p) {
+
+        return {&p.vx, &p.vy, &p.vz, &p.ax, &p.ay, &p.az, &p.mass, &p.radius, &p.prev_ax, &p.prev_ay, &p.prev_az};
+
+    }
+
+    //Copies a column of the file into a column of the particles, which may be stored as another type
+    template <typename Stored, typename Column>
+    void read_column(const void *data, std::size_t n_particles, std::vector<Column> &column) {
+
+        const Stored *values = static_cast<const Stored*>(data);
+        column.assign(values, values + n_particles);
+
+    }
+
+    bool write_padded(std::FILE *file, const void *data, std::size_t n_bytes) {
+
+        static const char zeros[column_alignment] = {};
+
+        if (n_bytes > 0 && std::fwrite(data, 1, n_bytes, file) != n_bytes) return false;
+        std::size_t padding = align(n_bytes) - n_bytes;
+        return padding == 0 || std::fwrite(zeros, 1, padding, file) == padding;
+
+    }
+
+}
+
+namespace Snapshot {
+
+    bool save(const char *path, const Particle::Store &particles, const Info &info) {
+
+        std::string tmp_path = std::string(path) + ".tmp";
+        std::FILE *file = std::fopen(tmp_path.c_str(), "wb");
+        if (!file) {
+            std::fprintf(stderr, "Error: Couldn't open \"%s\" to write a snapshot to!\n", tmp_path.c_str());
+            return false;
+        }
+
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.byte_order = byte_order_mark;
+        header.n_particles = particles.size();
+        header.step = info.step;
+        header.time = info.time;
+        header.flags = info.accelerations_are_current ? accelerations_are_current_flag : 0;
+        if (sizeof(Vectors::Coordinate) == sizeof(double)) header.flags |= double_positions_flag;
+
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+        for (const std::vector<Vectors::Coordinate> *column : position_columns(particles)) {
+            ok = ok && write_padded(file, column->data(), particles.size()*sizeof(Vectors::Coordinate));
+        }
+        for (const std::vector<float> *column : float_columns(particles)) {
+            ok = ok && write_padded(file, column->data(), particles.size()*sizeof(float));
+        }
+
+        std::vector<std::uint64_t> ids(particles.id.begin(), particles.id.end());
+        ok = ok && write_padded(file, ids.data(), ids.size()*sizeof(std::uint64_t));
+
+        ok = std::fclose(file) == 0 && ok;
+        ok = ok && std::rename(tmp_path.c_str(), path) == 0;
+
+        if (!ok) {
+            std::fprintf(stderr, "Error: Couldn't write the snapshot \"%s\"!\n", path);
+            std::remove(tmp_path.c_str());
+        }
+        return ok;
+
+    }
+
+    MappedFile::~MappedFile() {
+
+        close();
+
+    }
+
+    void MappedFile::close() {
+
+        if (!data) return;
+
+#ifdef GRAVITY_SIM_HAS_MMAP
+        if (is_mapped) munmap(const_cast<unsigned char*>(data), n_bytes);
+        else delete[] data;
+#else
+        delete[] data;
+#endif
+
+        data = NULL;
+        n_bytes = 0;
+        n_particles = 0;
+
+    }
+
+    bool MappedFile::open(const char *path) {
+
+        close();
+
+#ifdef GRAVITY_SIM_HAS_MMAP
+        int fd = ::open(path, O_RDONLY);
+        struct stat file_stat;
+        if (fd < 0 || fstat(fd, &file_stat) != 0) {
+            if (fd >= 0) ::close(fd);
+            std::fprintf(stderr, "Error: Couldn't open the snapshot \"%s\"!\n", path);
+            return false;
+        }
+
+        n_bytes = static_cast<std::size_t>(file_stat.st_size);
+        void *mapping = n_bytes > 0 ? mmap(NULL, n_bytes, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        ::close(fd);    //The mapping stays valid without the file descriptor
+        if (mapping == MAP_FAILED) {
+            std::fprintf(stderr, "Error: Couldn't map the snapshot \"%s\" into memory!\n", path);
+            n_bytes = 0;
+            return false;
+        }
+
+        //The columns are read front to back
+        madvise(mapping, n_bytes, MADV_SEQUENTIAL);
+        data = static_cast<const unsigned char*>(mapping);
+        is_mapped = true;
+#else
+        std::FILE *file = std::fopen(path, "rb");
+        if (!file) {
+            std::fprintf(stderr, "Error: Couldn't open the snapshot \"%s\"!\n", path);
+            return false;
+        }
+
+        std::fseek(file, 0, SEEK_END);
+        long length = std::ftell(file);
+        std::fseek(file, 0, SEEK_SET);
+        n_bytes = length > 0 ? static_cast<std::size_t>(length) : 0;
+
+        unsigned char *buffer = new unsigned char[n_bytes > 0 ? n_bytes : 1];
+        bool ok = std::fread(buffer, 1, n_bytes, file) == n_bytes;
+        std::fclose(file);
+        data = buffer;
+        is_mapped = false;
+        if (!ok) {
+            std::fprintf(stderr, "Error: Couldn't read the snapshot \"%s\"!\n", path);
+            close();
+            return false;
+        }
+#endif
+
+        Header header;
+        if (n_bytes < sizeof(header)) {
+            std::fprintf(stderr, "Error: \"%s\" is too short to be a snapshot!\n", path);
+            close();
+            return false;
+        }
+        std::memcpy(&header, data, sizeof(header));
+
+        if (std::memcmp(header.magic, magic, sizeof(magic)) != 0) {
+            std::fprintf(stderr, "Error: \"%s\" isn't a snapshot!\n", path);
+            close();
+            return false;
+        }
+        if (header.byte_order != byte_order_mark) {
+            std::fprintf(stderr, "Error: The snapshot \"%s\" was written by a machine with a different byte order!\n", path);
+            close();
+            return false;
+        }
+        if (header.version < min_version || header.version > version) {
+            std::fprintf(stderr, "Error: The snapshot \"%s\" is version %u, only versions %u to %u can be read!\n", path, header.version, min_version,
+                    version);
+            close();
+            return false;
+        }
+        position_bytes = header.version >= 2 && (header.flags & double_positions_flag) ? sizeof(double) : sizeof(float);
+        //Checked against the bytes per particle first, so that a huge particle count can't overflow the size of the file
+        if (header.n_particles > n_bytes/bytes_per_particle(position_bytes) || n_bytes < file_size(header.n_particles, position_bytes)) {
+            std::fprintf(stderr, "Error: The snapshot \"%s\" is cut short, it should hold %llu particles!\n", path,
+                    static_cast<unsigned long long>(header.n_particles));
+            close();
+            return false;
+        }
+
+        n_particles = header.n_particles;
+        file_info.step = header.step;
+        file_info.time = header.time;
+        file_info.accelerations_are_current = (header.flags & accelerations_are_current_flag) != 0;
+
+        return true;
+
+    }
+
+    std::size_t MappedFile::size() const {
+
+        return n_particles;
+
+    }
+
+    const Info &MappedFile::info() const {
+
+        return file_info;
+
+    }
+
+    const void *MappedFile::column(std::size_t k) const {
+
+        return data + column_offset(k, n_particles, position_bytes);
+
+    }
+
+    const std::uint64_t *MappedFile::id_column() const {
+
+        return reinterpret_cast<const std::uint64_t*>(data + column_offset(n_columns, n_particles, position_bytes));
+
+    }
+
+    bool MappedFile::has_double_positions() const {
+
+        return position_bytes == sizeof(double);
+
+    }
+
+    void MappedFile::read(Particle::Store &particles) const {
+
+        std::vector<std::vector<Vectors::Coordinate>*> positions = position_columns(particles);
+        for (std::size_t k = 0; k < n_position_columns; k++) {
+            if (has_double_positions()) read_column<double>(column(k), n_particles, *positions[k]);
+            else read_column<float>(column(k), n_particles, *positions[k]);
+        }
+
+        std::vector<std::vector<float>*> columns = float_columns(particles);
+        for (std::size_t k = n_position_columns; k < n_columns; k++) {
+            read_column<float>(column(k), n_particles, *columns[k - n_position_columns]);
+        }
+
+        const std::uint64_t *ids = id_column();
+        particles.id.assign(ids, ids + n_particles);
+
+    }
+
+    bool load(const char *path, Particle::Store &particles, Info &info) {
+
+        MappedFile file;
+        if (!file.open(path)) return false;
+
+        file.read(particles);
+        info = file.info();
+        return true;
+
+    }
+
+    Checkpointer::Checkpointer(const std::string &path) : path(path) {
+
+        writer = std::thread(&Checkpointer::writer_loop, this);
+
+    }
+
+    Checkpointer::~Checkpointer() {
+
+        finish();
+
+    }
+
+    void Checkpointer::finish() {
+
+        if (!writer.joinable()) return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_one();
+        writer.join();
+
+    }
+
+    void Checkpointer::save(const Particle::Store &particles, const Info &info) {
+
+        //Copied under the lock, but the thread only holds it to swap the buffers, never while writing
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending = particles;
+            pending_info = info;
+            has_pending = true;
+        }
+        cv.notify_one();
+
+    }
+
+    std::size_t Checkpointer::written() {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        return n_written;
+
+    }
+
+    std::size_t Checkpointer::failed() {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        return n_failed;
+
+    }
+
+    void Checkpointer::writer_loop() {
+
+        while (true) {
+
+            Info info;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this]() { return stopping || has_pending; });
+                if (!has_pending) return;   //Stopping, with nothing left to write
+
+                writing.swap(pending);
+                info = pending_info;
+                has_pending = false;
+            }
+
+            bool ok = Snapshot::save(path.c_str(), writing, info);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (ok) n_written++;
+            else n_failed++;
+
+        }
+
+    }
+
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "particle_store.hpp"
+
+namespace Snapshot {
+
+    //A snapshot is a 64 byte header followed by every column of a Particle::Store, one after the other: x, y, z, vx, vy, vz, ax, ay, az,
+    //mass, radius, prev_ax, prev_ay, prev_az as floats, then id as 64 bit integers. Every column starts on a multiple of 64 bytes.
+    //x, y and z are doubles instead if a flag in the header says so, which builds with double positions set (version 2 on, version 1
+    //only has floats). Either can be read by either build, the positions are converted if they have to be.
+    //Numbers are stored as they are in memory, the header tells if the machine reading them stores them the other way around.
+    //Any change to the layout needs a new version
+    constexpr std::uint32_t version = 2;
+    constexpr std::uint32_t min_version = 1;
+
+    //What a snapshot holds besides the particles
+    class Info {
+
+    public:
+        std::uint64_t step = 0;     //Number of steps taken to get to the snapshot
+        double time = 0.0;          //Simulated time, in seconds
+
+        //Whether prev_a* is the gravity at exactly the stored positions, which block timesteps reuse instead of computing it again
+        bool accelerations_are_current = false;
+
+    };
+
+    //Writes the particles to path. They're written to path.tmp first and then renamed, so path always holds a whole snapshot, even if
+    //the program dies while writing. Prints an error and returns false if it fails
+    bool save(const char *path, const Particle::Store &particles, const Info &info);
+
+    //A snapshot file mapped into memory, read only. The columns are read straight from the mapping, without any copy in between
+    class MappedFile {
+
+        const unsigned char *data = NULL;
+        std::size_t n_bytes = 0;
+        bool is_mapped = false; //Without mmap the whole file is read into memory instead
+
+        std::size_t n_particles = 0;
+        std::size_t position_bytes = sizeof(float);
+        Info file_info;
+
+        void close();
+
+    public:
+
+        MappedFile() = default;
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        //Maps the file and checks its header and size. Prints an error and returns false if it isn't a snapshot this version can read
+        bool open(const char *path);
+
+        std::size_t size() const;
+        const Info &info() const;
+
+        //Column k of the layout above, valid while the file is open. Floats, except for the first 3 with has_double_positions
+        const void *column(std::size_t k) const;
+        const std::uint64_t *id_column() const;
+        bool has_double_positions() const;
+
+        //Copies every column into particles, replacing what was there
+        void read(Particle::Store &particles) const;
+
+    };
+
+    //Opens path and reads it into particles. Prints an error and returns false if it fails
+    bool load(const char *path, Particle::Store &particles, Info &info);
+
+    //Writes snapshots on a thread of its own, so the step loop never waits for the disk. save only copies the particles and hands them over.
+    //If the last snapshot is still being written, the new one replaces any that was waiting, only the latest one matters
+    class Checkpointer {
+
+        std::string path;
+        std::thread writer;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        Particle::Store pending;    //Filled by save, swapped with writing by the thread
+        Particle::Store writing;
+        Info pending_info;
+        bool has_pending = false;
+        bool stopping = false;
+        std::size_t n_written = 0;
+        std::size_t n_failed = 0;
+
+        void writer_loop();
+
+    public:
+
+        explicit Checkpointer(const std::string &path);
+        ~Checkpointer();
+
+        //Waits for the last snapshot it was given to be written, and stops the thread. save can't be called after
+        void finish();
+
+        Checkpointer(const Checkpointer&) = delete;
+        Checkpointer& operator=(const Checkpointer&) = delete;
+
+        void save(const Particle::Store &particles, const Info &info);
+
+        //Snapshots written so far, and ones that couldn't be
+        std::size_t written();
+        std::size_t failed();
+
+    };
+
+}
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "arguments.hpp"
+#include "gravity_kernels.hpp"
+#include "scenes.hpp"
+#include "simulation.hpp"
+
+namespace {
+
+    constexpr std::size_t n_repeats = 3;
+    constexpr std::size_t n_reference_particles = 1000;
+    constexpr std::size_t max_sweep_particles = 64000;
+    constexpr float sweep_thetas[] = {0.3f, 0.5f, 0.7f, 1.f, 1.3f};
+
+    //Fastest of a few runs of building the tree and computing gravity with the simulation's current solver
+    double time_gravity(Simulation::Simulation &simulation) {
+
+        double best_time = 0.0;
+
+        for (std::size_t repeat = 0; repeat < n_repeats; repeat++) {
+            Particle::Store &particles = simulation.particles;
+            std::fill(particles.ax.begin(), particles.ax.end(), 0.f);
+            std::fill(particles.ay.begin(), particles.ay.end(), 0.f);
+            std::fill(particles.az.begin(), particles.az.end(), 0.f);
+
+            auto start_time = std::chrono::steady_clock::now();
+            simulation.build_tree();
+            simulation.compute_accelerations();
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+            if (repeat == 0 || elapsed < best_time) best_time = elapsed;
+        }
+
+        return best_time;
+
+    }
+
+    //Mean relative error of the accelerations against a direct sum, for every stride'th particle
+    double mean_error(const Particle::Store &particles, const Kernels::Parameters &gravity, std::size_t stride) {
+
+        Kernels::Sources sources;
+        for (std::size_t i = 0; i < particles.size(); i++) sources.push_back(particles.x[i], particles.y[i], particles.z[i], particles.mass[i]);
+
+        double total_error = 0.0;
+        std::size_t n_checked = 0;
+
+        for (std::size_t i = 0; i < particles.size(); i += stride) {
+            float ax = 0.f, ay = 0.f, az = 0.f;
+            Kernels::accumulate_gravity(sources, particles.x[i], particles.y[i], particles.z[i], gravity, ax, ay, az);
+
+            double dx = particles.ax[i] - ax, dy = particles.ay[i] - ay, dz = particles.az[i] - az;
+            double reference = std::sqrt(static_cast<double>(ax)*ax + static_cast<double>(ay)*ay + static_cast<double>(az)*az);
+            total_error += std::sqrt(dx*dx + dy*dy + dz*dz) / reference;
+            n_checked++;
+        }
+
+        return total_error / static_cast<double>(n_checked);
+
+    }
+
+}
+
+//Times Barnes-Hut against the fast multipole method on the default scene, doubling the number of particles every row,
+//to find where the FMM starts to pay off. Both include building the tree.
+//Then sweeps the opening angle of Barnes-Hut with and without quadrupoles, for the accuracy each costs
+//Usage: gravity_solver_bench [max_particles] [n_threads]
+int main(int argc, char** argv) {
+
+    std::size_t max_particles = 256000;
+    std::size_t n_threads = 0;
+
+    std::vector<const char*> args = Arguments::positional(argc, argv);
+
+    if (args.size() >= 1 && !Arguments::parse_count(args[0], "particles", max_particles)) return EXIT_FAILURE;
+    if (args.size() >= 2 && !Arguments::parse_count(args[1], "threads", n_threads)) return EXIT_FAILURE;
+    if (n_threads == 0) n_threads = Simulation::default_thread_count();
+
+    Simulation::Simulation simulation(n_threads);
+
+    std::printf("Simulation using %zu threads, FMM theta %.2f.\n", simulation.thread_count(), simulation.fmm.theta);
+    std::printf("%10s %14s %10s %14s %10s %8s\n", "particles", "barnes-hut s", "error", "fmm s", "error", "speedup");
+
+    std::size_t crossover = 0;
+
+    for (std::size_t n_particles = 1000; n_particles <= max_particles; n_particles *= 2) {
+
+        simulation.particles = Scenes::two_spheres(n_particles);
+        std::size_t stride = std::max<std::size_t>(1, simulation.particles.size()/n_reference_particles);
+
+        simulation.solver = Simulation::Solver::barnes_hut;
+        double barnes_hut_time = time_gravity(simulation);
+        double barnes_hut_error = mean_error(simulation.particles, simulation.gravity, stride);
+
+        simulation.solver = Simulation::Solver::fmm;
+        double fmm_time = time_gravity(simulation);
+        double fmm_error = mean_error(simulation.particles, simulation.gravity, stride);
+
+        std::printf("%10zu %14.5f %10.5f %14.5f %10.5f %7.2fx\n", simulation.particles.size(), barnes_hut_time, barnes_hut_error,
+                fmm_time, fmm_error, barnes_hut_time/fmm_time);
+
+        if (crossover == 0 && fmm_time < barnes_hut_time) crossover = simulation.particles.size();
+        if (crossover != 0 && fmm_time >= barnes_hut_time) crossover = 0;
+
+    }
+
+    if (crossover != 0) {
+        std::printf("The FMM is faster from %zu particles on.\n", crossover);
+    }
+    else {
+        std::printf("The FMM doesn't stay faster than Barnes-Hut up to %zu particles.\n", max_particles);
+    }
+
+    simulation.particles = Scenes::two_spheres(std::min(max_particles, max_sweep_particles));
+    simulation.solver = Simulation::Solver::barnes_hut;
+    std::size_t stride = std::max<std::size_t>(1, simulation.particles.size()/n_reference_particles);
+
+    std::printf("\nBarnes-Hut with %zu particles:\n", simulation.particles.size());
+    std::printf("%8s %14s %10s %14s %10s\n", "theta", "monopole s", "error", "quadrupole s", "error");
+
+    for (float theta : sweep_thetas) {
+
+        simulation.bh_tree.theta = theta;
+
+        simulation.bh_tree.use_quadrupoles = false;
+        double monopole_time = time_gravity(simulation);
+        double monopole_error = mean_error(simulation.particles, simulation.gravity, stride);
+
+        simulation.bh_tree.use_quadrupoles = true;
+        double quadrupole_time = time_gravity(simulation);
+        double quadrupole_error = mean_error(simulation.particles, simulation.gravity, stride);
+
+        std::printf("%8.2f %14.5f %10.5f %14.5f %10.5f\n", theta, monopole_time, monopole_error, quadrupole_time, quadrupole_error);
+
+    }
+
+    return 0;
+
+}
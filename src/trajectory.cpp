@@ -0,0 +1,551 @@
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+#include "trajectory.hpp"
+
+namespace {
+
+    constexpr char file_magic[8] = {'G', 'R', 'A', 'V', 'T', 'R', 'A', 'J'};
+    constexpr char index_magic[8] = {'G', 'R', 'A', 'V', 'T', 'I', 'D', 'X'};
+    constexpr std::uint32_t chunk_magic = 0x4b4e4843;   //"CHNK"
+    constexpr std::uint32_t version = 1;
+    constexpr std::uint32_t byte_order_mark = 0x01020304;
+    constexpr std::uint32_t keyframe_flag = 1;
+
+    //Written as they are, laid out so that nothing needs padding
+    struct FileHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byte_order;
+        std::uint32_t fields;
+        float position_quantum;
+        float velocity_quantum;
+        std::uint32_t keyframe_interval;
+    };
+
+    struct ChunkHeader {
+        std::uint32_t magic;
+        std::uint32_t flags;
+        std::uint64_t step;
+        double time;
+        std::uint64_t n_particles;
+        std::uint64_t payload_bytes;
+    };
+
+    //Where the index starts, after the last chunk. The very end of a finished file
+    struct IndexTrailer {
+        std::uint64_t index_offset;
+        char magic[8];
+    };
+
+    static_assert(sizeof(FileHeader) == 32, "The trajectory header must be 32 bytes");
+    static_assert(sizeof(ChunkHeader) == 40, "The chunk header must be 40 bytes");
+    static_assert(sizeof(IndexTrailer) == 16, "The index trailer must be 16 bytes");
+
+    //Non-finite values, and ones too large to be a whole number of quanta, are stored as 0
+    std::int64_t quantize(double value, float quantum) {
+
+        double q = std::nearbyint(value/static_cast<double>(quantum));
+        if (!(std::fabs(q) < 9e18)) return 0;
+        return static_cast<std::int64_t>(q);
+
+    }
+
+    double dequantize(std::int64_t q, float quantum) {
+
+        return static_cast<double>(q)*static_cast<double>(quantum);
+
+    }
+
+    //Zigzag maps small negative numbers to small positive ones, and LEB128 stores 7 bits per byte, so a difference of up to ±63 takes one byte
+    void put_varint(std::vector<std::uint8_t> &buffer, std::int64_t value) {
+
+        std::uint64_t zigzag = (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+        while (zigzag >= 0x80) {
+            buffer.push_back(static_cast<std::uint8_t>(zigzag | 0x80));
+            zigzag >>= 7;
+        }
+        buffer.push_back(static_cast<std::uint8_t>(zigzag));
+
+    }
+
+    bool get_varint(const std::uint8_t *&pos, const std::uint8_t *end, std::int64_t &value) {
+
+        std::uint64_t zigzag = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (pos == end) return false;
+            std::uint8_t byte = *pos++;
+            zigzag |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                value = static_cast<std::int64_t>(zigzag >> 1) ^ -static_cast<std::int64_t>(zigzag & 1);
+                return true;
+            }
+        }
+        return false;
+
+    }
+
+    //Quantizes a column of floats or positions, and stores every value or its difference to the same particle in the frame before
+    template<typename T>
+    void put_column(std::vector<std::uint8_t> &buffer, const std::vector<T> &column, float quantum, bool is_keyframe, std::int64_t *previous) {
+
+        for (std::size_t i = 0; i < column.size(); i++) {
+            std::int64_t q = quantize(column[i], quantum);
+            put_varint(buffer, is_keyframe ? q : q - previous[i]);
+            previous[i] = q;
+        }
+
+    }
+
+    //Turns a column back from quanta into what the frame holds it as
+    template<typename T>
+    void get_column(std::vector<T> &column, const std::int64_t *values, std::size_t n, float quantum) {
+
+        column.resize(n);
+        for (std::size_t i = 0; i < n; i++) column[i] = static_cast<T>(dequantize(values[i], quantum));
+
+    }
+
+    std::size_t quantized_column_count(std::uint32_t fields) {
+
+        return (fields & Trajectory::Field::velocity) ? 6 : 3;
+
+    }
+
+}
+
+namespace Trajectory {
+
+    bool parse_fields(const char *list, std::uint32_t &fields) {
+
+        std::uint32_t parsed = 0;
+        std::string remaining = list;
+        while (true) {
+            std::size_t comma = remaining.find(',');
+            std::string name = remaining.substr(0, comma);
+
+            if (name == "velocity") parsed |= Field::velocity;
+            else if (name == "acceleration") parsed |= Field::prev_acceleration;
+            else if (name != "none") {
+                std::fprintf(stderr, "Error: Unknown trajectory field \"%s\" (velocity, acceleration or none)!\n", name.c_str());
+                return false;
+            }
+
+            if (comma == std::string::npos) break;
+            remaining.erase(0, comma + 1);
+        }
+
+        fields = parsed;
+        return true;
+
+    }
+
+    std::size_t Frame::size() const {
+
+        return x.size();
+
+    }
+
+    Writer::Writer(const char *path, const Settings &settings) : settings(settings) {
+
+        if (this->settings.keyframe_interval == 0) this->settings.keyframe_interval = 1;
+        if (this->settings.queue_size == 0) this->settings.queue_size = 1;
+
+        file = std::fopen(path, "wb");
+        if (!file) {
+            std::fprintf(stderr, "Error: Couldn't open \"%s\" to write the trajectory to!\n", path);
+            return;
+        }
+
+        FileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, file_magic, sizeof(file_magic));
+        header.version = version;
+        header.byte_order = byte_order_mark;
+        header.fields = this->settings.fields;
+        header.position_quantum = this->settings.position_quantum;
+        header.velocity_quantum = this->settings.velocity_quantum;
+        header.keyframe_interval = this->settings.keyframe_interval;
+        if (std::fwrite(&header, sizeof(header), 1, file) != 1) failed = true;
+
+        writer = std::thread(&Writer::writer_loop, this);
+
+    }
+
+    Writer::~Writer() {
+
+        finish();
+
+    }
+
+    bool Writer::is_open() const {
+
+        return file != NULL;
+
+    }
+
+    void Writer::write(const Particle::Store &particles, std::uint64_t step, double time) {
+
+        if (!file) return;
+
+        std::unique_ptr<Frame> frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (queue.size() >= settings.queue_size) {
+                auto start_time = std::chrono::steady_clock::now();
+                cv.wait(lock, [this]() { return queue.size() < settings.queue_size || failed; });
+                stall_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+            }
+            if (failed) return;
+
+            if (!free_frames.empty()) {
+                frame = std::move(free_frames.back());
+                free_frames.pop_back();
+            }
+        }
+        if (!frame) frame.reset(new Frame());
+
+        //The copy is all the step loop pays for, outside of the lock
+        frame->step = step;
+        frame->time = time;
+        frame->id.assign(particles.id.begin(), particles.id.end());
+        frame->x = particles.x;
+        frame->y = particles.y;
+        frame->z = particles.z;
+        if (settings.fields & Field::velocity) {
+            frame->vx = particles.vx;
+            frame->vy = particles.vy;
+            frame->vz = particles.vz;
+        }
+        if (settings.fields & Field::prev_acceleration) {
+            frame->prev_ax = particles.prev_ax;
+            frame->prev_ay = particles.prev_ay;
+            frame->prev_az = particles.prev_az;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(frame));
+        }
+        cv.notify_all();
+
+    }
+
+    void Writer::writer_loop() {
+
+        while (true) {
+
+            std::unique_ptr<Frame> frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (queue.empty()) return;  //Stopping, with nothing left to write
+                frame = std::move(queue.front());
+                queue.pop_front();
+            }
+
+            bool ok = write_frame(*frame);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                free_frames.push_back(std::move(frame));
+                if (!ok) failed = true;
+            }
+            cv.notify_all();
+
+        }
+
+    }
+
+    bool Writer::write_frame(const Frame &frame) {
+
+        std::size_t n = frame.size();
+        std::size_t n_columns = quantized_column_count(settings.fields);
+
+        bool is_keyframe = chunk_offsets.size() % settings.keyframe_interval == 0 || frame.id != previous_ids;
+        if (is_keyframe) previous_ids = frame.id;
+        previous_values.resize(n_columns*n, 0);
+
+        buffer.clear();
+        if (is_keyframe) {
+            std::uint64_t previous_id = 0;
+            for (std::uint64_t id : frame.id) {
+                put_varint(buffer, static_cast<std::int64_t>(id - previous_id));
+                previous_id = id;
+            }
+        }
+
+        //One column after the other, so the differences of neighbouring values look alike
+        const std::vector<Vectors::Coordinate> *positions[] = {&frame.x, &frame.y, &frame.z};
+        const std::vector<float> *velocities[] = {&frame.vx, &frame.vy, &frame.vz};
+        for (std::size_t c = 0; c < n_columns; c++) {
+            std::int64_t *previous = &previous_values[c*n];
+            if (c < 3) put_column(buffer, *positions[c], settings.position_quantum, is_keyframe, previous);
+            else put_column(buffer, *velocities[c - 3], settings.velocity_quantum, is_keyframe, previous);
+        }
+
+        if (settings.fields & Field::prev_acceleration) {
+            for (const std::vector<float> *column : {&frame.prev_ax, &frame.prev_ay, &frame.prev_az}) {
+                const std::uint8_t *bytes = reinterpret_cast<const std::uint8_t*>(column->data());
+                buffer.insert(buffer.end(), bytes, bytes + n*sizeof(float));
+            }
+        }
+
+        ChunkHeader header;
+        header.magic = chunk_magic;
+        header.flags = is_keyframe ? keyframe_flag : 0;
+        header.step = frame.step;
+        header.time = frame.time;
+        header.n_particles = n;
+        header.payload_bytes = buffer.size();
+
+        if (std::fwrite(&header, sizeof(header), 1, file) != 1) return false;
+        if (!buffer.empty() && std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) return false;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        chunk_offsets.push_back(sizeof(FileHeader) + n_bytes);
+        n_bytes += sizeof(header) + buffer.size();
+        return true;
+
+    }
+
+    bool Writer::finish() {
+
+        if (!file) return false;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        if (writer.joinable()) writer.join();
+
+        //Nothing else touches the file now
+        IndexTrailer trailer;
+        trailer.index_offset = sizeof(FileHeader) + n_bytes;
+        std::memcpy(trailer.magic, index_magic, sizeof(index_magic));
+
+        std::uint64_t n_frames = chunk_offsets.size();
+        bool ok = !failed;
+        ok = ok && std::fwrite(&n_frames, sizeof(n_frames), 1, file) == 1;
+        ok = ok && (n_frames == 0 || std::fwrite(chunk_offsets.data(), sizeof(std::uint64_t), n_frames, file) == n_frames);
+        ok = ok && std::fwrite(&trailer, sizeof(trailer), 1, file) == 1;
+        ok = std::fclose(file) == 0 && ok;
+        file = NULL;
+
+        if (!ok) std::fprintf(stderr, "Error: Couldn't write the whole trajectory!\n");
+        return ok;
+
+    }
+
+    std::size_t Writer::frames_written() {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        return chunk_offsets.size();
+
+    }
+
+    std::uint64_t Writer::bytes_written() {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        return n_bytes;
+
+    }
+
+    double Writer::stalled_seconds() const {
+
+        return stall_seconds;
+
+    }
+
+    const Settings &Writer::get_settings() const {
+
+        return settings;
+
+    }
+
+    Reader::~Reader() {
+
+        if (file) std::fclose(file);
+
+    }
+
+    bool Reader::open(const char *path) {
+
+        if (file) std::fclose(file);
+        chunk_offsets.clear();
+        last_frame = static_cast<std::size_t>(-1);
+
+        file = std::fopen(path, "rb");
+        if (!file) {
+            std::fprintf(stderr, "Error: Couldn't open the trajectory \"%s\"!\n", path);
+            return false;
+        }
+
+        FileHeader header;
+        if (std::fread(&header, sizeof(header), 1, file) != 1 || std::memcmp(header.magic, file_magic, sizeof(file_magic)) != 0) {
+            std::fprintf(stderr, "Error: \"%s\" isn't a trajectory!\n", path);
+            return false;
+        }
+        if (header.byte_order != byte_order_mark) {
+            std::fprintf(stderr, "Error: The trajectory \"%s\" was written by a machine with a different byte order!\n", path);
+            return false;
+        }
+        if (header.version != version) {
+            std::fprintf(stderr, "Error: The trajectory \"%s\" is version %u, only version %u can be read!\n", path, header.version, version);
+            return false;
+        }
+
+        settings.fields = header.fields;
+        settings.position_quantum = header.position_quantum;
+        settings.velocity_quantum = header.velocity_quantum;
+        settings.keyframe_interval = header.keyframe_interval;
+
+        std::fseek(file, 0, SEEK_END);
+        long length = std::ftell(file);
+        file_size = length > 0 ? static_cast<std::uint64_t>(length) : 0;
+
+        IndexTrailer trailer;
+        bool has_index = std::fseek(file, -static_cast<long>(sizeof(trailer)), SEEK_END) == 0 && std::fread(&trailer, sizeof(trailer), 1, file) == 1 &&
+                std::memcmp(trailer.magic, index_magic, sizeof(index_magic)) == 0;
+
+        std::uint64_t n_frames = 0;
+        if (has_index) {
+            has_index = std::fseek(file, static_cast<long>(trailer.index_offset), SEEK_SET) == 0 && std::fread(&n_frames, sizeof(n_frames), 1, file) == 1;
+        }
+        if (has_index && n_frames > file_size/sizeof(std::uint64_t)) has_index = false;
+        if (has_index) {
+            chunk_offsets.resize(n_frames);
+            has_index = n_frames == 0 || std::fread(chunk_offsets.data(), sizeof(std::uint64_t), n_frames, file) == n_frames;
+        }
+
+        //The writer didn't get to write the index, so every whole chunk is found by walking from one to the next. The last one may be cut short
+        if (!has_index) {
+            chunk_offsets.clear();
+            std::uint64_t offset = sizeof(FileHeader);
+            ChunkHeader chunk;
+            while (std::fseek(file, static_cast<long>(offset), SEEK_SET) == 0 && std::fread(&chunk, sizeof(chunk), 1, file) == 1 &&
+                    chunk.magic == chunk_magic && chunk.payload_bytes <= file_size - offset - sizeof(chunk)) {
+                chunk_offsets.push_back(offset);
+                offset += sizeof(chunk) + chunk.payload_bytes;
+            }
+        }
+
+        return true;
+
+    }
+
+    std::size_t Reader::frame_count() const {
+
+        return chunk_offsets.size();
+
+    }
+
+    const Settings &Reader::get_settings() const {
+
+        return settings;
+
+    }
+
+    bool Reader::is_keyframe(std::size_t frame_idx) {
+
+        ChunkHeader chunk;
+        if (std::fseek(file, static_cast<long>(chunk_offsets[frame_idx]), SEEK_SET) != 0 || std::fread(&chunk, sizeof(chunk), 1, file) != 1) return false;
+        return (chunk.flags & keyframe_flag) != 0;
+
+    }
+
+    bool Reader::read_chunk(std::size_t frame_idx, Frame &frame) {
+
+        ChunkHeader chunk;
+        std::uint64_t offset = chunk_offsets[frame_idx];
+        if (offset > file_size || file_size - offset < sizeof(chunk)) return false;
+        if (std::fseek(file, static_cast<long>(offset), SEEK_SET) != 0 || std::fread(&chunk, sizeof(chunk), 1, file) != 1 ||
+                chunk.magic != chunk_magic) return false;
+
+        //Every particle takes at least a byte of the payload, so neither can be larger than what's left of the file, and nothing below overflows
+        if (chunk.payload_bytes > file_size - offset - sizeof(chunk) || chunk.n_particles > chunk.payload_bytes) return false;
+
+        buffer.resize(chunk.payload_bytes);
+        if (chunk.payload_bytes > 0 && std::fread(buffer.data(), 1, buffer.size(), file) != buffer.size()) return false;
+
+        std::size_t n = chunk.n_particles;
+        std::size_t n_columns = quantized_column_count(settings.fields);
+        bool keyframe = (chunk.flags & keyframe_flag) != 0;
+        if (!keyframe && ids.size() != n) return false;
+
+        const std::uint8_t *pos = buffer.data();
+        const std::uint8_t *end = buffer.data() + buffer.size();
+
+        if (keyframe) {
+            ids.resize(n);
+            std::uint64_t id = 0;
+            for (std::size_t i = 0; i < n; i++) {
+                std::int64_t delta;
+                if (!get_varint(pos, end, delta)) return false;
+                id += static_cast<std::uint64_t>(delta);
+                ids[i] = id;
+            }
+        }
+
+        values.resize(n_columns*n, 0);
+        for (std::size_t k = 0; k < n_columns*n; k++) {
+            std::int64_t value;
+            if (!get_varint(pos, end, value)) return false;
+            values[k] = keyframe ? value : values[k] + value;
+        }
+
+        frame.prev_ax.clear();
+        frame.prev_ay.clear();
+        frame.prev_az.clear();
+        if (settings.fields & Field::prev_acceleration) {
+            if (static_cast<std::size_t>(end - pos) < 3*n*sizeof(float)) return false;
+            for (std::vector<float> *column : {&frame.prev_ax, &frame.prev_ay, &frame.prev_az}) {
+                column->resize(n);
+                if (n > 0) std::memcpy(column->data(), pos, n*sizeof(float));
+                pos += n*sizeof(float);
+            }
+        }
+
+        frame.step = chunk.step;
+        frame.time = chunk.time;
+        return true;
+
+    }
+
+    bool Reader::read_frame(std::size_t frame_idx, Frame &frame) {
+
+        if (!file || frame_idx >= chunk_offsets.size()) return false;
+
+        //Back to the closest keyframe, unless the frame read last is on the way
+        std::size_t first = frame_idx;
+        while (first > 0 && !(last_frame != static_cast<std::size_t>(-1) && last_frame == first - 1) && !is_keyframe(first)) first--;
+
+        for (std::size_t i = first; i <= frame_idx; i++) {
+            if (!read_chunk(i, frame)) {
+                last_frame = static_cast<std::size_t>(-1);
+                std::fprintf(stderr, "Error: Frame %zu of the trajectory is damaged!\n", i);
+                return false;
+            }
+            last_frame = i;
+        }
+
+        std::size_t n = ids.size();
+        frame.id = ids;
+
+        const std::size_t n_columns = quantized_column_count(settings.fields);
+        std::vector<Vectors::Coordinate> *positions[] = {&frame.x, &frame.y, &frame.z};
+        std::vector<float> *velocities[] = {&frame.vx, &frame.vy, &frame.vz};
+        for (std::size_t c = 0; c < 3; c++) get_column(*positions[c], &values[c*n], n, settings.position_quantum);
+        for (std::size_t c = 3; c < 6; c++) {
+            if (c < n_columns) get_column(*velocities[c - 3], &values[c*n], n, settings.velocity_quantum);
+            else velocities[c - 3]->clear();
+        }
+
+        return true;
+
+    }
+
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "particle_store.hpp"
+#include "vectors.hpp"
+
+namespace Trajectory {
+
+    //Fields a trajectory can hold besides the positions, which it always does
+    enum Field : std::uint32_t {
+        velocity = 1,
+        prev_acceleration = 2
+    };
+
+    //Reads a comma separated list of fields, "velocity" and "acceleration", or "none" for only the positions.
+    //Prints an error and returns false if a field is unknown
+    bool parse_fields(const char *list, std::uint32_t &fields);
+
+    class Settings {
+
+    public:
+        std::uint32_t fields = Field::velocity;
+
+        //Positions and velocities are stored as whole multiples of these, so they come back within half of one
+        float position_quantum = 1e-3f;
+        float velocity_quantum = 1e-3f;
+
+        //Every this many frames, a frame is stored as it is instead of as the difference to the one before, so reading a frame never has to
+        //go back further than that. A frame with other particles than the one before is always stored as it is
+        std::uint32_t keyframe_interval = 32;
+
+        //At most this many frames are waiting to be written. A step that would add one more waits for the writer instead
+        std::size_t queue_size = 4;
+
+    };
+
+    //The particles of one frame, in the order they were in the store
+    class Frame {
+
+    public:
+        std::uint64_t step = 0;
+        double time = 0.0;
+
+        std::vector<std::uint64_t> id;
+        std::vector<Vectors::Coordinate> x, y, z;       //As the store holds them, so double positions are quantized before they're narrowed
+        std::vector<float> vx, vy, vz;                  //Empty if the trajectory doesn't hold velocities
+        std::vector<float> prev_ax, prev_ay, prev_az;   //Empty if the trajectory doesn't hold accelerations
+
+        std::size_t size() const;
+
+    };
+
+    //Streams frames into a file of chunks, one per frame, with an index of where every chunk starts at the end.
+    //Positions and velocities are quantized, and every frame but the keyframes only stores how far every value moved since the frame before,
+    //as a variable length integer, which takes one or two bytes for most particles. Accelerations are stored as they are.
+    //write only copies the fields out of the particles. The encoding and the writing happen on a thread of their own
+    class Writer {
+
+        std::FILE *file = NULL;
+        Settings settings;
+        std::thread writer;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<std::unique_ptr<Frame>> queue;       //Frames waiting to be written, oldest first
+        std::vector<std::unique_ptr<Frame>> free_frames; //Written frames, reused so their arrays don't have to be allocated again
+        bool stopping = false;
+        bool failed = false;
+
+        //Only changed by the writer thread, under mutex, so the writer thread can read them without it and every other thread with it
+        std::vector<std::uint64_t> chunk_offsets;
+        std::uint64_t n_bytes = 0;
+
+        //Only touched by the writer thread until it's done
+        std::vector<std::uint64_t> previous_ids;
+        std::vector<std::int64_t> previous_values;  //Quantized values of the last frame, to take the differences against
+        std::vector<std::uint8_t> buffer;
+
+        double stall_seconds = 0.0;
+
+        void writer_loop();
+        bool write_frame(const Frame &frame);
+
+    public:
+
+        //Prints an error if the file can't be opened, is_open tells if it was
+        Writer(const char *path, const Settings &settings);
+        ~Writer();
+
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+
+        bool is_open() const;
+
+        //Copies the fields of the settings out of the particles and queues them. Only waits if queue_size frames are already waiting
+        void write(const Particle::Store &particles, std::uint64_t step, double time);
+
+        //Writes every frame still waiting and then the index, and closes the file. Returns false if anything couldn't be written.
+        //write can't be called after
+        bool finish();
+
+        std::size_t frames_written();
+        std::uint64_t bytes_written();  //Of the frames, without the header and the index
+        double stalled_seconds() const; //Time write spent waiting for room in the queue
+        const Settings &get_settings() const;
+
+    };
+
+    //Reads a trajectory, any frame in any order
+    class Reader {
+
+        std::FILE *file = NULL;
+        std::uint64_t file_size = 0;    //What every count and length read from the file is checked against before it's used
+        Settings settings;
+        std::vector<std::uint64_t> chunk_offsets;
+        std::vector<std::uint8_t> buffer;
+        std::vector<std::uint64_t> ids;     //Of the frame read last
+        std::vector<std::int64_t> values;   //Quantized values of the frame read last
+        std::size_t last_frame = static_cast<std::size_t>(-1);
+
+        bool is_keyframe(std::size_t frame_idx);
+        bool read_chunk(std::size_t frame_idx, Frame &frame);
+
+    public:
+
+        Reader() = default;
+        ~Reader();
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        //Reads the header and the index. A file whose writer never finished has no index, and is scanned chunk by chunk instead.
+        //Prints an error and returns false if it isn't a trajectory this version can read
+        bool open(const char *path);
+
+        std::size_t frame_count() const;
+        const Settings &get_settings() const;
+
+        //Decodes from the closest keyframe at or before frame_idx, or from the frame read last if that's closer
+        bool read_frame(std::size_t frame_idx, Frame &frame);
+
+    };
+
+}
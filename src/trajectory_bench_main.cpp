@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "arguments.hpp"
+#include "profiling.hpp"
+#include "scenes.hpp"
+#include "simulation.hpp"
+#include "trajectory.hpp"
+
+namespace {
+
+    constexpr float delta_time = 1.f/60.f;
+    constexpr std::size_t sample_stride = 997;  //Every this many particles are kept to check the frames read back against
+
+    //The positions and velocities of the sampled particles in one frame, as the store holds them
+    class Sample {
+
+    public:
+        std::vector<double> values;
+
+    };
+
+    Sample take_sample(const Particle::Store &particles) {
+
+        Sample sample;
+        for (std::size_t i = 0; i < particles.size(); i += sample_stride) {
+            sample.values.insert(sample.values.end(), {static_cast<double>(particles.x[i]), static_cast<double>(particles.y[i]), static_cast<double>(particles.z[i]),
+                static_cast<double>(particles.vx[i]), static_cast<double>(particles.vy[i]), static_cast<double>(particles.vz[i])});
+        }
+        return sample;
+
+    }
+
+    //How far a value read back is from the one written, in quanta. Half a quantum from rounding, and a little more from storing the
+    //value read back as a float, or as a double with double positions, again
+    template<typename T>
+    double error_in_quanta(double written, T read, float quantum) {
+
+        double slack = std::fabs(written)*static_cast<double>(std::numeric_limits<T>::epsilon());
+        return (std::fabs(static_cast<double>(read) - static_cast<double>(written)) - slack)/static_cast<double>(quantum);
+
+    }
+
+}
+
+//Streams frames of a Plummer sphere into a trajectory and reads them back in random order. Tells how long the step loop waited for the writer,
+//how small the frames get, how long reading a frame takes, and checks every value read back is within half a quantum of the one written.
+//Between frames the particles take --steps-between-frames real steps, or only drift along their velocities without it, which gives the writer
+//the least time to keep up
+//Usage: gravity_trajectory_bench [n_particles] [n_frames] [n_threads] [--steps-between-frames=<n>] [--trajectory-fields=<list>] [--output=<file>]
+int main(int argc, char** argv) {
+
+    std::size_t n_particles = 1000000;
+    std::size_t n_frames = 64;
+    std::size_t steps_between_frames = 0;
+    std::size_t n_threads = 0;
+
+    std::vector<const char*> args = Arguments::positional(argc, argv);
+
+    if (args.size() >= 1 && !Arguments::parse_count(args[0], "particles", n_particles)) return EXIT_FAILURE;
+    if (args.size() >= 2 && !Arguments::parse_count(args[1], "frames", n_frames)) return EXIT_FAILURE;
+    if (args.size() >= 3 && !Arguments::parse_count(args[2], "threads", n_threads)) return EXIT_FAILURE;
+    if (n_threads == 0) n_threads = Simulation::default_thread_count();
+
+    const char *steps = Arguments::find_option(argc, argv, "steps-between-frames");
+    if (steps && !Arguments::parse_count(steps, "steps between frames", steps_between_frames)) return EXIT_FAILURE;
+
+    Trajectory::Settings settings;
+    const char *fields = Arguments::find_option(argc, argv, "trajectory-fields");
+    if (fields && !Trajectory::parse_fields(fields, settings.fields)) return EXIT_FAILURE;
+
+    const char *output = Arguments::find_option(argc, argv, "output");
+    const char *path = output ? output : "gravity_trajectory_bench.traj";
+
+    Simulation::Simulation simulation(n_threads);
+    simulation.particles = Scenes::plummer(n_particles, simulation.gravity.G);
+    Particle::Store &particles = simulation.particles;
+
+    bool has_velocity = (settings.fields & Trajectory::Field::velocity) != 0;
+    std::size_t n_stored_floats = 3 + (has_velocity ? 3 : 0) + ((settings.fields & Trajectory::Field::prev_acceleration) ? 3 : 0);
+
+    std::printf("Writing %zu frames of %zu particles to \"%s\", %zu steps between frames with %zu threads.\n", n_frames, particles.size(), path,
+            steps_between_frames, simulation.thread_count());
+
+    std::vector<Sample> samples;
+    double step_seconds = 0.0;
+    double write_seconds = 0.0;
+    double finish_seconds = 0.0;
+    double stall_seconds = 0.0;
+    std::uint64_t n_bytes = 0;
+
+    {
+        Trajectory::Writer writer(path, settings);
+        if (!writer.is_open()) return EXIT_FAILURE;
+
+        for (std::size_t frame = 0; frame < n_frames; frame++) {
+            {
+                Profiling::ScopedTimer timer(step_seconds);
+                if (steps_between_frames == 0) {
+                    for (std::size_t i = 0; i < particles.size(); i++) {
+                        particles.x[i] += particles.vx[i]*delta_time;
+                        particles.y[i] += particles.vy[i]*delta_time;
+                        particles.z[i] += particles.vz[i]*delta_time;
+                    }
+                }
+                for (std::size_t i = 0; i < steps_between_frames; i++) simulation.step(delta_time);
+            }
+
+            samples.push_back(take_sample(particles));
+
+            Profiling::ScopedTimer timer(write_seconds);
+            writer.write(particles, frame, static_cast<double>(frame)*delta_time);
+        }
+
+        {
+            Profiling::ScopedTimer timer(finish_seconds);
+            if (!writer.finish()) return EXIT_FAILURE;
+        }
+        stall_seconds = writer.stalled_seconds();
+        n_bytes = writer.bytes_written();
+    }
+
+    double frames = static_cast<double>(n_frames);
+    double raw_bytes = frames*static_cast<double>(particles.size()*n_stored_floats*sizeof(float));
+    std::printf("Per frame: %.3f ms to move the particles, %.3f ms in write, %.3f ms of that waiting for the writer.\n",
+            step_seconds/frames*1000.0, write_seconds/frames*1000.0, stall_seconds/frames*1000.0);
+    std::printf("Waited %.3f ms for the last frames to be written after the loop.\n", finish_seconds*1000.0);
+    std::printf("%.2f bytes per particle and frame, %.2fx smaller than %zu raw floats.\n", static_cast<double>(n_bytes)/(frames*particles.size()),
+            raw_bytes/static_cast<double>(n_bytes), n_stored_floats);
+
+    Trajectory::Reader reader;
+    if (!reader.open(path)) return EXIT_FAILURE;
+    if (reader.frame_count() != n_frames) {
+        std::fprintf(stderr, "Error: Read back %zu frames, not %zu!\n", reader.frame_count(), n_frames);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::size_t> order(n_frames);
+    for (std::size_t i = 0; i < n_frames; i++) order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(3));
+
+    Trajectory::Frame frame;
+    double read_seconds = 0.0;
+    double worst_error = 0.0;
+    for (std::size_t frame_idx : order) {
+
+        {
+            Profiling::ScopedTimer timer(read_seconds);
+            if (!reader.read_frame(frame_idx, frame)) return EXIT_FAILURE;
+        }
+
+        if (frame.step != frame_idx || frame.size() != particles.size()) {
+            std::fprintf(stderr, "Error: Frame %zu was read back as step %llu with %zu particles!\n", frame_idx,
+                    static_cast<unsigned long long>(frame.step), frame.size());
+            return EXIT_FAILURE;
+        }
+
+        const std::vector<double> &expected = samples[frame_idx].values;
+        for (std::size_t i = 0, k = 0; i < frame.size(); i += sample_stride, k += 6) {
+            if (frame.id[i] != particles.id[i]) {
+                std::fprintf(stderr, "Error: Particle %zu of frame %zu has the wrong id!\n", i, frame_idx);
+                return EXIT_FAILURE;
+            }
+
+            const Vectors::Coordinate read[] = {frame.x[i], frame.y[i], frame.z[i]};
+            for (std::size_t c = 0; c < 3; c++) worst_error = std::max(worst_error, error_in_quanta(expected[k + c], read[c], settings.position_quantum));
+            if (has_velocity) {
+                const float read_v[] = {frame.vx[i], frame.vy[i], frame.vz[i]};
+                for (std::size_t c = 0; c < 3; c++) {
+                    worst_error = std::max(worst_error, error_in_quanta(expected[k + 3 + c], read_v[c], settings.velocity_quantum));
+                }
+            }
+        }
+
+    }
+
+    std::printf("Read every frame back in random order, %.3f ms per frame, worst error %.3f quanta.\n", read_seconds/frames*1000.0, worst_error);
+    if (!output) std::remove(path);
+
+    if (worst_error > 0.5) {
+        std::fprintf(stderr, "Error: A value was read back more than half a quantum off!\n");
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+
+}
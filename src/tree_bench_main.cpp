@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "arguments.hpp"
+#include "barnes_hut.hpp"
+#include "gravity_kernels.hpp"
+#include "parallel.hpp"
+#include "scenes.hpp"
+
+namespace {
+
+    constexpr std::size_t particle_counts[] = {10000, 100000, 1000000};
+
+    //From this many particles on, only every walk_stride-th particle walks the tree, and the traversal time is scaled up to all of them
+    constexpr std::size_t strided_particles = 1000000;
+    constexpr std::size_t walk_stride = 10;
+
+    constexpr std::size_t walk_grain_size = 64;
+
+    //Median of the times, which one run disturbed by the rest of the machine doesn't move the way it moves the mean
+    double median(std::vector<double> times) {
+
+        std::sort(times.begin(), times.end());
+        std::size_t n = times.size();
+        return n % 2 == 1 ? times[n/2] : 0.5*(times[n/2 - 1] + times[n/2]);
+
+    }
+
+}
+
+//Times building the Barnes-Hut tree and walking it once for every particle, one walk per particle without groups, for the default scene
+//of 10k, 100k and 1M particles. Every size is built and walked n_repeats times, and the fastest and the median run are printed, since the
+//spread between runs on a busy machine is easily larger than the difference between two versions of the tree
+//Usage: gravity_tree_bench [max_particles] [n_repeats] [n_threads]
+int main(int argc, char** argv) {
+
+    std::size_t max_particles = 1000000;
+    std::size_t n_repeats = 5;
+    std::size_t n_threads = 1;
+
+    std::vector<const char*> args = Arguments::positional(argc, argv);
+
+    if (args.size() >= 1 && !Arguments::parse_count(args[0], "particles", max_particles)) return EXIT_FAILURE;
+    if (args.size() >= 2 && !Arguments::parse_count(args[1], "repeats", n_repeats)) return EXIT_FAILURE;
+    if (args.size() >= 3 && !Arguments::parse_count(args[2], "threads", n_threads)) return EXIT_FAILURE;
+
+    Parallel::ThreadPool pool(n_threads);
+    Kernels::Parameters gravity;
+    BarnesHut::Tree tree;
+
+    std::printf("Building and walking the tree %zu times on %zu threads, theta %.2f, up to %zu particles per leaf.\n", n_repeats, pool.size(),
+            tree.theta, tree.leaf_size);
+    std::printf("%10s %8s %12s %12s %16s %16s\n", "particles", "nodes", "build min", "build median", "traversal min", "traversal median");
+
+    for (std::size_t n_particles : particle_counts) {
+
+        if (n_particles > max_particles) break;
+
+        Particle::Store particles = Scenes::two_spheres(n_particles);
+        std::size_t stride = n_particles >= strided_particles ? walk_stride : 1;
+        std::size_t n_walks = (particles.size() + stride - 1)/stride;
+
+        std::vector<double> build_times, traversal_times;
+        for (std::size_t repeat = 0; repeat < n_repeats; repeat++) {
+
+            auto start_time = std::chrono::steady_clock::now();
+            tree.build(particles, pool);
+            auto built_time = std::chrono::steady_clock::now();
+
+            pool.for_each_range(n_walks, walk_grain_size, [&](std::size_t lower_limit, std::size_t upper_limit) {
+                static thread_local Kernels::Sources sources;
+                static thread_local Kernels::Multipoles multipoles;
+                for (std::size_t k = lower_limit; k <= upper_limit; k++) tree.apply_gravity(particles, k*stride, gravity, sources, multipoles);
+            });
+            auto walked_time = std::chrono::steady_clock::now();
+
+            build_times.push_back(std::chrono::duration<double>(built_time - start_time).count());
+            traversal_times.push_back(std::chrono::duration<double>(walked_time - built_time).count()*static_cast<double>(stride));
+
+        }
+
+        std::printf("%10zu %8zu %9.1f ms %9.1f ms %13.1f ms %13.1f ms\n", particles.size(), tree.get_nodes().size(),
+                *std::min_element(build_times.begin(), build_times.end())*1000.0, median(build_times)*1000.0,
+                *std::min_element(traversal_times.begin(), traversal_times.end())*1000.0, median(traversal_times)*1000.0);
+
+    }
+
+    return 0;
+
+}
@@ -52,8 +52,10 @@ namespace Vectors {
 
     }
 
+#ifndef GRAVITY_SIM_HEADLESS
     Vec3::operator Vector3() const {
         return {x, y, z};
     }
+#endif
 
 }
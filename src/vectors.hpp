@@ -1,6 +1,8 @@
 #pragma once
 
+#ifndef GRAVITY_SIM_HEADLESS
 #include "raylib.h"
+#endif
 
 namespace Vectors {
 
@@ -24,8 +26,61 @@ namespace Vectors {
 
         Vec3 lerp(const Vec3 &v, float t) const;
 
+#ifndef GRAVITY_SIM_HEADLESS
         operator Vector3() const;
+#endif
 
     };
 
+    //What particle positions are stored as. float by default, double when compiled with GRAVITY_SIM_DOUBLE_POSITIONS, for scenes so wide
+    //that a float far from the origin can't tell close particles apart. Velocities, accelerations and every offset forces are computed
+    //from stay float either way
+#ifdef GRAVITY_SIM_DOUBLE_POSITIONS
+    using Coordinate = double;
+#else
+    using Coordinate = float;
+#endif
+
+    //A position with Real components. The difference of two is a Vec3, computed in Real before it's rounded to float, so offsets between
+    //close points keep their precision however far from the origin the points are
+    template <typename Real>
+    class BasicPoint {
+
+    public:
+        Real x, y, z;
+
+        Vec3 operator-(const BasicPoint &p) const {
+            return {static_cast<float>(x-p.x), static_cast<float>(y-p.y), static_cast<float>(z-p.z)};
+        }
+
+        BasicPoint operator+(const Vec3 &v) const {
+            return {x+v.x, y+v.y, z+v.z};
+        }
+
+        //For sums of positions weighted by mass
+        BasicPoint operator+(const BasicPoint &p) const {
+            return {x+p.x, y+p.y, z+p.z};
+        }
+
+        BasicPoint operator*(const Real s) const {
+            return {x*s, y*s, z*s};
+        }
+
+        BasicPoint operator/(const Real s) const {
+            return {x/s, y/s, z/s};
+        }
+
+        float dist(const BasicPoint &p) const {
+            return (p - *this).length();
+        }
+
+        //Rounded to float, for drawing and for anything that only needs a rough position
+        Vec3 rounded() const {
+            return {static_cast<float>(x), static_cast<float>(y), static_cast<float>(z)};
+        }
+
+    };
+
+    using Point = BasicPoint<Coordinate>;
+
 }